@@ -0,0 +1,155 @@
+/*
+Recording the messages from the caller to a file, and playing them back in
+place of the caller. Used to benchmark the driver against real traffic.
+
+A capture file is a header followed by one record per message. Each record
+is the time it arrived in microseconds since recording started, the length
+of the message, then the message itself. Everything is native endian, so
+play a capture back on the same kind of machine it was recorded on.
+
+Both run on the reader thread.
+*/
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CAPTURE_MAGIC 0x53475231
+
+PACK(typedef struct capture_record_t
+{
+  uint64_t time;
+  uint32_t length;
+}) capture_record_t;
+
+static FILE*  p_record_file = NULL;
+static double record_start  = 0;
+
+static FILE*    p_replay_file = NULL;
+static bool     replay_fast   = false;
+static double   replay_start  = 0;
+static byte*    p_replay_buf  = NULL;
+static uint32_t replay_size   = 0;
+static uint32_t replay_count  = 0;
+
+//=============================================================================
+// recording
+
+//---------------------------------------------------------
+bool start_recording(const char* path)
+{
+  p_record_file = fopen(path, "wb");
+  if (p_record_file == NULL)
+    return false;
+
+  uint32_t magic = CAPTURE_MAGIC;
+  fwrite(&magic, sizeof(uint32_t), 1, p_record_file);
+  record_start = glfwGetTime();
+  return true;
+}
+
+//---------------------------------------------------------
+bool recording()
+{
+  return p_record_file != NULL;
+}
+
+//---------------------------------------------------------
+// write one message, gathered from several pieces
+void record_parts(out_part_t* p_parts, int count)
+{
+  if (p_record_file == NULL)
+    return;
+
+  capture_record_t record = {(glfwGetTime() - record_start) * 1000000, 0};
+  for (int i = 0; i < count; i++)
+    record.length += p_parts[i].length;
+
+  fwrite(&record, sizeof(capture_record_t), 1, p_record_file);
+  for (int i = 0; i < count; i++)
+    fwrite(p_parts[i].p_data, 1, p_parts[i].length, p_record_file);
+
+  // the driver can exit without the reader thread finishing
+  fflush(p_record_file);
+}
+
+//---------------------------------------------------------
+void stop_recording()
+{
+  if (p_record_file == NULL)
+    return;
+
+  fclose(p_record_file);
+  p_record_file = NULL;
+}
+
+//=============================================================================
+// replay
+
+//---------------------------------------------------------
+// fast plays the messages back as quickly as they can be taken, instead of
+// at the speed they were recorded
+bool start_replay(const char* path, bool fast)
+{
+  p_replay_file = fopen(path, "rb");
+  if (p_replay_file == NULL)
+    return false;
+
+  uint32_t magic = 0;
+  if (fread(&magic, sizeof(uint32_t), 1, p_replay_file) != 1 ||
+      magic != CAPTURE_MAGIC)
+  {
+    fclose(p_replay_file);
+    p_replay_file = NULL;
+    return false;
+  }
+
+  replay_fast  = fast;
+  replay_start = glfwGetTime();
+  return true;
+}
+
+//---------------------------------------------------------
+bool replaying()
+{
+  return p_replay_file != NULL;
+}
+
+//---------------------------------------------------------
+// the next message from the capture, in place of read_msg. Waits until it is
+// due. The data is only valid until the next call. Returns false at the end.
+bool read_replay(msg_cursor_t* p_msg)
+{
+  capture_record_t record;
+  if (fread(&record, sizeof(capture_record_t), 1, p_replay_file) != 1)
+  {
+    fprintf(stderr, "replay: %u messages in %.3fs\n", replay_count,
+            glfwGetTime() - replay_start);
+    return false;
+  }
+
+  if (record.length > replay_size)
+  {
+    byte* p_buf = realloc(p_replay_buf, record.length);
+    if (p_buf == NULL)
+      return false;
+    p_replay_buf = p_buf;
+    replay_size  = record.length;
+  }
+
+  if (fread(p_replay_buf, 1, record.length, p_replay_file) != record.length)
+    return false;
+
+  while (!replay_fast &&
+         (glfwGetTime() - replay_start) * 1000000 < record.time)
+  {
+    comms_backoff();
+  }
+
+  p_msg->p_data = p_replay_buf;
+  p_msg->length = record.length;
+  p_msg->offset = 0;
+  replay_count++;
+  return true;
+}
@@ -0,0 +1,20 @@
+/*
+Recording the messages from the caller to a file, and playing them back in
+place of the caller. Used to benchmark the driver against real traffic.
+*/
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include "comms.h"
+
+bool start_recording(const char* path);
+bool recording();
+void record_parts(out_part_t* p_parts, int count);
+void stop_recording();
+
+bool start_replay(const char* path, bool fast);
+bool replaying();
+bool read_replay(msg_cursor_t* p_msg);
+
+#endif
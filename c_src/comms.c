@@ -14,7 +14,12 @@ The caller will typically be erlang, so use the 2-byte length indicator
 #include <stdlib.h>
 #include <string.h>
 
+#include "capture.h"
+#include "damage.h"
 #include "render_script.h"
+#include "retained.h"
+#include "script_cache.h"
+#include "text_cache.h"
 #include "tx.h"
 #include "types.h"
 #include "utils.h"
@@ -27,6 +32,7 @@ The caller will typically be erlang, so use the 2-byte length indicator
 #define MSG_OUT_RESHAPE 0x05
 #define MSG_OUT_READY 0x06
 #define MSG_OUT_DRAW_READY 0x07
+#define MSG_OUT_SCRIPT_MISS 0x08
 
 #define MSG_OUT_KEY 0x0A
 #define MSG_OUT_CODEPOINT 0x0B
@@ -35,6 +41,7 @@ The caller will typically be erlang, so use the 2-byte length indicator
 #define MSG_OUT_MOUSE_SCROLL 0x0E
 #define MSG_OUT_CURSOR_ENTER 0x0F
 #define MSG_OUT_DROP_PATHS 0x10
+#define MSG_OUT_EVENT_BATCH 0x11
 #define MSG_OUT_STATIC_TEXTURE_MISS 0x20
 #define MSG_OUT_DYNAMIC_TEXTURE_MISS 0x21
 
@@ -43,9 +50,31 @@ The caller will typically be erlang, so use the 2-byte length indicator
 #define MSG_OUT_NEW_TX_ID 0x31
 #define MSG_OUT_NEW_FONT_ID 0x32
 
+// the ready message tells the caller which version of the protocol this is,
+// which of the optional commands and transports it can use, and the limits
+// it has to stay inside. Bump the version for changes that aren't optional.
+#define PROTOCOL_VERSION 1
+
+#define CAP_SHM 0x01
+#define CAP_BATCH 0x02
+#define CAP_PATCH_SCRIPT 0x04
+#define CAP_EVENT_BATCH 0x08
+#define CAP_TX_CHUNKS 0x10
+
+#define CAPABILITIES \
+  (CAP_BATCH | CAP_PATCH_SCRIPT | CAP_EVENT_BATCH | CAP_TX_CHUNKS)
+
+// script encodings run_script understands
+#define ENCODING_OPS 0x01
+#define ENCODING_INSTANCES 0x02
+#define ENCODING_POLYLINES 0x04
+
+#define ENCODINGS (ENCODING_OPS | ENCODING_INSTANCES | ENCODING_POLYLINES)
+
 #define CMD_RENDER_GRAPH 0x01
 #define CMD_CLEAR_GRAPH 0x02
 #define CMD_SET_ROOT 0x03
+#define CMD_PATCH_SCRIPT 0x04
 
 #define CMD_CLEAR_COLOR 0x05
 
@@ -67,13 +96,34 @@ The caller will typically be erlang, so use the 2-byte length indicator
 #define CMD_PUT_TX_BLOB 0x34
 #define CMD_PUT_TX_RAW 0x35
 
+#define CMD_PUT_TX_BEGIN 0x3A
+#define CMD_PUT_TX_CHUNK 0x3B
+#define CMD_PUT_TX_COMMIT 0x3C
+
 #define CMD_LOAD_FONT_FILE 0X37
 #define CMD_LOAD_FONT_BLOB 0X38
 #define CMD_FREE_FONT 0X39
 
+#define CMD_SHM_MSG 0x40
+#define CMD_BATCH 0x41
+
 // here to test recovery
 #define CMD_CRASH 0xFE
 
+// incoming messages are dispatched by lane, in this order. Control messages
+// are small and go first, then scripts. Bulk resources (fonts and textures)
+// get whatever time is left in the frame, so one big upload can't hold up
+// the messages behind it.
+#define LANE_CONTROL 0
+#define LANE_SCRIPTS 1
+#define LANE_BULK 2
+#define LANE_COUNT 3
+
+static uint32_t get_lane_depth(int lane);
+
+// set when a miss wasn't sent because the bulk lane was busy
+static bool miss_held = false;
+
 // handy time definitions in microseconds
 #define MILLISECONDS_8 8000
 #define MILLISECONDS_16 16000
@@ -114,43 +164,209 @@ void swap_little_endian_uint(uint32_t* target) {
 }
 }
 
+//=============================================================================
+// outgoing message buffer
+//
+// Messages going up to the caller are collected here over one pass of the
+// main loop and go out together when it calls flush_frame_msgs, instead of
+// each one being written separately. The buffer is flushed early if it fills.
+
+#define OUT_BUFFER_SIZE 0x8000
+
+static byte     out_buffer[OUT_BUFFER_SIZE];
+static uint32_t out_used = 0;
+
+static out_stats_t out_frame = {0, 0, 0};
+static out_stats_t out_last  = {0, 0, 0};
+
 //---------------------------------------------------------
-// the length indicator from erlang is always big-endian
-int write_cmd(byte* buf, unsigned int len)
+static void write_out_parts(out_part_t* p_parts, int count)
+{
+  size_t total = 0;
+  for (int i = 0; i < count; i++)
+    total += p_parts[i].length;
+  if (total == 0)
+    return;
+
+  write_parts(p_parts, count);
+  out_frame.bytes += total;
+  out_frame.writes++;
+}
+
+//---------------------------------------------------------
+static void write_out_buffer()
 {
-  int written = 0;
+  out_part_t part = {out_buffer, out_used};
+  write_out_parts(&part, 1);
+  out_used = 0;
+}
+
+static void flush_events();
 
-  // since this can be called from both the main and comms thread, need to
-  // synchronize it
-  // if ( pthread_rwlock_wrlock(&comms_out_lock) == 0 ) {
+//---------------------------------------------------------
+void flush_msgs()
+{
+  flush_events();
+  write_out_buffer();
+}
+
+//---------------------------------------------------------
+// called once at the end of every pass of the main loop
+void flush_frame_msgs()
+{
+  flush_msgs();
+  out_last  = out_frame;
+  out_frame = (out_stats_t){0, 0, 0};
+}
+
+//---------------------------------------------------------
+out_stats_t get_out_stats()
+{
+  return out_last;
+}
+
+//---------------------------------------------------------
+// queue one message. p_msg starts with the message id and p_tail is any
+// variable length data (strings, etc) that follows it.
+// the length indicator from erlang is always big-endian
+static void queue_msg(const void* p_msg, uint32_t msg_len, const void* p_tail,
+                      uint32_t tail_len)
+{
+  uint32_t len     = msg_len + tail_len;
   uint32_t len_big = len;
   if (f_little_endian)
     len_big = SWAP_UINT32(len_big);
-  write_exact((byte*) &len_big, sizeof(uint32_t));
-  written = write_exact(buf, len);
 
-  return written;
+  out_frame.msgs++;
+
+  if (out_used + sizeof(uint32_t) + len > OUT_BUFFER_SIZE)
+  {
+    if (sizeof(uint32_t) + len > OUT_BUFFER_SIZE / 2)
+    {
+      // too big to be worth copying. send it along with whatever is already
+      // waiting in one gathered write
+      out_part_t parts[4] = {{out_buffer, out_used},
+                             {&len_big, sizeof(uint32_t)},
+                             {p_msg, msg_len},
+                             {p_tail, tail_len}};
+      write_out_parts(parts, 4);
+      out_used = 0;
+      return;
+    }
+    write_out_buffer();
+  }
+
+  memcpy(out_buffer + out_used, &len_big, sizeof(uint32_t));
+  out_used += sizeof(uint32_t);
+  memcpy(out_buffer + out_used, p_msg, msg_len);
+  out_used += msg_len;
+  if (tail_len > 0)
+  {
+    memcpy(out_buffer + out_used, p_tail, tail_len);
+    out_used += tail_len;
+  }
+}
+
+//---------------------------------------------------------
+void write_cmd(byte* buf, unsigned int len)
+{
+  queue_msg(buf, len, NULL, 0);
+}
+
+//=============================================================================
+// input events
+//
+// Input events from one pass of the main loop go up together in a single
+// MSG_OUT_EVENT_BATCH as an array of fixed size records. Each record is the
+// id the event would have been sent with on its own, the time it happened in
+// seconds from glfwGetTime, and the event's own fields padded out to size.
+
+#define EVENT_DATA_SIZE 20
+#define EVENT_BATCH_SIZE 128
+
+PACK(typedef struct event_record_t
+{
+  uint32_t msg_id;
+  double   time;
+  byte     data[EVENT_DATA_SIZE];
+}) event_record_t;
+
+static event_record_t event_batch[EVENT_BATCH_SIZE];
+static uint32_t       event_count = 0;
+
+//---------------------------------------------------------
+static void flush_events()
+{
+  if (event_count == 0)
+    return;
+
+  uint32_t msg_id = MSG_OUT_EVENT_BATCH;
+  queue_msg(&msg_id, sizeof(uint32_t), event_batch,
+            event_count * sizeof(event_record_t));
+  event_count = 0;
 }
 
 //---------------------------------------------------------
-bool read_bytes_down(void* p_buff, int bytes_to_read, int* p_bytes_to_remaining)
+// p_msg is laid out like a message of its own, starting with the id
+static void queue_event(const void* p_msg, uint32_t msg_len, double time)
 {
-  if (p_bytes_to_remaining <= 0)
+  if (event_count == EVENT_BATCH_SIZE)
+    flush_events();
+
+  event_record_t* p_event = &event_batch[event_count++];
+  memset(p_event, 0, sizeof(event_record_t));
+  memcpy(&p_event->msg_id, p_msg, sizeof(uint32_t));
+  p_event->time = time;
+  memcpy(p_event->data, (const byte*) p_msg + sizeof(uint32_t),
+         msg_len - sizeof(uint32_t));
+}
+
+//=============================================================================
+// bounds checked reads out of an incoming message
+
+//---------------------------------------------------------
+uint32_t bytes_remaining(msg_cursor_t* p_msg)
+{
+  return p_msg->length - p_msg->offset;
+}
+
+//---------------------------------------------------------
+// copy the next bytes out of the message. If there aren't enough left, the
+// rest of the message is skipped and false is returned.
+bool read_bytes_down(msg_cursor_t* p_msg, void* p_buff, uint32_t bytes_to_read)
+{
+  void* p_src = read_ptr_down(p_msg, bytes_to_read);
+  if (p_src == NULL)
     return false;
-  if (bytes_to_read > *p_bytes_to_remaining)
+
+  memcpy(p_buff, p_src, bytes_to_read);
+  return true;
+}
+
+//---------------------------------------------------------
+// return a pointer to the next bytes in the message and step over them. This
+// points into the input buffer, so copy anything that needs to be kept.
+void* read_ptr_down(msg_cursor_t* p_msg, uint32_t bytes_to_read)
+{
+  if (bytes_to_read > bytes_remaining(p_msg))
   {
-    // read in the remaining bytes
-    read_exact(p_buff, *p_bytes_to_remaining);
-    *p_bytes_to_remaining = 0;
-    // return false
-    return false;
+    p_msg->offset = p_msg->length;
+    return NULL;
   }
 
-  // read in the requested bytes
-  read_exact(p_buff, bytes_to_read);
-  // do accounting on the bytes remaining
-  *p_bytes_to_remaining -= bytes_to_read;
-  return true;
+  void* p = p_msg->p_data + p_msg->offset;
+  p_msg->offset += bytes_to_read;
+  return p;
+}
+
+//---------------------------------------------------------
+// same as read_ptr_down, but also checks that the string is null terminated
+char* read_str_down(msg_cursor_t* p_msg, uint32_t bytes_to_read)
+{
+  char* p_str = read_ptr_down(p_msg, bytes_to_read);
+  if (p_str == NULL || bytes_to_read == 0 || p_str[bytes_to_read - 1] != 0)
+    return NULL;
+  return p_str;
 }
 
 //=============================================================================
@@ -159,90 +375,75 @@ bool read_bytes_down(void* p_buff, int bytes_to_read, int* p_bytes_to_remaining)
 //---------------------------------------------------------
 void send_puts(const char* msg)
 {
-  uint32_t msg_len = strlen(msg);
-  uint32_t cmd_len = msg_len + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_PUTS;
-
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
-
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact((byte*) msg, msg_len);
+  uint32_t cmd = MSG_OUT_PUTS;
+  queue_msg(&cmd, sizeof(uint32_t), msg, strlen(msg));
 }
 
 //---------------------------------------------------------
 void send_write(const char* msg)
 {
-  uint32_t msg_len = strlen(msg);
-  uint32_t cmd_len = msg_len + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_WRITE;
-
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
-
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact((byte*) msg, msg_len);
+  uint32_t cmd = MSG_OUT_WRITE;
+  queue_msg(&cmd, sizeof(uint32_t), msg, strlen(msg));
 }
 
 //---------------------------------------------------------
 void send_inspect(void* data, int length)
 {
-  uint32_t cmd_len = length + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_INSPECT;
-
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
-
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact(data, length);
+  uint32_t cmd = MSG_OUT_INSPECT;
+  queue_msg(&cmd, sizeof(uint32_t), data, length);
 }
 
 //---------------------------------------------------------
 void send_static_texture_miss(const char* key)
 {
-  uint32_t msg_len = strlen(key);
-  uint32_t cmd_len = msg_len + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_STATIC_TEXTURE_MISS;
-
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
+  // it is probably still waiting in the bulk lane. If not, the next
+  // frame drawn after the lane empties reports it
+  if (get_lane_depth(LANE_BULK) > 0)
+  {
+    miss_held = true;
+    return;
+  }
 
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact((byte*) key, msg_len);
+  uint32_t cmd = MSG_OUT_STATIC_TEXTURE_MISS;
+  queue_msg(&cmd, sizeof(uint32_t), key, strlen(key));
 }
 
 //---------------------------------------------------------
 void send_dynamic_texture_miss(const char* key)
 {
-  uint32_t msg_len = strlen(key);
-  uint32_t cmd_len = msg_len + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_DYNAMIC_TEXTURE_MISS;
+  // see send_static_texture_miss
+  if (get_lane_depth(LANE_BULK) > 0)
+  {
+    miss_held = true;
+    return;
+  }
 
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
+  uint32_t cmd = MSG_OUT_DYNAMIC_TEXTURE_MISS;
+  queue_msg(&cmd, sizeof(uint32_t), key, strlen(key));
+}
 
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact((byte*) key, msg_len);
+//---------------------------------------------------------
+// a texture that arrived but couldn't be loaded. Nothing draws it to ask
+// again later, so this is reported right away
+void send_texture_lost(const char* key, bool is_static)
+{
+  uint32_t cmd = is_static ? MSG_OUT_STATIC_TEXTURE_MISS
+                           : MSG_OUT_DYNAMIC_TEXTURE_MISS;
+  queue_msg(&cmd, sizeof(uint32_t), key, strlen(key));
 }
 
 //---------------------------------------------------------
 void send_font_miss(const char* key)
 {
-  uint32_t msg_len = strlen(key);
-  uint32_t cmd_len = msg_len + sizeof(uint32_t);
-  uint32_t cmd     = MSG_OUT_FONT_MISS;
-
-  if (f_little_endian)
-    cmd_len = SWAP_UINT32(cmd_len);
+  // see send_static_texture_miss
+  if (get_lane_depth(LANE_BULK) > 0)
+  {
+    miss_held = true;
+    return;
+  }
 
-  write_exact((byte*) &cmd_len, sizeof(uint32_t));
-  write_exact((byte*) &cmd, sizeof(uint32_t));
-  write_exact((byte*) key, msg_len);
+  uint32_t cmd = MSG_OUT_FONT_MISS;
+  queue_msg(&cmd, sizeof(uint32_t), key, strlen(key));
 }
 
 //---------------------------------------------------------
@@ -273,10 +474,10 @@ PACK(typedef struct msg_key_t
   uint32_t mods;
 }) msg_key_t;
 
-void send_key(int key, int scancode, int action, int mods)
+void send_key(int key, int scancode, int action, int mods, double time)
 {
   msg_key_t msg = {MSG_OUT_KEY, key, scancode, action, mods};
-  write_cmd((byte*) &msg, sizeof(msg_key_t));
+  queue_event(&msg, sizeof(msg_key_t), time);
 }
 
 //---------------------------------------------------------
@@ -287,10 +488,10 @@ PACK(typedef struct msg_codepoint_t
   uint32_t mods;
 }) msg_codepoint_t;
 
-void send_codepoint(unsigned int codepoint, int mods)
+void send_codepoint(unsigned int codepoint, int mods, double time)
 {
   msg_codepoint_t msg = {MSG_OUT_CODEPOINT, codepoint, mods};
-  write_cmd((byte*) &msg, sizeof(msg_codepoint_t));
+  queue_event(&msg, sizeof(msg_codepoint_t), time);
 }
 
 //---------------------------------------------------------
@@ -301,10 +502,10 @@ PACK(typedef struct msg_cursor_pos_t
   float    y;
 }) msg_cursor_pos_t;
 
-void send_cursor_pos(float xpos, float ypos)
+void send_cursor_pos(float xpos, float ypos, double time)
 {
   msg_cursor_pos_t msg = {MSG_OUT_CURSOR_POS, xpos, ypos};
-  write_cmd((byte*) &msg, sizeof(msg_cursor_pos_t));
+  queue_event(&msg, sizeof(msg_cursor_pos_t), time);
 }
 
 //---------------------------------------------------------
@@ -318,11 +519,12 @@ PACK(typedef struct msg_mouse_button_t
   float    ypos;
 }) msg_mouse_button_t;
 
-void send_mouse_button(int button, int action, int mods, float xpos, float ypos)
+void send_mouse_button(int button, int action, int mods, float xpos, float ypos,
+                       double time)
 {
   msg_mouse_button_t msg = {
       MSG_OUT_MOUSE_BUTTON, button, action, mods, xpos, ypos};
-  write_cmd((byte*) &msg, sizeof(msg_mouse_button_t));
+  queue_event(&msg, sizeof(msg_mouse_button_t), time);
 }
 
 //---------------------------------------------------------
@@ -335,10 +537,11 @@ PACK(typedef struct msg_scroll_t
   float    y;
 }) msg_scroll_t;
 
-void send_scroll(float xoffset, float yoffset, float xpos, float ypos)
+void send_scroll(float xoffset, float yoffset, float xpos, float ypos,
+                 double time)
 {
   msg_scroll_t msg = {MSG_OUT_MOUSE_SCROLL, xoffset, yoffset, xpos, ypos};
-  write_cmd((byte*) &msg, sizeof(msg_scroll_t));
+  queue_event(&msg, sizeof(msg_scroll_t), time);
 }
 
 //---------------------------------------------------------
@@ -350,10 +553,10 @@ PACK(typedef struct msg_cursor_enter_t
   float    y;
 }) msg_cursor_enter_t;
 
-void send_cursor_enter(int entered, float xpos, float ypos)
+void send_cursor_enter(int entered, float xpos, float ypos, double time)
 {
   msg_cursor_enter_t msg = {MSG_OUT_CURSOR_ENTER, entered, xpos, ypos};
-  write_cmd((byte*) &msg, sizeof(msg_cursor_enter_t));
+  queue_event(&msg, sizeof(msg_cursor_enter_t), time);
 }
 
 //---------------------------------------------------------
@@ -368,10 +571,24 @@ PACK(typedef struct msg_ready_t
 {
   uint32_t msg_id;
   int32_t  empty_dl;
+  uint32_t shm_mapped;
+  uint32_t version;
+  uint32_t capabilities;
+  uint32_t max_scripts;
+  uint32_t max_texture_size;
+  uint32_t encodings;
 }) msg_ready_t;
-void send_ready(int root_id)
+void send_ready(int root_id, bool shm_mapped, uint32_t max_scripts,
+                int max_texture_size)
 {
-  msg_ready_t msg = {MSG_OUT_READY, root_id};
+  // shared memory is only offered if it was actually mapped
+  uint32_t capabilities = CAPABILITIES;
+  if (shm_mapped)
+    capabilities |= CAP_SHM;
+
+  msg_ready_t msg = {MSG_OUT_READY,    root_id,          shm_mapped,
+                     PROTOCOL_VERSION, capabilities,     max_scripts,
+                     max_texture_size, ENCODINGS};
   write_cmd((byte*) &msg, sizeof(msg_ready_t));
 }
 
@@ -384,7 +601,16 @@ PACK(typedef struct msg_draw_ready_t
 
 void send_draw_ready(unsigned int id)
 {
-  msg_ready_t msg = {MSG_OUT_DRAW_READY, id};
+  msg_draw_ready_t msg = {MSG_OUT_DRAW_READY, id};
+  write_cmd((byte*) &msg, sizeof(msg_draw_ready_t));
+}
+
+//---------------------------------------------------------
+// a patch didn't match the script it was meant for. The caller needs to
+// send the whole thing again
+void send_script_miss(unsigned int id)
+{
+  msg_draw_ready_t msg = {MSG_OUT_SCRIPT_MISS, id};
   write_cmd((byte*) &msg, sizeof(msg_draw_ready_t));
 }
 
@@ -405,7 +631,92 @@ PACK(typedef struct msg_stats_t
   bool     iconified;
   bool     maximized;
   bool     visible;
+  uint32_t frame_msgs_out;
+  uint32_t frame_bytes_out;
+  uint32_t frame_writes_out;
+  double   frame_time;
+  uint32_t lane_control;
+  uint32_t lane_scripts;
+  uint32_t lane_bulk;
+  uint32_t scripts_live;
+  uint32_t scripts_peak;
+  uint32_t retained_hits;
+  uint32_t retained_records;
+  uint32_t retained_bytes;
+  uint32_t frames_partial;
+  uint32_t frames_full;
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  uint32_t cache_bytes;
+  uint32_t culled_skipped;
+  uint32_t culled_drawn;
+  uint32_t text_hits;
+  uint32_t text_misses;
+  uint32_t text_bytes;
+  uint32_t ops_received;
+  uint32_t ops_kept;
+  uint32_t profile_ops;
+  uint32_t profile_buckets;
+  uint64_t profile_frequency;
 }) msg_stats_t;
+
+// while profiling, the stats are followed by one of these for each op that
+// has run, then the tick histogram as profile_buckets uint64s
+PACK(typedef struct msg_op_profile_t
+{
+  uint32_t op;
+  uint64_t count;
+  uint64_t ticks;
+}) msg_op_profile_t;
+
+//---------------------------------------------------------
+static void write_stats(msg_stats_t* p_msg)
+{
+  if (!script_profiling())
+  {
+    p_msg->profile_ops       = 0;
+    p_msg->profile_buckets   = 0;
+    p_msg->profile_frequency = 0;
+    write_cmd((byte*) p_msg, sizeof(msg_stats_t));
+    return;
+  }
+
+  unsigned int size = sizeof(msg_stats_t) +
+                      sizeof(msg_op_profile_t) * PROFILE_OPS +
+                      sizeof(uint64_t) * PROFILE_BUCKETS;
+  byte* p_buffer = malloc(size);
+  if (p_buffer == NULL)
+  {
+    send_puts("receive_query_stats NO MEMORY");
+    return;
+  }
+
+  // only the ops that have run
+  const op_profile_t* p_profile = get_op_profile();
+  byte*               p_out     = p_buffer + sizeof(msg_stats_t);
+  uint32_t            ops       = 0;
+  for (uint32_t op = 0; op < PROFILE_OPS; op++)
+  {
+    if (p_profile[op].count == 0)
+      continue;
+    msg_op_profile_t rec = {op, p_profile[op].count, p_profile[op].ticks};
+    memcpy(p_out, &rec, sizeof(msg_op_profile_t));
+    p_out += sizeof(msg_op_profile_t);
+    ops++;
+  }
+  memcpy(p_out, get_tick_histogram(), sizeof(uint64_t) * PROFILE_BUCKETS);
+  p_out += sizeof(uint64_t) * PROFILE_BUCKETS;
+
+  p_msg->profile_ops       = ops;
+  p_msg->profile_buckets   = PROFILE_BUCKETS;
+  p_msg->profile_frequency = glfwGetTimerFrequency();
+  memcpy(p_buffer, p_msg, sizeof(msg_stats_t));
+
+  write_cmd(p_buffer, p_out - p_buffer);
+  free(p_buffer);
+}
+
+//---------------------------------------------------------
 void receive_query_stats(GLFWwindow* window)
 {
   msg_stats_t    msg;
@@ -431,14 +742,67 @@ void receive_query_stats(GLFWwindow* window)
   msg.maximized = false;
   msg.visible   = glfwGetWindowAttrib(window, GLFW_VISIBLE);
 
-  write_cmd((byte*) &msg, sizeof(msg_stats_t));
+  // what went up to the caller during the last full frame
+  out_stats_t out_stats = get_out_stats();
+  msg.frame_msgs_out    = out_stats.msgs;
+  msg.frame_bytes_out   = out_stats.bytes;
+  msg.frame_writes_out  = out_stats.writes;
+
+  // when the last frame was presented. Same clock as the input events
+  msg.frame_time = p_window_data->frame_time;
+
+  // messages still waiting in each lane
+  msg.lane_control = get_lane_depth(LANE_CONTROL);
+  msg.lane_scripts = get_lane_depth(LANE_SCRIPTS);
+  msg.lane_bulk    = get_lane_depth(LANE_BULK);
+
+  // scripts held now, and the most ever held at once
+  msg.scripts_live = p_window_data->scripts.live;
+  msg.scripts_peak = p_window_data->scripts.peak;
+
+  // scripts drawn from what they drew before, scripts recorded to be, and
+  // the memory that takes
+  msg.retained_hits    = get_retained_hits();
+  msg.retained_records = get_retained_records();
+  msg.retained_bytes   = get_retained_bytes();
+
+  // frames that only drew what changed, and frames that drew everything
+  msg.frames_partial = get_partial_frames();
+  msg.frames_full    = get_full_frames();
+
+  // scripts drawn from their textures, textures dropped because they no
+  // longer matched, and the GPU memory the textures take
+  msg.cache_hits   = get_cache_hits();
+  msg.cache_misses = get_cache_misses();
+  msg.cache_bytes  = get_cache_bytes();
+
+  // scripts skipped in the last frame because what they draw couldn't be
+  // seen, and scripts that were drawn
+  msg.culled_skipped = get_skipped_scripts();
+  msg.culled_drawn   = get_drawn_scripts();
+
+  // text drawn from its layout, text laid out, and the memory the layouts
+  // take
+  msg.text_hits   = get_text_hits();
+  msg.text_misses = get_text_misses();
+  msg.text_bytes  = get_text_bytes();
+
+  // ops in the scripts that arrived, and how many were left to run after
+  // decoding and optimizing them
+  msg.ops_received = get_ops_received();
+  msg.ops_kept     = get_ops_kept();
+
+  write_stats(&msg);
+
+  // the caller is blocked waiting on this one. don't hold it for the frame
+  flush_msgs();
 }
 
 //---------------------------------------------------------
-void receive_input(int* p_msg_length, GLFWwindow* window)
+void receive_input(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_window_data = glfwGetWindowUserPointer(window);
-  read_bytes_down(&p_window_data->input_flags, sizeof(uint32_t), p_msg_length);
+  read_bytes_down(p_msg, &p_window_data->input_flags, sizeof(uint32_t));
 }
 
 //---------------------------------------------------------
@@ -447,10 +811,10 @@ PACK(typedef struct cmd_move_t
   int32_t x_w;
   int32_t y_h;
 }) cmd_move_t;
-void receive_reshape(int* p_msg_length, GLFWwindow* window)
+void receive_reshape(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   cmd_move_t move_data;
-  if (read_bytes_down(&move_data, sizeof(cmd_move_t), p_msg_length))
+  if (read_bytes_down(p_msg, &move_data, sizeof(cmd_move_t)))
   {
     // act on the data
     glfwSetWindowSize(window, move_data.x_w, move_data.y_h);
@@ -458,10 +822,10 @@ void receive_reshape(int* p_msg_length, GLFWwindow* window)
 }
 
 //---------------------------------------------------------
-void receive_position(int* p_msg_length, GLFWwindow* window)
+void receive_position(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   cmd_move_t move_data;
-  if (read_bytes_down(&move_data, sizeof(cmd_move_t), p_msg_length))
+  if (read_bytes_down(p_msg, &move_data, sizeof(cmd_move_t)))
   {
     // act on the data
     glfwSetWindowPos(window, move_data.x_w, move_data.y_h);
@@ -482,11 +846,12 @@ void receive_quit(GLFWwindow* window)
 void receive_crash()
 {
   send_puts("receive_crash - exit");
+  flush_msgs();
   exit(EXIT_FAILURE);
 }
 
 //---------------------------------------------------------
-void receive_render(int* p_msg_length, GLFWwindow* window)
+void receive_render(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -497,14 +862,25 @@ void receive_render(int* p_msg_length, GLFWwindow* window)
 
   // get the draw list id to compile
   GLuint id;
-  read_bytes_down(&id, sizeof(GLuint), p_msg_length);
+  if (!read_bytes_down(p_msg, &id, sizeof(GLuint)))
+    return;
 
-  // extract the render script itself
-  void* p_script = malloc(*p_msg_length);
-  read_bytes_down(p_script, *p_msg_length, p_msg_length);
+  // the script is kept after the message is gone, so copy it out
+  uint32_t script_size = bytes_remaining(p_msg);
+  void*    p_script    = malloc(script_size);
+  if (p_script == NULL)
+  {
+    // the old script stays. the caller is still waiting on the signal
+    send_puts("receive_render NO MEMORY");
+    p_msg->offset = p_msg->length;
+  }
+  else
+  {
+    read_bytes_down(p_msg, p_script, script_size);
 
-  // save the script away for later
-  put_script(p_data, id, p_script);
+    // save the script away for later
+    put_script(p_data, id, p_script, script_size, 0);
+  }
 
   // send the signal that drawing is done
   send_draw_ready(id);
@@ -514,7 +890,133 @@ void receive_render(int* p_msg_length, GLFWwindow* window)
 }
 
 //---------------------------------------------------------
-void receive_clear(int* p_msg_length, GLFWwindow* window)
+// edit a resident script instead of replacing it. Each edit deletes
+// delete_length bytes at offset in the base script and inserts the
+// insert_length bytes that follow it. Edits are in order and don't overlap.
+// A base_tag of 0 means there is no base, which replaces the script outright.
+PACK(typedef struct patch_script_t
+{
+  GLuint id;
+  GLuint base_tag;
+  GLuint tag;
+  GLuint base_size;
+  GLuint edit_count;
+}) patch_script_t;
+
+PACK(typedef struct script_edit_t
+{
+  GLuint offset;
+  GLuint delete_length;
+  GLuint insert_length;
+}) script_edit_t;
+
+static bool apply_patch(window_data_t* p_data, patch_script_t* p_patch,
+                        msg_cursor_t* p_msg)
+{
+  void*    p_base    = NULL;
+  uint32_t base_size = 0;
+
+  if (p_patch->base_tag != 0)
+  {
+    script_t* p_entry = get_script_entry(p_data, p_patch->id);
+    if (p_entry == NULL || p_entry->p_script == NULL ||
+        p_entry->tag != p_patch->base_tag ||
+        p_entry->size != p_patch->base_size)
+      return false;
+    p_base    = p_entry->p_script;
+    base_size = p_entry->size;
+  }
+  else if (p_patch->base_size != 0)
+  {
+    return false;
+  }
+
+  // check the edits and work out the new size before touching anything
+  uint32_t start     = p_msg->offset;
+  uint32_t end       = 0;
+  uint32_t new_size  = base_size;
+  bool     same_size = p_base != NULL;
+  for (uint32_t i = 0; i < p_patch->edit_count; i++)
+  {
+    script_edit_t edit;
+    if (!read_bytes_down(p_msg, &edit, sizeof(script_edit_t)) ||
+        read_ptr_down(p_msg, edit.insert_length) == NULL ||
+        edit.offset < end || edit.offset > base_size ||
+        edit.delete_length > base_size - edit.offset)
+      return false;
+    end = edit.offset + edit.delete_length;
+    new_size += edit.insert_length - edit.delete_length;
+    same_size = same_size && edit.insert_length == edit.delete_length;
+  }
+  p_msg->offset = start;
+
+  // the common case. values changed but nothing moved. do it in place
+  if (same_size)
+  {
+    for (uint32_t i = 0; i < p_patch->edit_count; i++)
+    {
+      script_edit_t edit = {0, 0, 0};
+      read_bytes_down(p_msg, &edit, sizeof(script_edit_t));
+      memcpy((byte*) p_base + edit.offset,
+             read_ptr_down(p_msg, edit.insert_length), edit.insert_length);
+    }
+    get_script_entry(p_data, p_patch->id)->tag = p_patch->tag;
+    refresh_script(p_data, p_patch->id);
+    return true;
+  }
+
+  // otherwise splice it into a new buffer
+  byte* p_script = malloc(new_size);
+  if (p_script == NULL)
+    return false;
+
+  uint32_t from = 0;
+  byte*    p_to = p_script;
+  for (uint32_t i = 0; i < p_patch->edit_count; i++)
+  {
+    script_edit_t edit = {0, 0, 0};
+    read_bytes_down(p_msg, &edit, sizeof(script_edit_t));
+    memcpy(p_to, (byte*) p_base + from, edit.offset - from);
+    p_to += edit.offset - from;
+    memcpy(p_to, read_ptr_down(p_msg, edit.insert_length), edit.insert_length);
+    p_to += edit.insert_length;
+    from = edit.offset + edit.delete_length;
+  }
+  memcpy(p_to, (byte*) p_base + from, base_size - from);
+
+  put_script(p_data, p_patch->id, p_script, new_size, p_patch->tag);
+  return true;
+}
+
+void receive_patch_script(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_patch_script BAD WINDOW");
+    return;
+  }
+
+  patch_script_t patch;
+  if (!read_bytes_down(p_msg, &patch, sizeof(patch_script_t)))
+    return;
+
+  // if it doesn't apply, the script is left as it was
+  if (!apply_patch(p_data, &patch, p_msg))
+  {
+    p_msg->offset = p_msg->length;
+    send_script_miss(patch.id);
+  }
+
+  // the caller is waiting on this either way
+  send_draw_ready(patch.id);
+
+  // post a message to kick the display loop
+  glfwPostEmptyEvent();
+}
+
+//---------------------------------------------------------
+void receive_clear(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -525,14 +1027,15 @@ void receive_clear(int* p_msg_length, GLFWwindow* window)
 
   // get and validate the dl_id
   GLuint id;
-  read_bytes_down(&id, sizeof(GLuint), p_msg_length);
+  if (!read_bytes_down(p_msg, &id, sizeof(GLuint)))
+    return;
 
   // delete the list
   delete_script(p_data, id);
 }
 
 //---------------------------------------------------------
-void receive_set_root(int* p_msg_length, GLFWwindow* window)
+void receive_set_root(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -543,7 +1046,8 @@ void receive_set_root(int* p_msg_length, GLFWwindow* window)
 
   // get and validate the dl_id
   GLint id;
-  read_bytes_down(&id, sizeof(GLint), p_msg_length);
+  if (!read_bytes_down(p_msg, &id, sizeof(GLint)))
+    return;
 
   // update the current_dl with the incoming id
   p_data->root_script = id;
@@ -560,12 +1064,14 @@ PACK(typedef struct clear_color_t
   GLuint b;
   GLuint a;
 }) clear_color_t;
-void receive_clear_color(int* p_msg_length)
+void receive_clear_color(msg_cursor_t* p_msg)
 {
   // get the clear_color
   clear_color_t cc;
-  read_bytes_down(&cc, sizeof(clear_color_t), p_msg_length);
+  if (!read_bytes_down(p_msg, &cc, sizeof(clear_color_t)))
+    return;
   glClearColor(cc.r / 255.0, cc.g / 255.0, cc.b / 255.0, cc.a / 255.0);
+  damage_all();
 }
 
 //---------------------------------------------------------
@@ -575,7 +1081,7 @@ PACK(typedef struct font_info_t
   GLuint data_length;
 }) font_info_t;
 
-void receive_load_font_file(int* p_msg_length, GLFWwindow* window)
+void receive_load_font_file(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -586,27 +1092,29 @@ void receive_load_font_file(int* p_msg_length, GLFWwindow* window)
   NVGcontext* p_ctx = p_data->context.p_ctx;
 
   font_info_t font_info;
-  read_bytes_down(&font_info, sizeof(font_info_t), p_msg_length);
-
-  // create the name and data
-  void* p_name = malloc(font_info.name_length);
-  read_bytes_down(p_name, font_info.name_length, p_msg_length);
+  if (!read_bytes_down(p_msg, &font_info, sizeof(font_info_t)))
+    return;
 
-  void* p_path = malloc(font_info.data_length);
-  read_bytes_down(p_path, font_info.data_length, p_msg_length);
+  // the name and path are used straight out of the message
+  char* p_name = read_str_down(p_msg, font_info.name_length);
+  char* p_path = read_str_down(p_msg, font_info.data_length);
+  if (p_name == NULL || p_path == NULL)
+  {
+    send_puts("receive_load_font_file BAD MESSAGE");
+    return;
+  }
 
   // only load the font if it is not already loaded!
   if (nvgFindFont(p_ctx, p_name) < 0)
   {
     nvgCreateFont(p_ctx, p_name, p_path);
+    // text that was waiting on it can draw now
+    damage_all();
   }
-
-  free(p_name);
-  free(p_path);
 }
 
 //---------------------------------------------------------
-void receive_load_font_blob(int* p_msg_length, GLFWwindow* window)
+void receive_load_font_blob(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -617,33 +1125,136 @@ void receive_load_font_blob(int* p_msg_length, GLFWwindow* window)
   NVGcontext* p_ctx = p_data->context.p_ctx;
 
   font_info_t font_info;
-  read_bytes_down(&font_info, sizeof(font_info_t), p_msg_length);
-
-  // create the name and data
-  void* p_name = malloc(font_info.name_length);
-  read_bytes_down(p_name, font_info.name_length, p_msg_length);
+  if (!read_bytes_down(p_msg, &font_info, sizeof(font_info_t)))
+    return;
 
-  void* p_blob = malloc(font_info.data_length);
-  read_bytes_down(p_blob, font_info.data_length, p_msg_length);
+  char* p_name = read_str_down(p_msg, font_info.name_length);
+  void* p_blob = read_ptr_down(p_msg, font_info.data_length);
+  if (p_name == NULL || p_blob == NULL)
+  {
+    send_puts("receive_load_font_blob BAD MESSAGE");
+    return;
+  }
 
   // only load the font if it is not already loaded!
   if (nvgFindFont(p_ctx, p_name) < 0)
   {
-    nvgCreateFontMem(p_ctx, p_name, p_blob, font_info.data_length, true);
+    // nanovg keeps the blob and frees it with the font, so it needs its own
+    // copy that outlives the message
+    void* p_font = malloc(font_info.data_length);
+    if (p_font == NULL)
+    {
+      send_puts("receive_load_font_blob NO MEMORY");
+      return;
+    }
+    memcpy(p_font, p_blob, font_info.data_length);
+    nvgCreateFontMem(p_ctx, p_name, p_font, font_info.data_length, true);
+    damage_all();
   }
+}
 
-  free(p_name);
+//---------------------------------------------------------
+// a message that was written into the shared memory ring. Dispatch it in
+// place, then hand the space back to the caller.
+PACK(typedef struct shm_msg_t
+{
+  uint32_t sequence;
+  uint32_t offset;
+  uint32_t length;
+  uint32_t release;
+}) shm_msg_t;
+
+bool dispatch_message(msg_cursor_t* p_msg, GLFWwindow* window);
+
+bool receive_shm_msg(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  static uint32_t next_sequence = 0;
+
+  shm_msg_t desc;
+  if (!read_bytes_down(p_msg, &desc, sizeof(shm_msg_t)))
+    return false;
+
+  // the ring is strictly in order. If this trips, something is badly wrong
+  if (desc.sequence != next_sequence)
+  {
+    send_puts("receive_shm_msg OUT OF SEQUENCE");
+  }
+  next_sequence = desc.sequence + 1;
+
+  msg_cursor_t shm_msg = {get_shm(desc.offset, desc.length), desc.length, 0};
+  if (shm_msg.p_data == NULL)
+  {
+    send_puts("receive_shm_msg BAD RANGE");
+    release_shm(desc.release);
+    return false;
+  }
+
+  // don't let descriptors point at other descriptors or batches
+  uint32_t msg_id;
+  if (desc.length >= sizeof(uint32_t))
+  {
+    memcpy(&msg_id, shm_msg.p_data, sizeof(uint32_t));
+    if (msg_id == CMD_SHM_MSG || msg_id == CMD_BATCH)
+    {
+      send_puts("receive_shm_msg NESTED");
+      release_shm(desc.release);
+      return false;
+    }
+  }
+
+  bool render = dispatch_message(&shm_msg, window);
+  release_shm(desc.release);
+  return render;
+}
+
+//---------------------------------------------------------
+// a run of messages sent as one. Each is a native uint32 length followed by
+// the message itself. They are all applied in order before the next frame.
+bool receive_batch(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  bool render = false;
+
+  while (bytes_remaining(p_msg) > 0)
+  {
+    uint32_t length;
+    if (!read_bytes_down(p_msg, &length, sizeof(uint32_t)))
+      break;
+
+    msg_cursor_t sub_msg = {read_ptr_down(p_msg, length), length, 0};
+    if (sub_msg.p_data == NULL)
+    {
+      send_puts("receive_batch BAD MESSAGE");
+      break;
+    }
+
+    // batches don't nest
+    uint32_t msg_id;
+    if (length >= sizeof(uint32_t))
+    {
+      memcpy(&msg_id, sub_msg.p_data, sizeof(uint32_t));
+      if (msg_id == CMD_BATCH)
+      {
+        send_puts("receive_batch NESTED");
+        continue;
+      }
+    }
+
+    render = dispatch_message(&sub_msg, window) || render;
+  }
+
+  return render;
 }
 
 //---------------------------------------------------------
-bool dispatch_message(int msg_length, GLFWwindow* window)
+bool dispatch_message(msg_cursor_t* p_msg, GLFWwindow* window)
 {
 
   bool render = false;
 
   // read the message id
   uint32_t msg_id;
-  read_bytes_down(&msg_id, sizeof(uint32_t), &msg_length);
+  if (!read_bytes_down(p_msg, &msg_id, sizeof(uint32_t)))
+    return false;
 
   char buff[200];
 
@@ -656,35 +1267,39 @@ bool dispatch_message(int msg_length, GLFWwindow* window)
       return false;
 
     case CMD_RENDER_GRAPH:
-      receive_render(&msg_length, window);
+      receive_render(p_msg, window);
       render = true;
       break;
     case CMD_CLEAR_GRAPH:
-      receive_clear(&msg_length, window);
+      receive_clear(p_msg, window);
       render = true;
       break;
     case CMD_SET_ROOT:
-      receive_set_root(&msg_length, window);
+      receive_set_root(p_msg, window);
+      render = true;
+      break;
+    case CMD_PATCH_SCRIPT:
+      receive_patch_script(p_msg, window);
       render = true;
       break;
 
     case CMD_CLEAR_COLOR:
-      receive_clear_color(&msg_length);
+      receive_clear_color(p_msg);
       render = true;
       break;
 
     case CMD_INPUT:
-      receive_input(&msg_length, window);
+      receive_input(p_msg, window);
       break;
 
     case CMD_QUERY_STATS:
       receive_query_stats(window);
       break;
     case CMD_RESHAPE:
-      receive_reshape(&msg_length, window);
+      receive_reshape(p_msg, window);
       break;
     case CMD_POSITION:
-      receive_position(&msg_length, window);
+      receive_position(p_msg, window);
       break;
 
     case CMD_ICONIFY:
@@ -703,27 +1318,48 @@ bool dispatch_message(int msg_length, GLFWwindow* window)
 
     // font handling
     case CMD_LOAD_FONT_FILE:
-      receive_load_font_file(&msg_length, window);
+      receive_load_font_file(p_msg, window);
       render = true;
       break;
     case CMD_LOAD_FONT_BLOB:
-      receive_load_font_blob(&msg_length, window);
+      receive_load_font_blob(p_msg, window);
       render = true;
       break;
 
-    // the next three are in tx.c
+    // the next six are in tx.c
     case CMD_PUT_TX_BLOB:
-      receive_put_tx_blob(&msg_length, window);
+      receive_put_tx_blob(p_msg, window);
       render = true;
       break;
 
     case CMD_PUT_TX_RAW:
-      receive_put_tx_pixels(&msg_length, window);
+      receive_put_tx_pixels(p_msg, window);
       render = true;
       break;
 
     case CMD_FREE_TX_ID:
-      receive_free_tx_id(&msg_length, window);
+      receive_free_tx_id(p_msg, window);
+      break;
+
+    // chunks only copy in. Nothing to draw until the commit
+    case CMD_PUT_TX_BEGIN:
+      receive_put_tx_begin(p_msg, window);
+      break;
+
+    case CMD_PUT_TX_CHUNK:
+      receive_put_tx_chunk(p_msg, window);
+      break;
+
+    case CMD_PUT_TX_COMMIT:
+      receive_put_tx_commit(p_msg, window);
+      render = true;
+      break;
+
+    case CMD_SHM_MSG:
+      render = receive_shm_msg(p_msg, window);
+      break;
+    case CMD_BATCH:
+      render = receive_batch(p_msg, window);
       break;
 
     case CMD_CRASH:
@@ -735,15 +1371,12 @@ bool dispatch_message(int msg_length, GLFWwindow* window)
       send_puts(buff);
   }
 
-  // if there are any bytes left to read in the message, need to get rid of them
-  // here...
-  if (msg_length > 0)
+  // the whole message is already in memory, so any bytes left over are simply
+  // dropped with it. Still worth knowing about though.
+  if (bytes_remaining(p_msg) > 0)
   {
-    sprintf(buff, "WARNING Excess message bytes! %d", msg_length);
+    sprintf(buff, "WARNING Excess message bytes! %d", bytes_remaining(p_msg));
     send_puts(buff);
-    void* p = malloc(msg_length);
-    read_bytes_down(p, msg_length, &msg_length);
-    free(p);
   }
 
   check_gl_error(buff);
@@ -752,7 +1385,217 @@ bool dispatch_message(int msg_length, GLFWwindow* window)
 }
 
 //=============================================================================
-// non-threaded command reading
+// threaded command reading
+//
+// comms_thread does all the reading from the caller. It copies each complete
+// message into the next slot of a single producer / single consumer queue and
+// wakes the main loop. The main thread only ever dispatches messages that are
+// already sitting in the queue, so a big upload never holds up input polling
+// or presenting a frame. Nothing in here may call the send_* functions from
+// the reader thread. Only the main thread writes up to the caller.
+
+// must be a power of two
+#define MSG_QUEUE_SIZE 256
+
+// a slot keeps its buffer for the next message that lands in it. Big ones
+// (fonts, textures) are let go once a small message comes through.
+#define MSG_SLOT_IDLE_SIZE 0x100000
+
+#ifdef _MSC_VER
+  #define ATOMIC_LOAD(p) InterlockedCompareExchange((volatile LONG*) (p), 0, 0)
+  #define ATOMIC_STORE(p, v) InterlockedExchange((volatile LONG*) (p), (v))
+  #define ATOMIC_EXCHANGE(p, v) InterlockedExchange((volatile LONG*) (p), (v))
+#else
+  #define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+  #define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+  #define ATOMIC_EXCHANGE(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#endif
+
+typedef struct
+{
+  byte*    p_data;
+  uint32_t length;
+  uint32_t capacity;
+} msg_slot_t;
+
+static msg_slot_t msg_queue[MSG_QUEUE_SIZE];
+
+// running counts. head is only written by the reader, tail by the main thread
+static uint32_t queue_head = 0;
+static uint32_t queue_tail = 0;
+
+// set by the reader when it has woken the main thread, cleared by the main
+// thread before it drains. Keeps it to one wake up per drain.
+static uint32_t wake_pending = 0;
+
+// set once the pipe from the caller has closed
+static uint32_t reader_done = 0;
+
+//---------------------------------------------------------
+// copy a message into the next free slot. Blocks while the queue is full.
+static bool push_msg(msg_cursor_t* p_msg)
+{
+  uint32_t head = queue_head;
+
+  // the main thread is behind. make sure it is awake and give it a moment
+  while (head - ATOMIC_LOAD(&queue_tail) >= MSG_QUEUE_SIZE)
+  {
+    glfwPostEmptyEvent();
+    comms_backoff();
+  }
+
+  msg_slot_t* p_slot = &msg_queue[head & (MSG_QUEUE_SIZE - 1)];
+
+  if (p_slot->capacity > MSG_SLOT_IDLE_SIZE &&
+      p_msg->length <= MSG_SLOT_IDLE_SIZE)
+  {
+    free(p_slot->p_data);
+    p_slot->p_data   = NULL;
+    p_slot->capacity = 0;
+  }
+
+  if (p_msg->length > p_slot->capacity)
+  {
+    byte* p_data = realloc(p_slot->p_data, p_msg->length);
+    if (p_data == NULL)
+      return false;
+    p_slot->p_data   = p_data;
+    p_slot->capacity = p_msg->length;
+  }
+
+  memcpy(p_slot->p_data, p_msg->p_data, p_msg->length);
+  p_slot->length = p_msg->length;
+
+  // publish it, then wake the main thread unless it already has been
+  ATOMIC_STORE(&queue_head, head + 1);
+  if (ATOMIC_EXCHANGE(&wake_pending, 1) == 0)
+    glfwPostEmptyEvent();
+
+  return true;
+}
+
+//---------------------------------------------------------
+// what a message carries. For a shared memory descriptor that is the message
+// in the ring, otherwise it is the message itself.
+static byte* shm_payload(byte* p_data, uint32_t length, uint32_t* p_length)
+{
+  msg_cursor_t msg    = {p_data, length, 0};
+  uint32_t     msg_id = 0;
+  shm_msg_t    desc;
+
+  *p_length = length;
+  if (read_bytes_down(&msg, &msg_id, sizeof(uint32_t)) &&
+      msg_id == CMD_SHM_MSG && read_bytes_down(&msg, &desc, sizeof(shm_msg_t)))
+  {
+    byte* p_shm = get_shm(desc.offset, desc.length);
+    if (p_shm != NULL)
+    {
+      *p_length = desc.length;
+      return p_shm;
+    }
+  }
+  return p_data;
+}
+
+//---------------------------------------------------------
+// the ring won't be there when a recording is played back, so shared memory
+// messages are recorded as what they carry. That includes those in a batch.
+static void record_msg(msg_cursor_t* p_msg)
+{
+  uint32_t msg_id = 0;
+  if (p_msg->length >= sizeof(uint32_t))
+    memcpy(&msg_id, p_msg->p_data, sizeof(uint32_t));
+
+  if (msg_id != CMD_BATCH)
+  {
+    uint32_t   length;
+    out_part_t part = {shm_payload(p_msg->p_data, p_msg->length, &length), 0};
+    part.length     = length;
+    record_parts(&part, 1);
+    return;
+  }
+
+  // count the messages in the batch
+  msg_cursor_t batch = {p_msg->p_data, p_msg->length, sizeof(uint32_t)};
+  uint32_t     length;
+  int          count = 0;
+  while (read_bytes_down(&batch, &length, sizeof(uint32_t)) &&
+         read_ptr_down(&batch, length) != NULL)
+  {
+    count++;
+  }
+
+  // the id, then a new length and the payload for each one
+  uint32_t*   p_lengths = malloc(sizeof(uint32_t) * (count + 1));
+  out_part_t* p_parts   = malloc(sizeof(out_part_t) * (count * 2 + 1));
+  if (p_lengths == NULL || p_parts == NULL)
+  {
+    free(p_lengths);
+    free(p_parts);
+    return;
+  }
+
+  p_parts[0].p_data = p_msg->p_data;
+  p_parts[0].length = sizeof(uint32_t);
+
+  batch.offset = sizeof(uint32_t);
+  for (int i = 0; i < count; i++)
+  {
+    read_bytes_down(&batch, &length, sizeof(uint32_t));
+    byte* p_sub = read_ptr_down(&batch, length);
+
+    p_parts[i * 2 + 2].p_data = shm_payload(p_sub, length, &p_lengths[i]);
+    p_parts[i * 2 + 2].length = p_lengths[i];
+    p_parts[i * 2 + 1].p_data = &p_lengths[i];
+    p_parts[i * 2 + 1].length = sizeof(uint32_t);
+  }
+
+  record_parts(p_parts, count * 2 + 1);
+  free(p_lengths);
+  free(p_parts);
+}
+
+//---------------------------------------------------------
+// the next message for the queue. Normally from the caller, but it can be
+// played back from a recording instead.
+static bool next_msg(msg_cursor_t* p_msg)
+{
+  if (replaying())
+    return read_replay(p_msg);
+
+  // read_msg blocks with no timeout
+  if (!read_msg(p_msg, NULL))
+    return false;
+
+  if (recording())
+    record_msg(p_msg);
+  return true;
+}
+
+//---------------------------------------------------------
+// the reader thread. Runs until the caller goes away.
+void* comms_thread(void* window)
+{
+  msg_cursor_t msg;
+
+  while (next_msg(&msg))
+  {
+    if (!push_msg(&msg))
+      break;
+  }
+
+  stop_recording();
+  ATOMIC_STORE(&reader_done, 1);
+  glfwPostEmptyEvent();
+  return NULL;
+}
+
+//---------------------------------------------------------
+// true if there are messages waiting to be dispatched
+bool msgs_pending()
+{
+  return ATOMIC_LOAD(&queue_head) != queue_tail;
+}
 
 uint64_t get_time_stamp()
 {
@@ -761,29 +1604,200 @@ uint64_t get_time_stamp()
   return tv.tv_sec * (uint64_t) 1000000 + tv.tv_usec;
 }
 
-// read from the stdio in buffer and act on one message. Return true
-// if we need to redraw the screen. false if we do not
-bool handle_stdio_in(GLFWwindow* window)
+//=============================================================================
+// lanes
+//
+// The main thread sorts the queued messages into lanes and dispatches them
+// lane by lane, leaving the ones it skips in their slots. The tail only moves
+// past a run of dispatched slots, so the reader can't reuse one too soon.
+// Order within a lane is kept. Messages that came through shared memory have
+// to be handled in ring order, so a lane stops at one that would overtake an
+// earlier shared memory message still waiting in another lane.
+
+typedef struct
 {
-  int64_t        time_remaining = STDIO_TIMEOUT;
-  int64_t        end_time       = get_time_stamp() + STDIO_TIMEOUT;
-  struct timeval tv;
-  bool           redraw = false;
+  uint8_t lane;
+  bool    uses_shm;
+  bool    done;
+} slot_info_t;
+
+// only touched by the main thread
+static slot_info_t slot_info[MSG_QUEUE_SIZE];
+static uint32_t    sorted_head = 0;
+static uint32_t    lane_depths[LANE_COUNT];
+
+//---------------------------------------------------------
+static uint32_t get_lane_depth(int lane)
+{
+  return lane_depths[lane];
+}
+
+//---------------------------------------------------------
+static int get_lane(uint32_t msg_id)
+{
+  switch (msg_id)
+  {
+    case CMD_INPUT:
+    case CMD_QUIT:
+    case CMD_QUERY_STATS:
+    case CMD_RESHAPE:
+    case CMD_POSITION:
+    case CMD_FOCUS:
+    case CMD_ICONIFY:
+    case CMD_MAXIMIZE:
+    case CMD_RESTORE:
+    case CMD_SHOW:
+    case CMD_HIDE:
+    case CMD_CRASH:
+      return LANE_CONTROL;
+
+    case CMD_NEW_TX_ID:
+    case CMD_FREE_TX_ID:
+    case CMD_PUT_TX_BLOB:
+    case CMD_PUT_TX_RAW:
+    case CMD_PUT_TX_BEGIN:
+    case CMD_PUT_TX_CHUNK:
+    case CMD_PUT_TX_COMMIT:
+    case CMD_LOAD_FONT_FILE:
+    case CMD_LOAD_FONT_BLOB:
+    case CMD_FREE_FONT:
+      return LANE_BULK;
+
+    // scripts, and anything unknown so it stays in order with them
+    default:
+      return LANE_SCRIPTS;
+  }
+}
 
-  while (time_remaining > 0)
+//---------------------------------------------------------
+static void sort_msg(msg_slot_t* p_slot, slot_info_t* p_info)
+{
+  msg_cursor_t msg    = {p_slot->p_data, p_slot->length, 0};
+  uint32_t     msg_id = 0;
+  read_bytes_down(&msg, &msg_id, sizeof(uint32_t));
+
+  p_info->lane     = get_lane(msg_id);
+  p_info->uses_shm = false;
+  p_info->done     = false;
+
+  if (msg_id == CMD_SHM_MSG)
+  {
+    // goes in the lane of the message it carries
+    shm_msg_t desc;
+    p_info->uses_shm = true;
+    if (read_bytes_down(&msg, &desc, sizeof(shm_msg_t)))
+    {
+      byte* p_shm = get_shm(desc.offset, desc.length);
+      if (p_shm != NULL && desc.length >= sizeof(uint32_t))
+      {
+        memcpy(&msg_id, p_shm, sizeof(uint32_t));
+        p_info->lane = get_lane(msg_id);
+      }
+    }
+  }
+  else if (msg_id == CMD_BATCH)
   {
-    tv.tv_sec  = 0;
-    tv.tv_usec = time_remaining;
+    // a batch stays with the scripts, but may carry shared memory messages
+    uint32_t length;
+    while (!p_info->uses_shm &&
+           read_bytes_down(&msg, &length, sizeof(uint32_t)) &&
+           length <= bytes_remaining(&msg))
+    {
+      if (length >= sizeof(uint32_t))
+      {
+        memcpy(&msg_id, msg.p_data + msg.offset, sizeof(uint32_t));
+        p_info->uses_shm = msg_id == CMD_SHM_MSG;
+      }
+      msg.offset += length;
+    }
+  }
+
+  lane_depths[p_info->lane]++;
+}
+
+//---------------------------------------------------------
+// dispatch what is waiting in one lane. Always does at least one message if
+// there is one, so every lane keeps moving, then carries on until end_time.
+static bool drain_lane(GLFWwindow* window, int lane, uint64_t end_time)
+{
+  bool     redraw      = false;
+  bool     shm_waiting = false;
+  uint32_t count       = 0;
 
-    int len = read_msg_length(&tv);
-    if (len <= 0)
+  for (uint32_t i = queue_tail; i != sorted_head; i++)
+  {
+    msg_slot_t*  p_slot = &msg_queue[i & (MSG_QUEUE_SIZE - 1)];
+    slot_info_t* p_info = &slot_info[i & (MSG_QUEUE_SIZE - 1)];
+
+    if (p_info->done)
+      continue;
+
+    if (p_info->lane != lane)
+    {
+      shm_waiting = shm_waiting || p_info->uses_shm;
+      continue;
+    }
+
+    if ((p_info->uses_shm && shm_waiting) ||
+        (count > 0 && get_time_stamp() >= end_time))
       break;
 
-    // process the message
-    redraw = dispatch_message(len, window) || redraw;
+    // done before dispatching, so stats don't count themselves
+    p_info->done = true;
+    lane_depths[lane]--;
+    count++;
+
+    msg_cursor_t msg = {p_slot->p_data, p_slot->length, 0};
+    redraw           = dispatch_message(&msg, window) || redraw;
+  }
+
+  return redraw;
+}
+
+// dispatch the messages the reader thread has queued up, lane by lane.
+// Stops early if there are more than can be handled in STDIO_TIMEOUT, so
+// input still gets polled. Return true if we need to redraw the screen.
+// false if we do not
+bool handle_stdio_in(GLFWwindow* window)
+{
+  uint64_t end_time = get_time_stamp() + STDIO_TIMEOUT;
+  bool     redraw   = false;
+
+  // anything pushed from here on wakes the main loop again
+  ATOMIC_STORE(&wake_pending, 0);
+
+  // sort what has arrived since last time
+  uint32_t head = ATOMIC_LOAD(&queue_head);
+  for (; sorted_head != head; sorted_head++)
+  {
+    sort_msg(&msg_queue[sorted_head & (MSG_QUEUE_SIZE - 1)],
+             &slot_info[sorted_head & (MSG_QUEUE_SIZE - 1)]);
+  }
+
+  for (int lane = 0; lane < LANE_COUNT; lane++)
+  {
+    redraw = drain_lane(window, lane, end_time) || redraw;
+  }
+
+  // draw again once the bulk lane is empty, so anything still missing is
+  // reported
+  if (miss_held && get_lane_depth(LANE_BULK) == 0)
+  {
+    miss_held = false;
+    redraw    = true;
+  }
+
+  // hand the slots that are done back to the reader
+  uint32_t tail = queue_tail;
+  while (tail != sorted_head && slot_info[tail & (MSG_QUEUE_SIZE - 1)].done)
+    tail++;
+  ATOMIC_STORE(&queue_tail, tail);
 
-    // see if time is remaining, so we can process another one
-    time_remaining = end_time - get_time_stamp();
+  // once the caller has gone and everything it sent is done, stop
+  if (ATOMIC_LOAD(&reader_done) && !msgs_pending())
+  {
+    window_data_t* p_data = glfwGetWindowUserPointer(window);
+    p_data->keep_going    = false;
   }
 
   // return false to not cause a redraw
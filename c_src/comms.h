@@ -20,13 +20,51 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+// a bounds checked read cursor over one incoming message. From read_msg, the
+// data lives in the input buffer and is only valid until the next call
+typedef struct
+{
+  byte*    p_data;
+  uint32_t length;
+  uint32_t offset;
+} msg_cursor_t;
+
+// one piece of a gathered write up to the caller
+typedef struct
+{
+  const void* p_data;
+  size_t      length;
+} out_part_t;
+
+// what went up to the caller over one pass of the main loop
+typedef struct
+{
+  uint32_t msgs;
+  uint32_t bytes;
+  uint32_t writes;
+} out_stats_t;
+
 int read_exact(byte* buf, int len);
 int write_exact(byte* buf, int len);
-int read_msg_length(struct timeval * ptv);
+int write_parts(out_part_t* p_parts, int count);
+bool read_msg(msg_cursor_t* p_msg, struct timeval* ptv);
 bool isCallerDown();
 
-bool read_bytes_down(void* p_buff, int bytes_to_read,
-                     int* p_bytes_to_remaining);
+// optional shared memory transport for bulk messages
+bool  map_shm(const char* name);
+byte* get_shm(uint32_t offset, uint32_t length);
+void  release_shm(uint32_t position);
+
+uint32_t bytes_remaining(msg_cursor_t* p_msg);
+bool     read_bytes_down(msg_cursor_t* p_msg, void* p_buff,
+                         uint32_t bytes_to_read);
+void*    read_ptr_down(msg_cursor_t* p_msg, uint32_t bytes_to_read);
+char*    read_str_down(msg_cursor_t* p_msg, uint32_t bytes_to_read);
+
+// outgoing messages are buffered until the end of the frame
+void        flush_msgs();
+void        flush_frame_msgs();
+out_stats_t get_out_stats();
 
 // basic events to send up to the caller
 void send_puts(const char* msg);
@@ -35,21 +73,27 @@ void send_inspect(void* data, int length);
 
 void send_static_texture_miss(const char* key);
 void send_dynamic_texture_miss(const char* key);
+void send_texture_lost(const char* key, bool is_static);
 void send_font_miss(const char* key);
 void send_reshape(int window_width, int window_height, int frame_width,
                   int frame_height);
-void send_key(int key, int scancode, int action, int mods);
-void send_codepoint(unsigned int codepoint, int mods);
-void send_cursor_pos(float xpos, float ypos);
+void send_key(int key, int scancode, int action, int mods, double time);
+void send_codepoint(unsigned int codepoint, int mods, double time);
+void send_cursor_pos(float xpos, float ypos, double time);
 void send_mouse_button(int button, int action, int mods, float xpos,
-                       float ypos);
-void send_scroll(float xoffset, float yoffset, float xpos, float ypos);
-void send_cursor_enter(int entered, float xpos, float ypos);
+                       float ypos, double time);
+void send_scroll(float xoffset, float yoffset, float xpos, float ypos,
+                 double time);
+void send_cursor_enter(int entered, float xpos, float ypos, double time);
 void send_close();
-void send_ready(int root_id);
+void send_ready(int root_id, bool shm_mapped, uint32_t max_scripts,
+                int max_texture_size);
 void send_draw_ready(unsigned int id);
 
 void* comms_thread(void* window);
+bool  start_comms_thread(GLFWwindow* window);
+void  comms_backoff();
+bool  msgs_pending();
 
 void test_endian();
 void swap_little_endian_uint(uint32_t* target);
@@ -0,0 +1,321 @@
+/*
+Partial redraw. Only the part of the window that changed since the last
+frame is drawn again. The rest is kept from the frame before in a
+framebuffer of our own, which is copied to the window after each frame, so
+it doesn't matter what the window system leaves in the back buffer.
+
+Where each script drew is taken from the vertices it made, so text and
+everything else are covered without working out their sizes. A script that
+changes damages where it drew in the last frame, and where it draws in this
+one, along with the scripts it runs. Every script still runs each frame,
+but nanovg only draws on the GPU when the frame ends, so by then the damage
+is known and the drawing can be clipped to it.
+
+Changes that can touch the whole window, like its size, the root script,
+the clear color, textures and fonts, draw all of it again. So does a GL
+without framebuffer objects.
+
+Everything here runs on the main thread.
+*/
+
+#include "damage.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// how far antialiasing reaches past the vertices, in framebuffer pixels
+#define DAMAGE_MARGIN 2
+
+typedef struct
+{
+  GLuint fbo;
+  GLuint color;
+  GLuint stencil;
+  int    width;
+  int    height;
+} target_t;
+
+static bool     damage     = true;
+static target_t target     = {0};
+static uint32_t frame      = 1;
+static bool     full       = true;
+static float    damaged[4] = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+// where the script that just finished drew, for the one that ran it
+static float child_drawn[4];
+
+// what the last frame was drawn with
+static int      last_root          = -1;
+static uint32_t last_tx_generation = 0;
+static int      last_width         = 0;
+static int      last_height        = 0;
+
+static uint32_t partial_frames = 0;
+static uint32_t full_frames    = 0;
+
+//---------------------------------------------------------
+void set_damage(bool on)
+{
+  damage = on;
+}
+
+uint32_t get_partial_frames()
+{
+  return partial_frames;
+}
+
+uint32_t get_full_frames()
+{
+  return full_frames;
+}
+
+// frames are numbered from 1. This is the one being drawn, or the next one
+// if between frames
+uint32_t current_frame()
+{
+  return frame;
+}
+
+//---------------------------------------------------------
+static void empty(float* p_bounds)
+{
+  p_bounds[0] = FLT_MAX;
+  p_bounds[1] = FLT_MAX;
+  p_bounds[2] = -FLT_MAX;
+  p_bounds[3] = -FLT_MAX;
+}
+
+static void grow(float* p_bounds, const float* p_more)
+{
+  p_bounds[0] = fminf(p_bounds[0], p_more[0]);
+  p_bounds[1] = fminf(p_bounds[1], p_more[1]);
+  p_bounds[2] = fmaxf(p_bounds[2], p_more[2]);
+  p_bounds[3] = fmaxf(p_bounds[3], p_more[3]);
+}
+
+//---------------------------------------------------------
+// the next frame draws the whole window
+void damage_all()
+{
+  full = true;
+}
+
+//---------------------------------------------------------
+// the next frame draws this part of the window again
+void damage_bounds(const float* p_bounds)
+{
+  grow(damaged, p_bounds);
+}
+
+//---------------------------------------------------------
+// the script is about to change or go away. Where it drew in the last frame
+// needs drawing again, and so does wherever it draws in the next
+void damage_script(script_t* p_entry)
+{
+  if (p_entry->drawn_frame + 1 == frame)
+    grow(damaged, p_entry->drawn);
+  p_entry->changed_frame = frame;
+}
+
+//=============================================================================
+// where scripts draw
+
+//---------------------------------------------------------
+void start_drawn(drawn_t* p_drawn, window_data_t* p_data)
+{
+  if (!damage)
+    return;
+  empty(p_drawn->bounds);
+  nvglMark(p_data->context.p_ctx, &p_drawn->mark);
+}
+
+//---------------------------------------------------------
+// the script is about to run another one. Take what it drew up to here, so
+// the other one's drawing isn't gone over twice
+void drawn_child(drawn_t* p_drawn, window_data_t* p_data)
+{
+  if (!damage)
+    return;
+  nvglBounds(p_data->context.p_ctx, &p_drawn->mark, p_drawn->bounds);
+  empty(child_drawn);
+}
+
+//---------------------------------------------------------
+void drawn_child_done(drawn_t* p_drawn, window_data_t* p_data)
+{
+  if (!damage)
+    return;
+  grow(p_drawn->bounds, child_drawn);
+  nvglMark(p_data->context.p_ctx, &p_drawn->mark);
+}
+
+//---------------------------------------------------------
+// a script can run more than once in a frame. It drew on all of those places
+void finish_drawn(drawn_t* p_drawn, window_data_t* p_data, script_t* p_entry)
+{
+  if (!damage)
+    return;
+  nvglBounds(p_data->context.p_ctx, &p_drawn->mark, p_drawn->bounds);
+
+  if (p_entry->drawn_frame == frame)
+  {
+    grow(p_entry->drawn, p_drawn->bounds);
+  }
+  else
+  {
+    memcpy(p_entry->drawn, p_drawn->bounds, sizeof(p_entry->drawn));
+    p_entry->drawn_frame = frame;
+  }
+
+  if (p_entry->changed_frame == frame)
+    grow(damaged, p_drawn->bounds);
+
+  memcpy(child_drawn, p_drawn->bounds, sizeof(child_drawn));
+}
+
+//=============================================================================
+// the kept frame
+
+//---------------------------------------------------------
+static void free_target()
+{
+  glDeleteFramebuffers(1, &target.fbo);
+  glDeleteRenderbuffers(1, &target.color);
+  glDeleteRenderbuffers(1, &target.stencil);
+  memset(&target, 0, sizeof(target_t));
+}
+
+//---------------------------------------------------------
+// nanovg needs a stencil buffer along with the color
+static bool make_target(int width, int height)
+{
+  glGenFramebuffers(1, &target.fbo);
+  glGenRenderbuffers(1, &target.color);
+  glGenRenderbuffers(1, &target.stencil);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, target.stencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, target.color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, target.stencil);
+  bool ok = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  if (!ok)
+  {
+    free_target();
+    return false;
+  }
+  target.width  = width;
+  target.height = height;
+  return true;
+}
+
+//---------------------------------------------------------
+// draw into the kept frame, making it first if it isn't there or is the
+// wrong size. false if the frame is drawn straight to the window
+static bool bind_target(context_t* p_context)
+{
+  int width  = p_context->frame_width;
+  int height = p_context->frame_height;
+  if (width <= 0 || height <= 0)
+    return false;
+
+  if (target.fbo != 0 && (target.width != width || target.height != height))
+    free_target();
+
+  if (target.fbo == 0)
+  {
+    if (!p_context->glew_ok ||
+        !(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) ||
+        !make_target(width, height))
+    {
+      // no point trying again every frame
+      damage = false;
+      return false;
+    }
+    full = true;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+  return true;
+}
+
+//=============================================================================
+// frames
+
+//---------------------------------------------------------
+// the scripts have run, but nothing is drawn yet. Clip the frame to what
+// changed and clear that part
+void clip_frame(window_data_t* p_data)
+{
+  context_t* p_context = &p_data->context;
+
+  if (p_data->root_script != last_root ||
+      p_data->tx_generation != last_tx_generation ||
+      p_context->window_width != last_width ||
+      p_context->window_height != last_height)
+    full = true;
+  last_root          = p_data->root_script;
+  last_tx_generation = p_data->tx_generation;
+  last_width         = p_context->window_width;
+  last_height        = p_context->window_height;
+
+  if (!damage || !bind_target(p_context) || full)
+  {
+    glClear(GL_COLOR_BUFFER_BIT);
+    full_frames++;
+    return;
+  }
+
+  // to framebuffer pixels, bottom up
+  int x = 0, y = 0, w = 0, h = 0;
+  if (damaged[0] <= damaged[2] && damaged[1] <= damaged[3])
+  {
+    float rx = p_context->frame_ratio.x;
+    float ry = p_context->frame_ratio.y;
+    int   x0 = fmaxf(floorf(damaged[0] * rx) - DAMAGE_MARGIN, 0);
+    int   x1 = fminf(ceilf(damaged[2] * rx) + DAMAGE_MARGIN, target.width);
+    int   y0 = fmaxf(floorf(damaged[1] * ry) - DAMAGE_MARGIN, 0);
+    int   y1 = fminf(ceilf(damaged[3] * ry) + DAMAGE_MARGIN, target.height);
+    if (x1 > x0 && y1 > y0)
+    {
+      x = x0;
+      y = target.height - y1;
+      w = x1 - x0;
+      h = y1 - y0;
+    }
+  }
+
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(x, y, w, h);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glDisable(GL_SCISSOR_TEST);
+  nvglClip(p_context->p_ctx, x, y, w, h);
+  partial_frames++;
+}
+
+//---------------------------------------------------------
+// the frame is drawn. Copy it to the window and start on the next one
+void present_frame(window_data_t* p_data)
+{
+  if (damage && target.fbo != 0)
+  {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width,
+                      target.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  frame++;
+  full = false;
+  empty(damaged);
+}
@@ -0,0 +1,41 @@
+/*
+Partial redraw. Only the part of the window that changed since the last
+frame is drawn again.
+*/
+
+#ifndef _DAMAGE_H
+#define _DAMAGE_H
+
+#include "comms.h"
+#include "types.h"
+
+#ifndef NANOVG_GL_H
+#include "nanovg/nanovg_gl.h"
+#endif
+
+// where a script has drawn so far while it runs. Lives on the stack of
+// run_script
+typedef struct
+{
+  NVGLmark mark;
+  float    bounds[4];
+} drawn_t;
+
+void set_damage(bool on);
+void damage_all();
+void damage_bounds(const float* p_bounds);
+void damage_script(script_t* p_entry);
+uint32_t current_frame();
+
+void start_drawn(drawn_t* p_drawn, window_data_t* p_data);
+void drawn_child(drawn_t* p_drawn, window_data_t* p_data);
+void drawn_child_done(drawn_t* p_drawn, window_data_t* p_data);
+void finish_drawn(drawn_t* p_drawn, window_data_t* p_data, script_t* p_entry);
+
+void clip_frame(window_data_t* p_data);
+void present_frame(window_data_t* p_data);
+
+uint32_t get_partial_frames();
+uint32_t get_full_frames();
+
+#endif
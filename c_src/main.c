@@ -13,6 +13,7 @@
 #include <fcntl.h> //O_BINARY
 #endif
 
+#include "capture.h"
 #include "comms.h"
 
 #include <GL/glew.h>
@@ -22,8 +23,13 @@
 #include "nanovg/nanovg.h"
 #include "nanovg/nanovg_gl.h"
 
+#include "damage.h"
 #include "render_script.h"
+#include "retained.h"
+#include "script_cache.h"
+#include "script_table.h"
 #include "types.h"
+#include "tx.h"
 #include "utils.h"
 
 #define STDIN_FILENO 0
@@ -37,6 +43,12 @@
 #define MSG_DROP_PATHS_MASK 0x0040
 #define MSG_RESHAPE_MASK 0x0080
 
+// cursor moves, scrolls and reshapes go up at most this often, in seconds
+#define INPUT_INTERVAL 0.016
+
+// the longest the main loop sleeps if the caller doesn't say, in ms
+#define DEFAULT_MAX_IDLE 1000
+
 //=============================================================================
 // window callbacks
 
@@ -73,12 +85,74 @@ void reshape_window(GLFWwindow* window, int w, int h)
   p_data->context.frame_ratio.y = (float) p_data->context.frame_height /
                                   (float) p_data->context.window_height;
 
-  send_reshape(p_data->context.window_width, p_data->context.window_height, w,
-               h);
+  // sent with the other high rate input
+  p_data->pending.reshaped = true;
 
   p_data->redraw = true;
 }
 
+//---------------------------------------------------------
+bool input_pending(window_data_t* p_data)
+{
+  return p_data->pending.reshaped || p_data->pending.cursor_moved ||
+         p_data->pending.scrolled;
+}
+
+//---------------------------------------------------------
+void send_pending_scroll(pending_input_t* p_pending)
+{
+  send_scroll(p_pending->scroll_x, p_pending->scroll_y,
+              p_pending->scroll_pos_x, p_pending->scroll_pos_y,
+              p_pending->scroll_time);
+  p_pending->scrolled = false;
+}
+
+//---------------------------------------------------------
+// send up whatever high rate input has collected since the last time
+void send_pending_input(window_data_t* p_data)
+{
+  pending_input_t* p_pending = &p_data->pending;
+
+  if (!input_pending(p_data))
+    return;
+
+  if (p_pending->reshaped)
+  {
+    send_reshape(p_data->context.window_width, p_data->context.window_height,
+                 p_data->context.window_width, p_data->context.window_height);
+  }
+
+  // keep the events in time order. The scroll may have started before the
+  // latest cursor move
+  if (p_pending->scrolled && (p_pending->scroll_time <= p_pending->cursor_time))
+  {
+    send_pending_scroll(p_pending);
+  }
+
+  // only send the cursor if the postion changed
+  if (p_pending->cursor_moved &&
+      ((p_data->last_x != p_pending->cursor_x) ||
+       (p_data->last_y != p_pending->cursor_y)))
+  {
+    send_cursor_pos(p_pending->cursor_x, p_pending->cursor_y,
+                    p_pending->cursor_time);
+    p_data->last_x = p_pending->cursor_x;
+    p_data->last_y = p_pending->cursor_y;
+  }
+
+  if (p_pending->scrolled)
+  {
+    send_pending_scroll(p_pending);
+  }
+
+  p_pending->reshaped     = false;
+  p_pending->cursor_moved = false;
+  p_pending->scrolled     = false;
+  p_pending->scroll_x     = 0;
+  p_pending->scroll_y     = 0;
+  p_pending->next_send    = glfwGetTime() + INPUT_INTERVAL;
+}
+
 //---------------------------------------------------------
 void key_callback(GLFWwindow* window, int key, int scancode, int action,
                   int mods)
@@ -86,7 +160,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action,
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data->input_flags & MSG_KEY_MASK)
   {
-    send_key(key, scancode, action, mods);
+    send_key(key, scancode, action, mods, glfwGetTime());
   }
 }
 
@@ -96,26 +170,21 @@ void charmods_callback(GLFWwindow* window, unsigned int codepoint, int mods)
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data->input_flags & MSG_CHAR_MASK)
   {
-    send_codepoint(codepoint, mods);
+    send_codepoint(codepoint, mods, glfwGetTime());
   }
 }
 
 //---------------------------------------------------------
+// only the latest position is kept. It goes up with the next pending input
 static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 {
-  float          x, y;
   window_data_t* p_data = glfwGetWindowUserPointer(window);
-  if (p_data->input_flags & MSG_MOUSE_MOVE_MASK || true)
+  if (p_data->input_flags & MSG_MOUSE_MOVE_MASK)
   {
-    x = xpos;
-    y = ypos;
-    // only send the message if the postion changed
-    if ((p_data->last_x != x) || (p_data->last_y != y))
-    {
-      send_cursor_pos(x, y);
-      p_data->last_x = x;
-      p_data->last_y = y;
-    }
+    p_data->pending.cursor_moved = true;
+    p_data->pending.cursor_x     = xpos;
+    p_data->pending.cursor_y     = ypos;
+    p_data->pending.cursor_time  = glfwGetTime();
   }
 }
 
@@ -126,12 +195,15 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data->input_flags & MSG_MOUSE_BUTTON_MASK)
   {
+    // anything held back happened first
+    send_pending_input(p_data);
     glfwGetCursorPos(window, &x, &y);
-    send_mouse_button(button, action, mods, x, y);
+    send_mouse_button(button, action, mods, x, y, glfwGetTime());
   }
 }
 
 //---------------------------------------------------------
+// scrolling adds up until the next pending input is sent
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
   double         x, y;
@@ -139,7 +211,12 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
   if (p_data->input_flags & MSG_MOUSE_SCROLL_MASK)
   {
     glfwGetCursorPos(window, &x, &y);
-    send_scroll(xoffset, yoffset, x, y);
+    p_data->pending.scrolled = true;
+    p_data->pending.scroll_x += xoffset;
+    p_data->pending.scroll_y += yoffset;
+    p_data->pending.scroll_pos_x = x;
+    p_data->pending.scroll_pos_y = y;
+    p_data->pending.scroll_time  = glfwGetTime();
   }
 }
 //---------------------------------------------------------
@@ -149,8 +226,9 @@ void cursor_enter_callback(GLFWwindow* window, int entered)
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data->input_flags & MSG_MOUSE_ENTER_MASK)
   {
+    send_pending_input(p_data);
     glfwGetCursorPos(window, &x, &y);
-    send_cursor_enter(entered, x, y);
+    send_cursor_enter(entered, x, y, glfwGetTime());
   }
 }
 
@@ -194,8 +272,6 @@ void setup_window(GLFWwindow* window, int width, int height, int num_scripts)
   // set up the window's private data
   p_data = malloc(sizeof(window_data_t));
   memset(p_data, 0, sizeof(window_data_t));
-  p_data->p_scripts = NULL;
-
   p_data->keep_going = true;
 
   p_data->input_flags = 0xFFFF;
@@ -248,16 +324,12 @@ void setup_window(GLFWwindow* window, int width, int height, int num_scripts)
   glfwSetScrollCallback(window, scroll_callback);
   glfwSetWindowCloseCallback(window, window_close_callback);
 
-  // set up the scripts table
-  p_data->p_scripts = malloc(sizeof(void*) * num_scripts);
-  memset(p_data->p_scripts, 0, sizeof(void*) * num_scripts);
-  p_data->num_scripts = num_scripts;
+  // the scripts table grows as needed. make room for the expected ones now
+  if (num_scripts > 0)
+    reserve_scripts(&p_data->scripts, num_scripts);
 
   // set the initial clear color
   glClearColor(0.0, 0.0, 0.0, 1.0);
-
-  // signal the app that the window is ready
-  send_ready(0);
 }
 
 //---------------------------------------------------------
@@ -265,7 +337,10 @@ void setup_window(GLFWwindow* window, int width, int height, int num_scripts)
 void cleanup_window(GLFWwindow* window)
 {
   // free the window's private data
-  free(glfwGetWindowUserPointer(window));
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data != NULL)
+    free_tx_uploads(p_data);
+  free(p_data);
 }
 
 //---------------------------------------------------------
@@ -276,8 +351,10 @@ int main(int argc, char** argv)
 
   test_endian();
 
-  // super simple arg check
-  if (argc != 6)
+  // super simple arg check. The first five are all a driver has ever been
+  // started with. Anything newer is optional, so any version of the library
+  // can start any version of the driver
+  if (argc < 6 || argc > 8)
   {
     printf("\r\nscenic_driver_glfw should be launched via the "
            "Scenic.Driver.Glfw library.\r\n\r\n");
@@ -288,10 +365,26 @@ int main(int argc, char** argv)
   // argv[2] is the height of the window
   int height = atoi(argv[2]);
 
-  // argv[5] is the space to allocate for lists
+  // argv[5] is how many scripts to make room for up front
   // becoming obsolete
   int dl_block_size = atoi(argv[5]);
 
+  // the longest the main loop sleeps with nothing to do, in ms. Input and
+  // messages from the caller wake it right away regardless. 0 means sleep
+  // until something happens. From the environment, or argv[6]
+  const char* p_idle = getenv("SCENIC_DRIVER_GLFW_MAX_IDLE");
+  if (p_idle == NULL && argc > 6)
+    p_idle = argv[6];
+  double max_idle = (p_idle != NULL ? atoi(p_idle) : DEFAULT_MAX_IDLE) / 1000.0;
+
+  // the name of a shared memory ring the caller writes bulk messages into,
+  // from the environment or argv[7]. Fall back to the pipe if there is none
+  // or it can't be mapped. The caller only uses it once told it was.
+  const char* p_shm = getenv("SCENIC_DRIVER_GLFW_SHM");
+  if (p_shm == NULL && argc > 7)
+    p_shm = argv[7];
+  bool shm_ok = p_shm != NULL && map_shm(p_shm);
+
   /* Initialize the library */
   if (!glfwInit())
   {
@@ -316,6 +409,13 @@ int main(int argc, char** argv)
   setup_window(window, width, height, dl_block_size);
   window_data_t* p_data = glfwGetWindowUserPointer(window);
 
+  // signal the app that the window is ready, and what it can handle
+  GLint max_texture_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+  // scripts can use any id except the one root_script uses for none
+  send_ready(0, shm_ok, UINT32_MAX, max_texture_size);
+  flush_msgs();
+
 #ifdef __APPLE__
   // heinous hack to get around macOS Mojave GL issues
   // without this, the window is blank until manually resized
@@ -331,17 +431,62 @@ int main(int argc, char** argv)
   _setmode(_fileno(stdout), O_BINARY);
 #endif
 
+  // the messages from the caller can be recorded to a file, or played back
+  // from one in place of the caller. These are set from the environment so
+  // the caller doesn't need to know.
+  const char* p_replay = getenv("SCENIC_DRIVER_GLFW_REPLAY");
+  const char* p_record = getenv("SCENIC_DRIVER_GLFW_RECORD");
+  if (p_replay != NULL)
+  {
+    bool fast = getenv("SCENIC_DRIVER_GLFW_REPLAY_FAST") != NULL;
+    if (!start_replay(p_replay, fast))
+      send_puts("Could not open replay file");
+  }
+  else if (p_record != NULL && !start_recording(p_record))
+  {
+    send_puts("Could not open record file");
+  }
+
+  // count and time the script ops. read back with the stats
+  set_script_profiling(getenv("SCENIC_DRIVER_GLFW_PROFILE") != NULL);
+
+  // keep what each script draws to draw it again. on unless turned off
+  set_retained(getenv("SCENIC_DRIVER_GLFW_IMMEDIATE") == NULL);
+
+  // only draw the part of the window that changed. on unless turned off
+  set_damage(getenv("SCENIC_DRIVER_GLFW_FULL_REDRAW") == NULL);
+
+  // skip scripts that draw where it can't be seen. on unless turned off
+  set_culling(getenv("SCENIC_DRIVER_GLFW_NO_CULL") == NULL);
+
+  // drop ops from scripts that can't change what they draw. on unless
+  // turned off
+  set_optimizing(getenv("SCENIC_DRIVER_GLFW_NO_OPTIMIZE") == NULL);
+
+  // GPU memory for scripts cached as textures. 0 turns it off
+  const char* p_budget = getenv("SCENIC_DRIVER_GLFW_CACHE_BUDGET");
+  set_cache_budget(p_data, p_budget != NULL ? strtoul(p_budget, NULL, 10)
+                                            : 16 * 1024 * 1024);
+
+  // messages from the caller are read on their own thread
+  if (!start_comms_thread(window))
+  {
+    send_puts("Could not start comms thread!!!");
+    flush_msgs();
+    cleanup_window(window);
+    glfwTerminate();
+    return -1;
+  }
+
   /* Loop until the calling app closes the window */
-  while (p_data->keep_going && !isCallerDown())
+  while (p_data->keep_going)
   {
-    // check for incoming messages - blocks with a timeout
+    // handle the messages that have come in
     if (p_data->redraw || handle_stdio_in(window))
     {
       p_data->redraw = false;
 
-      // clear the buffer
-      glClear(GL_COLOR_BUFFER_BIT);
-      // render the scene
+      // render the scene. nanovg draws it all at the end of the frame
       nvgBeginFrame(p_data->context.p_ctx, p_data->context.window_width,
                     p_data->context.window_height,
                     p_data->context.frame_ratio.x);
@@ -349,16 +494,48 @@ int main(int argc, char** argv)
       {
         run_script(p_data->root_script, p_data);
       }
+      // by then it is known what changed. Clear and draw only that
+      clip_frame(p_data);
       nvgEndFrame(p_data->context.p_ctx);
+      // scripts cached in this frame get their textures now
+      draw_caches(p_data);
+      present_frame(p_data);
       // Swap front and back buffers
       glfwSwapBuffers(window);
+      p_data->frame_time = glfwGetTime();
     }
 
-    // poll for events and return immediately
-    glfwPollEvents();
+    // wait for events. The reader thread posts an empty event to wake this
+    // up when a message arrives. Don't wait if some are still queued or if
+    // it is time to stop. Held back input cuts the wait short.
+    double timeout = max_idle;
+    bool   poll    = msgs_pending() || !p_data->keep_going;
+    if (input_pending(p_data))
+    {
+      double due = p_data->pending.next_send - glfwGetTime();
+      if (due <= 0)
+        poll = true;
+      else if (timeout <= 0 || due < timeout)
+        timeout = due;
+    }
+
+    if (poll)
+      glfwPollEvents();
+    else if (timeout > 0)
+      glfwWaitEventsTimeout(timeout);
+    else
+      glfwWaitEvents();
+
+    // high rate input goes up at most once a frame
+    if (glfwGetTime() >= p_data->pending.next_send)
+      send_pending_input(p_data);
+
+    // send everything that was queued up during this frame in one go
+    flush_frame_msgs();
   }
 
   // clean up
+  flush_msgs();
   cleanup_window(window);
   glfwTerminate();
 
@@ -125,6 +125,7 @@ struct NVGcontext {
 	struct FONScontext* fs;
 	int fontImages[NVG_MAX_FONTIMAGES];
 	int fontImageIdx;
+	int atlasGeneration;
 	int drawCallCount;
 	int fillTriCount;
 	int strokeTriCount;
@@ -1069,19 +1070,25 @@ static float nvg__distPtSeg(float x, float y, float px, float py, float qx, floa
 	return dx*dx + dy*dy;
 }
 
-static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
+static int nvg__reserveCommands(NVGcontext* ctx, int nvals)
 {
-	NVGstate* state = nvg__getState(ctx);
-	int i;
-
 	if (ctx->ncommands+nvals > ctx->ccommands) {
 		float* commands;
 		int ccommands = ctx->ncommands+nvals + ctx->ccommands/2;
 		commands = (float*)realloc(ctx->commands, sizeof(float)*ccommands);
-		if (commands == NULL) return;
+		if (commands == NULL) return 0;
 		ctx->commands = commands;
 		ctx->ccommands = ccommands;
 	}
+	return 1;
+}
+
+static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
+{
+	NVGstate* state = nvg__getState(ctx);
+	int i;
+
+	if (!nvg__reserveCommands(ctx, nvals)) return;
 
 	if ((int)vals[0] != NVG_CLOSE && (int)vals[0] != NVG_WINDING) {
 		ctx->commandx = vals[nvals-2];
@@ -1981,6 +1988,28 @@ void nvgLineTo(NVGcontext* ctx, float x, float y)
 	nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
 }
 
+void nvgPolyline(NVGcontext* ctx, const float* pts, int npts, int close)
+{
+	NVGstate* state = nvg__getState(ctx);
+	int i, nvals = npts*3 + (close ? 1 : 0);
+	float* vals;
+
+	if (npts <= 0 || !nvg__reserveCommands(ctx, nvals)) return;
+
+	// written in place, already transformed, instead of a command at a time
+	vals = &ctx->commands[ctx->ncommands];
+	for (i = 0; i < npts; i++) {
+		vals[i*3] = i == 0 ? NVG_MOVETO : NVG_LINETO;
+		nvgTransformPoint(&vals[i*3+1], &vals[i*3+2], state->xform, pts[i*2], pts[i*2+1]);
+	}
+	if (close)
+		vals[npts*3] = NVG_CLOSE;
+
+	ctx->commandx = pts[npts*2-2];
+	ctx->commandy = pts[npts*2-1];
+	ctx->ncommands += nvals;
+}
+
 void nvgBezierTo(NVGcontext* ctx, float c1x, float c1y, float c2x, float c2y, float x, float y)
 {
 	float vals[] = { NVG_BEZIERTO, c1x, c1y, c2x, c2y, x, y };
@@ -2216,6 +2245,131 @@ void nvgDebugDumpPathCache(NVGcontext* ctx)
 	}
 }
 
+int nvgStateSize(void)
+{
+	return sizeof(NVGstate);
+}
+
+void nvgGetState(NVGcontext* ctx, void* state)
+{
+	memcpy(state, nvg__getState(ctx), sizeof(NVGstate));
+}
+
+void nvgSetState(NVGcontext* ctx, const void* state)
+{
+	memcpy(nvg__getState(ctx), state, sizeof(NVGstate));
+}
+
+int nvgStateDepth(NVGcontext* ctx)
+{
+	return ctx->nstates;
+}
+
+static int nvg__scissorActive(const NVGscissor* scissor)
+{
+	return scissor->extent[0] > -0.5f && scissor->extent[1] > -0.5f;
+}
+
+// A plain color draws the same whatever its transform is.
+static int nvg__paintIsColor(const NVGpaint* paint)
+{
+	return paint->image == 0 && memcmp(&paint->innerColor, &paint->outerColor, sizeof(NVGcolor)) == 0;
+}
+
+static int nvg__movedBy(const float* from, const float* to, float dx, float dy)
+{
+	return nvg__absf((to[4] - from[4]) - dx) < 1e-3f && nvg__absf((to[5] - from[5]) - dy) < 1e-3f;
+}
+
+static void nvg__clearTranslation(float* xform)
+{
+	xform[4] = 0.0f;
+	xform[5] = 0.0f;
+}
+
+int nvgStateMoved(const void* from, const void* to, float* dx, float* dy)
+{
+	NVGstate a, b;
+	memcpy(&a, from, sizeof(NVGstate));
+	memcpy(&b, to, sizeof(NVGstate));
+
+	*dx = b.xform[4] - a.xform[4];
+	*dy = b.xform[5] - a.xform[5];
+	nvg__clearTranslation(a.xform);
+	nvg__clearTranslation(b.xform);
+
+	// whatever moves with the transform has to move by the same amount
+	if (nvg__scissorActive(&a.scissor) && nvg__scissorActive(&b.scissor)) {
+		if (!nvg__movedBy(a.scissor.xform, b.scissor.xform, *dx, *dy)) return 0;
+		nvg__clearTranslation(a.scissor.xform);
+		nvg__clearTranslation(b.scissor.xform);
+	}
+	if (!nvg__paintIsColor(&a.fill) || !nvg__paintIsColor(&b.fill)) {
+		if (!nvg__movedBy(a.fill.xform, b.fill.xform, *dx, *dy)) return 0;
+	}
+	if (!nvg__paintIsColor(&a.stroke) || !nvg__paintIsColor(&b.stroke)) {
+		if (!nvg__movedBy(a.stroke.xform, b.stroke.xform, *dx, *dy)) return 0;
+	}
+	nvg__clearTranslation(a.fill.xform);
+	nvg__clearTranslation(b.fill.xform);
+	nvg__clearTranslation(a.stroke.xform);
+	nvg__clearTranslation(b.stroke.xform);
+
+	return memcmp(&a, &b, sizeof(NVGstate)) == 0;
+}
+
+void nvgTranslateState(void* state, float dx, float dy)
+{
+	NVGstate* s = (NVGstate*)state;
+	s->xform[4] += dx;
+	s->xform[5] += dy;
+	if (nvg__scissorActive(&s->scissor)) {
+		s->scissor.xform[4] += dx;
+		s->scissor.xform[5] += dy;
+	}
+	if (!nvg__paintIsColor(&s->fill)) {
+		s->fill.xform[4] += dx;
+		s->fill.xform[5] += dy;
+	}
+	if (!nvg__paintIsColor(&s->stroke)) {
+		s->stroke.xform[4] += dx;
+		s->stroke.xform[5] += dy;
+	}
+}
+
+int nvgTextAtlasGeneration(NVGcontext* ctx)
+{
+	return ctx->atlasGeneration;
+}
+
+void nvgCurrentReach(NVGcontext* ctx, float* strokeWidth, float* miterLimit, float* fontSize,
+					 float* fontBlur, float* lineHeight)
+{
+	NVGstate* state = nvg__getState(ctx);
+	*strokeWidth = state->strokeWidth;
+	*miterLimit = state->miterLimit;
+	*fontSize = state->fontSize;
+	*fontBlur = state->fontBlur;
+	*lineHeight = state->lineHeight;
+}
+
+int nvgCurrentScissorBounds(NVGcontext* ctx, float* bounds)
+{
+	NVGstate* state = nvg__getState(ctx);
+	const float* xform = state->scissor.xform;
+	const float* extent = state->scissor.extent;
+	float ex, ey;
+	if (!nvg__scissorActive(&state->scissor)) return 0;
+
+	ex = nvg__absf(xform[0])*extent[0] + nvg__absf(xform[2])*extent[1];
+	ey = nvg__absf(xform[1])*extent[0] + nvg__absf(xform[3])*extent[1];
+	bounds[0] = xform[4] - ex;
+	bounds[1] = xform[5] - ey;
+	bounds[2] = xform[4] + ex;
+	bounds[3] = xform[5] + ey;
+	return 1;
+}
+
 void nvgFill(NVGcontext* ctx)
 {
 	NVGstate* state = nvg__getState(ctx);
@@ -2408,6 +2562,7 @@ static int nvg__allocTextAtlas(NVGcontext* ctx)
 	}
 	++ctx->fontImageIdx;
 	fonsResetAtlas(ctx->fs, iw, ih);
+	++ctx->atlasGeneration;
 	return 1;
 }
 
@@ -2496,6 +2651,91 @@ float nvgText(NVGcontext* ctx, float x, float y, const char* string, const char*
 	return iter.nextx / scale;
 }
 
+void nvgCurrentTextStyle(NVGcontext* ctx, NVGtextStyle* style)
+{
+	NVGstate* state = nvg__getState(ctx);
+	memset(style, 0, sizeof(*style));
+	style->fontId = state->fontId;
+	style->align = state->textAlign;
+	style->size = state->fontSize;
+	style->spacing = state->letterSpacing;
+	style->blur = state->fontBlur;
+	style->lineHeight = state->lineHeight;
+	style->scale = nvg__getFontScale(state) * ctx->devicePxRatio;
+}
+
+int nvgTextGlyphQuads(NVGcontext* ctx, float x, float y, const char* string, const char* end,
+					  NVGglyphQuad* quads, int maxQuads)
+{
+	NVGstate* state = nvg__getState(ctx);
+	FONStextIter iter;
+	FONSquad q;
+	float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
+	float invscale = 1.0f / scale;
+	int nquads = 0;
+
+	if (end == NULL)
+		end = string + strlen(string);
+
+	if (state->fontId == FONS_INVALID) return 0;
+
+	fonsSetSize(ctx->fs, state->fontSize*scale);
+	fonsSetSpacing(ctx->fs, state->letterSpacing*scale);
+	fonsSetBlur(ctx->fs, state->fontBlur*scale);
+	fonsSetAlign(ctx->fs, state->textAlign);
+	fonsSetFont(ctx->fs, state->fontId);
+
+	fonsTextIterInit(ctx->fs, &iter, x*scale, y*scale, string, end, FONS_GLYPH_BITMAP_REQUIRED);
+	while (fonsTextIterNext(ctx->fs, &iter, &q)) {
+		if (iter.prevGlyphIndex == -1) // no room in the atlas
+			return -1;
+		if (nquads < maxQuads) {
+			NVGglyphQuad* quad = &quads[nquads++];
+			quad->x0 = q.x0*invscale;
+			quad->y0 = q.y0*invscale;
+			quad->x1 = q.x1*invscale;
+			quad->y1 = q.y1*invscale;
+			quad->s0 = q.s0;
+			quad->t0 = q.t0;
+			quad->s1 = q.s1;
+			quad->t1 = q.t1;
+		}
+	}
+
+	nvg__flushTextTexture(ctx);
+	return nquads;
+}
+
+void nvgDrawGlyphQuads(NVGcontext* ctx, const NVGglyphQuad* quads, int nquads)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGvertex* verts;
+	int i, nverts = 0;
+
+	if (nquads <= 0) return;
+	verts = nvg__allocTempVerts(ctx, nquads * 6);
+	if (verts == NULL) return;
+
+	for (i = 0; i < nquads; i++) {
+		const NVGglyphQuad* q = &quads[i];
+		float c[4*2];
+		// Transform corners.
+		nvgTransformPoint(&c[0],&c[1], state->xform, q->x0, q->y0);
+		nvgTransformPoint(&c[2],&c[3], state->xform, q->x1, q->y0);
+		nvgTransformPoint(&c[4],&c[5], state->xform, q->x1, q->y1);
+		nvgTransformPoint(&c[6],&c[7], state->xform, q->x0, q->y1);
+		// Create triangles
+		nvg__vset(&verts[nverts], c[0], c[1], q->s0, q->t0); nverts++;
+		nvg__vset(&verts[nverts], c[4], c[5], q->s1, q->t1); nverts++;
+		nvg__vset(&verts[nverts], c[2], c[3], q->s1, q->t0); nverts++;
+		nvg__vset(&verts[nverts], c[0], c[1], q->s0, q->t0); nverts++;
+		nvg__vset(&verts[nverts], c[6], c[7], q->s0, q->t1); nverts++;
+		nvg__vset(&verts[nverts], c[4], c[5], q->s1, q->t1); nverts++;
+	}
+
+	nvg__renderText(ctx, verts, nverts);
+}
+
 void nvgTextBox(NVGcontext* ctx, float x, float y, float breakRowWidth, const char* string, const char* end)
 {
 	NVGstate* state = nvg__getState(ctx);
@@ -467,6 +467,10 @@ void nvgMoveTo(NVGcontext* ctx, float x, float y);
 // Adds line segment from the last point in the path to the specified point.
 void nvgLineTo(NVGcontext* ctx, float x, float y);
 
+// Starts new sub-path at the first of npts points, given as x,y pairs, and adds line segments
+// through the rest. Closes the sub-path if close is non-zero.
+void nvgPolyline(NVGcontext* ctx, const float* pts, int npts, int close);
+
 // Adds cubic bezier segment from last point in the path via two control points to the specified point.
 void nvgBezierTo(NVGcontext* ctx, float c1x, float c1y, float c2x, float c2y, float x, float y);
 
@@ -672,6 +676,54 @@ NVGparams* nvgInternalParams(NVGcontext* ctx);
 // Debug function to dump cached path data.
 void nvgDebugDumpPathCache(NVGcontext* ctx);
 
+// Retained drawing support. A copy of the current state can be kept and compared
+// with a later one, to tell if drawing recorded under the first would come out the
+// same under the second moved by a translation (dx,dy).
+int nvgStateSize(void);
+void nvgGetState(NVGcontext* ctx, void* state);
+void nvgSetState(NVGcontext* ctx, const void* state);
+int nvgStateDepth(NVGcontext* ctx);
+int nvgStateMoved(const void* from, const void* to, float* dx, float* dy);
+void nvgTranslateState(void* state, float dx, float dy);
+
+// Changes every time the text atlas is reset. Text drawn before then points into the old atlas.
+int nvgTextAtlasGeneration(NVGcontext* ctx);
+
+// Culling support. The parts of the current state that decide how far drawing reaches past
+// its points, and the bounds of the current scissor in screen coordinates. Returns 0 if
+// there is no scissor.
+void nvgCurrentReach(NVGcontext* ctx, float* strokeWidth, float* miterLimit, float* fontSize,
+					 float* fontBlur, float* lineHeight);
+int nvgCurrentScissorBounds(NVGcontext* ctx, float* bounds);
+
+// Text layout support. Text laid out into glyph quads can be drawn again from them with any
+// transform, as long as the text style is the same and the text atlas hasn't been reset
+// since. The quads are in local coordinates, with their texture coordinates in the atlas.
+struct NVGglyphQuad {
+	float x0, y0, x1, y1;
+	float s0, t0, s1, t1;
+};
+typedef struct NVGglyphQuad NVGglyphQuad;
+
+// Everything the layout depends on. scale is the size glyphs are rendered at in the atlas.
+struct NVGtextStyle {
+	int fontId;
+	int align;
+	float size;
+	float spacing;
+	float blur;
+	float lineHeight;
+	float scale;
+};
+typedef struct NVGtextStyle NVGtextStyle;
+
+void nvgCurrentTextStyle(NVGcontext* ctx, NVGtextStyle* style);
+// Lays out a row of text like nvgText would draw it, into at most maxQuads quads. Returns
+// the number of quads, or -1 if the atlas is full. The atlas isn't grown, nvgText does that.
+int nvgTextGlyphQuads(NVGcontext* ctx, float x, float y, const char* string, const char* end,
+					  NVGglyphQuad* quads, int maxQuads);
+void nvgDrawGlyphQuads(NVGcontext* ctx, const NVGglyphQuad* quads, int nquads);
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
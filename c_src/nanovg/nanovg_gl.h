@@ -51,6 +51,16 @@ enum NVGcreateFlags {
 
 #define NANOVG_GL_USE_STATE_FILTER (1)
 
+// Consecutive calls that draw the same way are drawn with one glDrawElements. GLES2
+// can't count on 32 bit indices.
+#ifndef NANOVG_GL_USE_BATCHES
+#  if defined NANOVG_GLES2
+#    define NANOVG_GL_USE_BATCHES (0)
+#  else
+#    define NANOVG_GL_USE_BATCHES (1)
+#  endif
+#endif
+
 // Creates NanoVG contexts for different OpenGL (ES) versions.
 // Flags should be combination of the create flags above.
 
@@ -94,6 +104,35 @@ GLuint nvglImageHandleGLES3(NVGcontext* ctx, int image);
 
 #endif
 
+// Retained drawing. What was drawn since a mark can be kept and drawn again later,
+// moved by (dx,dy), without being tessellated again. A recording is only good while
+// the device pixel ratio, text atlas and images it used stay the same.
+struct NVGLmark {
+	int ncalls;
+	int npaths;
+	int nverts;
+	int nuniforms;
+};
+typedef struct NVGLmark NVGLmark;
+typedef struct NVGLrecording NVGLrecording;
+
+void nvglMark(NVGcontext* ctx, NVGLmark* mark);
+// Returns 0 if out of memory. *rec is NULL if nothing was drawn since the mark.
+int nvglRecord(NVGcontext* ctx, const NVGLmark* from, NVGLrecording** rec);
+int nvglReplay(NVGcontext* ctx, const NVGLrecording* rec, float dx, float dy);
+int nvglRecordingSize(const NVGLrecording* rec);
+void nvglDeleteRecording(NVGLrecording* rec);
+
+// Partial redraw. Grows bounds {minx,miny,maxx,maxy} to take in every vertex drawn since
+// a mark, in the same units as the view. The clip is a rectangle in framebuffer pixels,
+// bottom up, that the next flush draws inside of. w < 0 for no clip.
+void nvglBounds(NVGcontext* ctx, const NVGLmark* from, float* bounds);
+void nvglClip(NVGcontext* ctx, int x, int y, int w, int h);
+
+// Tinting. Multiplies the colors of everything drawn since a mark by a color, as if
+// each had been drawn in its color times that one.
+void nvglTint(NVGcontext* ctx, const NVGLmark* from, NVGcolor tint);
+
 // These are additional flags on top of NVGimageFlags.
 enum NVGimageFlagsGL {
 	NVG_IMAGE_NODELETE			= 1<<16,	// Do not delete GL texture handle.
@@ -107,6 +146,7 @@ enum NVGimageFlagsGL {
 
 #ifdef NANOVG_GL_IMPLEMENTATION
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -179,6 +219,14 @@ struct GLNVGcall {
 };
 typedef struct GLNVGcall GLNVGcall;
 
+struct GLNVGbatch {
+	int first;
+	int last;
+	int indexOffset;
+	int indexCount;
+};
+typedef struct GLNVGbatch GLNVGbatch;
+
 struct GLNVGpath {
 	int fillOffset;
 	int fillCount;
@@ -259,6 +307,19 @@ struct GLNVGcontext {
 	int cuniforms;
 	int nuniforms;
 
+	// Clip for the next flush
+	int clip[4];
+	int clipped;
+
+	// Runs of calls drawn as one, worked out at each flush
+	GLuint indexBuf;
+	GLuint* indices;
+	int cindices;
+	int nindices;
+	GLNVGbatch* batches;
+	int cbatches;
+	int nbatches;
+
 	// cached state
 	#if NANOVG_GL_USE_STATE_FILTER
 	GLuint boundTexture;
@@ -691,6 +752,9 @@ static int glnvg__renderCreate(void* uptr)
 	glGenVertexArrays(1, &gl->vertArr);
 #endif
 	glGenBuffers(1, &gl->vertBuf);
+#if NANOVG_GL_USE_BATCHES
+	glGenBuffers(1, &gl->indexBuf);
+#endif
 
 #if NANOVG_GL_USE_UNIFORMBUFFER
 	// Create UBOs
@@ -1113,12 +1177,160 @@ static void glnvg__triangles(GLNVGcontext* gl, GLNVGcall* call)
 	glDrawArrays(GL_TRIANGLES, call->triangleOffset, call->triangleCount);
 }
 
+#if NANOVG_GL_USE_BATCHES
+static int glnvg__allocIndices(GLNVGcontext* gl, int n)
+{
+	int ret = 0;
+	if (gl->nindices+n > gl->cindices) {
+		GLuint* indices;
+		int cindices = glnvg__maxi(gl->nindices + n, 4096) + gl->cindices/2; // 1.5x Overallocate
+		indices = (GLuint*)realloc(gl->indices, sizeof(GLuint) * cindices);
+		if (indices == NULL) return -1;
+		gl->indices = indices;
+		gl->cindices = cindices;
+	}
+	ret = gl->nindices;
+	gl->nindices += n;
+	return ret;
+}
+
+static GLNVGbatch* glnvg__allocBatch(GLNVGcontext* gl)
+{
+	if (gl->nbatches+1 > gl->cbatches) {
+		GLNVGbatch* batches;
+		int cbatches = glnvg__maxi(gl->nbatches+1, 64) + gl->cbatches/2; // 1.5x Overallocate
+		batches = (GLNVGbatch*)realloc(gl->batches, sizeof(GLNVGbatch) * cbatches);
+		if (batches == NULL) return NULL;
+		gl->batches = batches;
+		gl->cbatches = cbatches;
+	}
+	return &gl->batches[gl->nbatches++];
+}
+
+// Calls that draw triangles with the uniforms, texture and blend they are given and
+// nothing else.
+static int glnvg__batchable(const GLNVGcall* call)
+{
+	return call->type == GLNVG_CONVEXFILL || call->type == GLNVG_TRIANGLES;
+}
+
+// Whether two calls draw the same way. The paint matrix doesn't matter to textured
+// triangles, or to a gradient that is one color, so content moved by nvglReplay still
+// matches.
+static int glnvg__sameDraw(GLNVGcontext* gl, const GLNVGcall* a, const GLNVGcall* b)
+{
+	GLNVGfragUniforms* fa = nvg__fragUniformPtr(gl, a->uniformOffset);
+	GLNVGfragUniforms* fb = nvg__fragUniformPtr(gl, b->uniformOffset);
+	int solid;
+
+	if (!glnvg__batchable(b) || a->image != b->image ||
+		memcmp(&a->blendFunc, &b->blendFunc, sizeof(GLNVGblend)) != 0)
+		return 0;
+	if (fa->type != fb->type) return 0;
+
+	solid = fa->type == NSVG_SHADER_IMG ||
+		(fa->type == NSVG_SHADER_FILLGRAD &&
+		 memcmp(&fa->innerCol, &fa->outerCol, sizeof(NVGcolor)) == 0);
+	if (!solid)
+		return memcmp(fa, fb, sizeof(GLNVGfragUniforms)) == 0;
+	return memcmp(fa->scissorMat, fb->scissorMat, sizeof(fa->scissorMat)) == 0 &&
+		memcmp(&fa->innerCol, &fb->innerCol,
+			   sizeof(GLNVGfragUniforms) - offsetof(GLNVGfragUniforms, innerCol)) == 0;
+}
+
+static int glnvg__callIndexCount(GLNVGcontext* gl, const GLNVGcall* call)
+{
+	GLNVGpath* paths = &gl->paths[call->pathOffset];
+	int i, count = 0;
+	if (call->type == GLNVG_TRIANGLES)
+		return call->triangleCount;
+	for (i = 0; i < call->pathCount; i++) {
+		count += glnvg__maxi(paths[i].fillCount - 2, 0) * 3;
+		count += glnvg__maxi(paths[i].strokeCount - 2, 0) * 3;
+	}
+	return count;
+}
+
+// The triangles of the fans and strips a call would draw, in the order and facing
+// they would be drawn in.
+static GLuint* glnvg__callIndices(GLNVGcontext* gl, const GLNVGcall* call, GLuint* dst)
+{
+	GLNVGpath* paths = &gl->paths[call->pathOffset];
+	int i, j;
+	if (call->type == GLNVG_TRIANGLES) {
+		for (j = 0; j < call->triangleCount; j++)
+			*dst++ = call->triangleOffset + j;
+		return dst;
+	}
+	for (i = 0; i < call->pathCount; i++) {
+		GLuint o = paths[i].fillOffset;
+		for (j = 1; j < paths[i].fillCount - 1; j++) {
+			*dst++ = o;
+			*dst++ = o + j;
+			*dst++ = o + j + 1;
+		}
+		o = paths[i].strokeOffset;
+		for (j = 0; j < paths[i].strokeCount - 2; j++) {
+			*dst++ = o + j + (j & 1);
+			*dst++ = o + j + 1 - (j & 1);
+			*dst++ = o + j + 2;
+		}
+	}
+	return dst;
+}
+
+static void glnvg__buildBatches(GLNVGcontext* gl)
+{
+	int i, j, k, n, offset;
+	GLNVGbatch* batch;
+	GLuint* dst;
+
+	gl->nbatches = 0;
+	gl->nindices = 0;
+	for (i = 0; i < gl->ncalls; i = j + 1) {
+		j = i;
+		if (!glnvg__batchable(&gl->calls[i])) continue;
+		n = glnvg__callIndexCount(gl, &gl->calls[i]);
+		while (j + 1 < gl->ncalls && glnvg__sameDraw(gl, &gl->calls[i], &gl->calls[j + 1])) {
+			j++;
+			n += glnvg__callIndexCount(gl, &gl->calls[j]);
+		}
+		if (j == i) continue;
+
+		offset = glnvg__allocIndices(gl, n);
+		if (offset == -1) return;
+		batch = glnvg__allocBatch(gl);
+		if (batch == NULL) {
+			gl->nindices = offset;
+			return;
+		}
+		batch->first = i;
+		batch->last = j;
+		batch->indexOffset = offset;
+		batch->indexCount = n;
+		dst = &gl->indices[offset];
+		for (k = i; k <= j; k++)
+			dst = glnvg__callIndices(gl, &gl->calls[k], dst);
+	}
+}
+
+static void glnvg__drawBatch(GLNVGcontext* gl, const GLNVGbatch* batch)
+{
+	GLNVGcall* call = &gl->calls[batch->first];
+	glnvg__setUniforms(gl, call->uniformOffset, call->image);
+	glnvg__checkError(gl, "batch");
+	glDrawElements(GL_TRIANGLES, batch->indexCount, GL_UNSIGNED_INT,
+				   (const GLvoid*)(size_t)(batch->indexOffset * sizeof(GLuint)));
+}
+#endif
+
 static void glnvg__renderCancel(void* uptr) {
 	GLNVGcontext* gl = (GLNVGcontext*)uptr;
 	gl->nverts = 0;
 	gl->npaths = 0;
 	gl->ncalls = 0;
 	gl->nuniforms = 0;
+	gl->clipped = 0;
 }
 
 static GLenum glnvg_convertBlendFuncFactor(int factor)
@@ -1168,7 +1380,7 @@ static GLNVGblend glnvg__blendCompositeOperation(NVGcompositeOperationState op)
 static void glnvg__renderFlush(void* uptr)
 {
 	GLNVGcontext* gl = (GLNVGcontext*)uptr;
-	int i;
+	int i, b = 0;
 
 	if (gl->ncalls > 0) {
 
@@ -1180,7 +1392,12 @@ static void glnvg__renderFlush(void* uptr)
 		glFrontFace(GL_CCW);
 		glEnable(GL_BLEND);
 		glDisable(GL_DEPTH_TEST);
-		glDisable(GL_SCISSOR_TEST);
+		if (gl->clipped) {
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(gl->clip[0], gl->clip[1], gl->clip[2], gl->clip[3]);
+		} else {
+			glDisable(GL_SCISSOR_TEST);
+		}
 		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 		glStencilMask(0xffffffff);
 		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
@@ -1216,6 +1433,14 @@ static void glnvg__renderFlush(void* uptr)
 		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex), (const GLvoid*)(size_t)0);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex), (const GLvoid*)(0 + 2*sizeof(float)));
 
+#if NANOVG_GL_USE_BATCHES
+		glnvg__buildBatches(gl);
+		if (gl->nindices > 0) {
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->indexBuf);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, gl->nindices * sizeof(GLuint), gl->indices, GL_STREAM_DRAW);
+		}
+#endif
+
 		// Set view and texture just once per frame.
 		glUniform1i(gl->shader.loc[GLNVG_LOC_TEX], 0);
 		glUniform2fv(gl->shader.loc[GLNVG_LOC_VIEWSIZE], 1, gl->view);
@@ -1227,6 +1452,12 @@ static void glnvg__renderFlush(void* uptr)
 		for (i = 0; i < gl->ncalls; i++) {
 			GLNVGcall* call = &gl->calls[i];
 			glnvg__blendFuncSeparate(gl,&call->blendFunc);
+#if NANOVG_GL_USE_BATCHES
+			if (b < gl->nbatches && gl->batches[b].first == i) {
+				glnvg__drawBatch(gl, &gl->batches[b]);
+				i = gl->batches[b++].last;
+			} else
+#endif
 			if (call->type == GLNVG_FILL)
 				glnvg__fill(gl, call);
 			else if (call->type == GLNVG_CONVEXFILL)
@@ -1239,6 +1470,10 @@ static void glnvg__renderFlush(void* uptr)
 
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
+#if NANOVG_GL_USE_BATCHES
+		if (gl->nindices > 0)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+#endif
 #if defined NANOVG_GL3
 		glBindVertexArray(0);
 #endif
@@ -1246,6 +1481,7 @@ static void glnvg__renderFlush(void* uptr)
 			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glUseProgram(0);
 		glnvg__bindTexture(gl, 0);
+		if (gl->clipped) glDisable(GL_SCISSOR_TEST);
 	}
 
 	// Reset calls
@@ -1253,6 +1489,7 @@ static void glnvg__renderFlush(void* uptr)
 	gl->npaths = 0;
 	gl->ncalls = 0;
 	gl->nuniforms = 0;
+	gl->clipped = 0;
 }
 
 static int glnvg__maxVertCount(const NVGpath* paths, int npaths)
@@ -1533,6 +1770,8 @@ static void glnvg__renderDelete(void* uptr)
 #endif
 	if (gl->vertBuf != 0)
 		glDeleteBuffers(1, &gl->vertBuf);
+	if (gl->indexBuf != 0)
+		glDeleteBuffers(1, &gl->indexBuf);
 
 	for (i = 0; i < gl->ntextures; i++) {
 		if (gl->textures[i].tex != 0 && (gl->textures[i].flags & NVG_IMAGE_NODELETE) == 0)
@@ -1544,6 +1783,8 @@ static void glnvg__renderDelete(void* uptr)
 	free(gl->verts);
 	free(gl->uniforms);
 	free(gl->calls);
+	free(gl->indices);
+	free(gl->batches);
 
 	free(gl);
 }
@@ -1646,4 +1887,183 @@ GLuint nvglImageHandleGLES3(NVGcontext* ctx, int image)
 	return tex->tex;
 }
 
+struct NVGLrecording {
+	int ncalls;
+	int npaths;
+	int nverts;
+	int nuniforms;
+	int size;
+	GLNVGcall* calls;
+	GLNVGpath* paths;
+	NVGvertex* verts;
+	unsigned char* uniforms;
+};
+
+// Moves the screen to local matrices of a uniform so they follow content moved by (dx,dy).
+static void glnvg__translateMat3x4(float* m3, float dx, float dy)
+{
+	m3[8] -= m3[0]*dx + m3[4]*dy;
+	m3[9] -= m3[1]*dx + m3[5]*dy;
+}
+
+// Moves the offsets in calls and paths from one set of buffer positions to another.
+static void glnvg__rebase(GLNVGcall* calls, int ncalls, GLNVGpath* paths, int npaths,
+						  int dpaths, int dverts, int duniforms)
+{
+	int i;
+	for (i = 0; i < ncalls; i++) {
+		if (calls[i].pathCount > 0) calls[i].pathOffset += dpaths;
+		if (calls[i].triangleCount > 0) calls[i].triangleOffset += dverts;
+		calls[i].uniformOffset += duniforms;
+	}
+	for (i = 0; i < npaths; i++) {
+		if (paths[i].fillCount > 0) paths[i].fillOffset += dverts;
+		if (paths[i].strokeCount > 0) paths[i].strokeOffset += dverts;
+	}
+}
+
+void nvglMark(NVGcontext* ctx, NVGLmark* mark)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	mark->ncalls = gl->ncalls;
+	mark->npaths = gl->npaths;
+	mark->nverts = gl->nverts;
+	mark->nuniforms = gl->nuniforms;
+}
+
+int nvglRecord(NVGcontext* ctx, const NVGLmark* from, NVGLrecording** rec)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	NVGLrecording* r;
+	int ncalls = gl->ncalls - from->ncalls;
+	int npaths = gl->npaths - from->npaths;
+	int nverts = gl->nverts - from->nverts;
+	int nuniforms = gl->nuniforms - from->nuniforms;
+	int callSize = sizeof(GLNVGcall) * ncalls;
+	int pathSize = sizeof(GLNVGpath) * npaths;
+	int vertSize = sizeof(NVGvertex) * nverts;
+	int uniformSize = gl->fragSize * nuniforms;
+
+	*rec = NULL;
+	if (ncalls <= 0) return 1;
+
+	// one block, so a recording is a single allocation
+	r = (NVGLrecording*)malloc(sizeof(NVGLrecording) + callSize + pathSize + vertSize + uniformSize);
+	if (r == NULL) return 0;
+	r->ncalls = ncalls;
+	r->npaths = npaths;
+	r->nverts = nverts;
+	r->nuniforms = nuniforms;
+	r->size = sizeof(NVGLrecording) + callSize + pathSize + vertSize + uniformSize;
+	r->calls = (GLNVGcall*)(r + 1);
+	r->paths = (GLNVGpath*)((unsigned char*)r->calls + callSize);
+	r->verts = (NVGvertex*)((unsigned char*)r->paths + pathSize);
+	r->uniforms = (unsigned char*)r->verts + vertSize;
+
+	memcpy(r->calls, &gl->calls[from->ncalls], callSize);
+	memcpy(r->paths, &gl->paths[from->npaths], pathSize);
+	memcpy(r->verts, &gl->verts[from->nverts], vertSize);
+	memcpy(r->uniforms, &gl->uniforms[from->nuniforms * gl->fragSize], uniformSize);
+	glnvg__rebase(r->calls, ncalls, r->paths, npaths,
+				  -from->npaths, -from->nverts, -from->nuniforms * gl->fragSize);
+
+	*rec = r;
+	return 1;
+}
+
+int nvglReplay(NVGcontext* ctx, const NVGLrecording* rec, float dx, float dy)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	NVGLmark mark;
+	int i, paths, verts, uniforms;
+
+	nvglMark(ctx, &mark);
+	paths = glnvg__allocPaths(gl, rec->npaths);
+	verts = glnvg__allocVerts(gl, rec->nverts);
+	uniforms = glnvg__allocFragUniforms(gl, rec->nuniforms);
+	if (paths == -1 || verts == -1 || uniforms == -1) goto error;
+	for (i = 0; i < rec->ncalls; i++) {
+		if (glnvg__allocCall(gl) == NULL) goto error;
+	}
+
+	memcpy(&gl->calls[mark.ncalls], rec->calls, sizeof(GLNVGcall) * rec->ncalls);
+	memcpy(&gl->paths[paths], rec->paths, sizeof(GLNVGpath) * rec->npaths);
+	memcpy(&gl->verts[verts], rec->verts, sizeof(NVGvertex) * rec->nverts);
+	memcpy(&gl->uniforms[uniforms], rec->uniforms, gl->fragSize * rec->nuniforms);
+	glnvg__rebase(&gl->calls[mark.ncalls], rec->ncalls, &gl->paths[paths], rec->npaths,
+				  paths, verts, uniforms);
+
+	if (dx != 0.0f || dy != 0.0f) {
+		for (i = 0; i < rec->nverts; i++) {
+			gl->verts[verts + i].x += dx;
+			gl->verts[verts + i].y += dy;
+		}
+		for (i = 0; i < rec->nuniforms; i++) {
+			GLNVGfragUniforms* frag = nvg__fragUniformPtr(gl, uniforms + i * gl->fragSize);
+			glnvg__translateMat3x4(frag->scissorMat, dx, dy);
+			glnvg__translateMat3x4(frag->paintMat, dx, dy);
+		}
+	}
+	return 1;
+
+error:
+	gl->ncalls = mark.ncalls;
+	gl->npaths = mark.npaths;
+	gl->nverts = mark.nverts;
+	gl->nuniforms = mark.nuniforms;
+	return 0;
+}
+
+int nvglRecordingSize(const NVGLrecording* rec)
+{
+	return rec != NULL ? rec->size : 0;
+}
+
+void nvglDeleteRecording(NVGLrecording* rec)
+{
+	free(rec);
+}
+
+void nvglBounds(NVGcontext* ctx, const NVGLmark* from, float* bounds)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	int i;
+	for (i = from->nverts; i < gl->nverts; i++) {
+		const NVGvertex* v = &gl->verts[i];
+		if (v->x < bounds[0]) bounds[0] = v->x;
+		if (v->y < bounds[1]) bounds[1] = v->y;
+		if (v->x > bounds[2]) bounds[2] = v->x;
+		if (v->y > bounds[3]) bounds[3] = v->y;
+	}
+}
+
+void nvglTint(NVGcontext* ctx, const NVGLmark* from, NVGcolor tint)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	float r = tint.r * tint.a, g = tint.g * tint.a, b = tint.b * tint.a, a = tint.a;
+	int i;
+	// the colors are premultiplied
+	for (i = from->nuniforms; i < gl->nuniforms; i++) {
+		GLNVGfragUniforms* frag = nvg__fragUniformPtr(gl, i * gl->fragSize);
+		frag->innerCol.r *= r;
+		frag->innerCol.g *= g;
+		frag->innerCol.b *= b;
+		frag->innerCol.a *= a;
+		frag->outerCol.r *= r;
+		frag->outerCol.g *= g;
+		frag->outerCol.b *= b;
+		frag->outerCol.a *= a;
+	}
+}
+
+void nvglClip(NVGcontext* ctx, int x, int y, int w, int h)
+{
+	GLNVGcontext* gl = (GLNVGcontext*)nvgInternalParams(ctx)->userPtr;
+	gl->clip[0] = x;
+	gl->clip[1] = y;
+	gl->clip[2] = w;
+	gl->clip[3] = h;
+	gl->clipped = w >= 0;
+}
+
 #endif /* NANOVG_GL_IMPLEMENTATION */
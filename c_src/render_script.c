@@ -5,16 +5,24 @@
 
 functions to play a compiled render script
 */
+#include <float.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "comms.h"
 
 #include <GLFW/glfw3.h>
 #include <stdlib.h>
 
+#include "damage.h"
 #include "nanovg/nanovg.h"
 #include "render_script.h"
+#include "retained.h"
+#include "script_cache.h"
+#include "script_table.h"
+#include "text_cache.h"
 #include "tx.h"
 #include "types.h"
 
@@ -24,6 +32,7 @@ functions to play a compiled render script
 #define OP_RESET_STATE 0X03
 
 #define OP_RUN_SCRIPT 0X04
+#define OP_DRAW_INSTANCES 0X05
 
 // RENDER STYLES
 #define OP_PAINT_LINEAR 0X06
@@ -61,6 +70,8 @@ functions to play a compiled render script
 #define OP_PATH_ARC_TO 0X25
 #define OP_PATH_CLOSE 0X26
 #define OP_PATH_WINDING 0X27
+#define OP_PATH_POLYLINE 0X28
+#define OP_PATH_POLYGON 0X2B
 
 #define OP_FILL 0X29
 #define OP_STROKE 0X2A
@@ -94,43 +105,18 @@ functions to play a compiled render script
 
 #define OP_TERMINATE 0XFF
 
+// how deep scripts can run other scripts. Stops a script that runs itself
+#define MAX_SCRIPT_DEPTH 64
+
 static const float TAU = NVG_PI * 2;
 
 NVGpaint current_paint;
 
-//=============================================================================
-// access functions for scripts
-
-void delete_script(window_data_t* p_data, GLuint id)
-{
-  if (p_data->p_scripts[id])
-  {
-    free(p_data->p_scripts[id]);
-    p_data->p_scripts[id] = NULL;
-  }
-}
-
-void delete_all(window_data_t* p_data)
-{
-  for (GLuint i = 0; i < p_data->num_scripts; i++)
-  {
-    delete_script(p_data, i);
-  }
-}
-
-void put_script(window_data_t* p_data, GLuint id, void* p_script)
-{
-  delete_script(p_data, id);
-  p_data->p_scripts[id] = p_script;
-}
-
-void* get_script(window_data_t* p_data, GLuint id)
-{
-  return p_data->p_scripts[id];
-}
+// textures and fonts that weren't loaded when they were drawn
+static uint32_t draw_misses = 0;
 
 //=============================================================================
-// types
+// wire types. Used to read the scripts as they arrive
 
 PACK(typedef struct color_t
 {
@@ -140,34 +126,92 @@ PACK(typedef struct color_t
   GLuint a;
 }) color_t;
 
-PACK(typedef struct xy_t
+PACK(typedef struct linear_gradient_t
 {
-  GLfloat x;
-  GLfloat y;
-}) xy_t;
+  GLfloat sx;
+  GLfloat sy;
+  GLfloat ex;
+  GLfloat ey;
+  GLuint  sr;
+  GLuint  sg;
+  GLuint  sb;
+  GLuint  sa;
+  GLuint  er;
+  GLuint  eg;
+  GLuint  eb;
+  GLuint  ea;
+}) linear_gradient_t;
 
-PACK(typedef struct xywh_t
+PACK(typedef struct box_gradient_t
 {
   GLfloat x;
   GLfloat y;
   GLfloat w;
   GLfloat h;
-}) xywh_t;
+  GLfloat radius;
+  GLfloat feather;
+  GLuint  sr;
+  GLuint  sg;
+  GLuint  sb;
+  GLuint  sa;
+  GLuint  er;
+  GLuint  eg;
+  GLuint  eb;
+  GLuint  ea;
+}) box_gradient_t;
+
+PACK(typedef struct radial_gradient_t
+{
+  GLfloat cx;
+  GLfloat cy;
+  GLfloat r_in;
+  GLfloat r_out;
+  GLuint  sr;
+  GLuint  sg;
+  GLuint  sb;
+  GLuint  sa;
+  GLuint  er;
+  GLuint  eg;
+  GLuint  eb;
+  GLuint  ea;
+}) radial_gradient_t;
+
+PACK(typedef struct image_pattern_t
+{
+  GLfloat ox;
+  GLfloat oy;
+  GLfloat ex;
+  GLfloat ey;
+  GLfloat angle;
+  GLuint  alpha;
+  GLuint  key_size;
+}) image_pattern_t;
+
+//=============================================================================
+// decoded types. Each op in a decoded script is a uint32_t followed by one of
+// these. They are all made of 4 byte fields, so everything stays aligned.
+// Geometry is the same as on the wire and is copied straight across.
+
+typedef struct
+{
+  GLfloat x;
+  GLfloat y;
+} xy_t;
 
-PACK(typedef struct wh_t
+typedef struct
 {
   GLfloat w;
   GLfloat h;
-}) wh_t;
+} wh_t;
 
-PACK(typedef struct whr_t
+typedef struct
 {
   GLfloat w;
   GLfloat h;
   GLfloat r;
-}) whr_t;
+} whr_t;
 
-PACK(typedef struct bezier_to_t
+typedef struct
 {
   GLfloat c1x;
   GLfloat c1y;
@@ -175,44 +219,39 @@ PACK(typedef struct bezier_to_t
   GLfloat c2y;
   GLfloat x;
   GLfloat y;
-}) bezier_to_t;
+} bezier_to_t;
 
-PACK(typedef struct quadratic_to_t
+typedef struct
 {
   GLfloat cx;
   GLfloat cy;
   GLfloat x;
   GLfloat y;
-}) quadratic_to_t;
+} quadratic_to_t;
 
-PACK(typedef struct arc_to_t
+typedef struct
 {
   GLfloat x1;
   GLfloat y1;
   GLfloat x2;
   GLfloat y2;
   GLfloat radius;
-}) arc_to_t;
+} arc_to_t;
 
-PACK(typedef struct ellipse_t
+typedef struct
 {
   GLfloat rx;
   GLfloat ry;
-}) ellipse_t;
-
-PACK(typedef struct circle_t
-{
-  GLfloat r;
-}) circle_t;
+} ellipse_t;
 
-PACK(typedef struct arc_sector_t
+typedef struct
 {
   GLfloat radius;
   GLfloat start;
   GLfloat finish;
-}) arc_sector_t;
+} arc_sector_t;
 
-PACK(typedef struct matrix_t
+typedef struct
 {
   GLfloat a;
   GLfloat b;
@@ -220,9 +259,9 @@ PACK(typedef struct matrix_t
   GLfloat d;
   GLfloat e;
   GLfloat f;
-}) matrix_t;
+} matrix_t;
 
-PACK(typedef struct triangle_t
+typedef struct
 {
   GLfloat x0;
   GLfloat y0;
@@ -230,131 +269,1480 @@ PACK(typedef struct triangle_t
   GLfloat y1;
   GLfloat x2;
   GLfloat y2;
-}) triangle_t;
+} triangle_t;
+
+typedef struct
+{
+  GLfloat  sx;
+  GLfloat  sy;
+  GLfloat  ex;
+  GLfloat  ey;
+  NVGcolor inner;
+  NVGcolor outer;
+} linear_paint_t;
+
+typedef struct
+{
+  GLfloat  x;
+  GLfloat  y;
+  GLfloat  w;
+  GLfloat  h;
+  GLfloat  radius;
+  GLfloat  feather;
+  NVGcolor inner;
+  NVGcolor outer;
+} box_paint_t;
+
+typedef struct
+{
+  GLfloat  cx;
+  GLfloat  cy;
+  GLfloat  r_in;
+  GLfloat  r_out;
+  NVGcolor inner;
+  NVGcolor outer;
+} radial_paint_t;
+
+// followed by the null terminated key, padded to key_size
+typedef struct
+{
+  GLfloat ox;
+  GLfloat oy;
+  GLfloat ex;
+  GLfloat ey;
+  GLfloat angle;
+  GLfloat alpha;
+  GLuint  key_size;
+} image_paint_t;
+
+// followed by size bytes of text, padded to 4 bytes
+typedef struct
+{
+  GLuint size;
+} text_t;
+
+// followed by count xy_ts
+typedef struct
+{
+  GLuint count;
+} points_t;
+
+// followed by count matrix_ts, then count NVGcolors if INSTANCES_TINTED
+#define INSTANCES_TINTED 0x01
+
+typedef struct
+{
+  GLuint id;
+  GLuint count;
+  GLuint flags;
+} instances_t;
+
+//=============================================================================
+// decoding
+//
+// Scripts are checked and decoded once when they arrive. Colors become
+// NVGcolors, enums become their nanovg values, strings are checked for their
+// terminators and sub-script ids are checked against the table. A script that
+// is cut short or has an unknown op is kept up to that point. The decoded
+// script always ends with OP_TERMINATE, and is never bigger than the original
+// plus that.
+
+//---------------------------------------------------------
+static void put_op(byte** pp_out, uint32_t op)
+{
+  memcpy(*pp_out, &op, sizeof(uint32_t));
+  *pp_out += sizeof(uint32_t);
+}
+
+//---------------------------------------------------------
+static void put_bytes(byte** pp_out, const void* p_data, uint32_t size)
+{
+  memcpy(*pp_out, p_data, size);
+  *pp_out += size;
+}
+
+//---------------------------------------------------------
+// ops that are the same once decoded
+static bool copy_op(msg_cursor_t* p_in, byte** pp_out, uint32_t size)
+{
+  void* p_data = read_ptr_down(p_in, size);
+  if (p_data == NULL)
+    return false;
+  put_bytes(pp_out, p_data, size);
+  return true;
+}
+
+//---------------------------------------------------------
+static NVGcolor to_color(GLuint r, GLuint g, GLuint b, GLuint a)
+{
+  return nvgRGBA(r, g, b, a);
+}
+
+//---------------------------------------------------------
+static bool decode_color(msg_cursor_t* p_in, byte** pp_out)
+{
+  color_t color;
+  if (!read_bytes_down(p_in, &color, sizeof(color_t)))
+    return false;
+  NVGcolor nvg_color = to_color(color.r, color.g, color.b, color.a);
+  put_bytes(pp_out, &nvg_color, sizeof(NVGcolor));
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_linear(msg_cursor_t* p_in, byte** pp_out)
+{
+  linear_gradient_t grad;
+  if (!read_bytes_down(p_in, &grad, sizeof(linear_gradient_t)))
+    return false;
+  linear_paint_t paint = {grad.sx,
+                          grad.sy,
+                          grad.ex,
+                          grad.ey,
+                          to_color(grad.sr, grad.sg, grad.sb, grad.sa),
+                          to_color(grad.er, grad.eg, grad.eb, grad.ea)};
+  put_bytes(pp_out, &paint, sizeof(linear_paint_t));
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_box(msg_cursor_t* p_in, byte** pp_out)
+{
+  box_gradient_t grad;
+  if (!read_bytes_down(p_in, &grad, sizeof(box_gradient_t)))
+    return false;
+  box_paint_t paint = {grad.x,
+                       grad.y,
+                       grad.w,
+                       grad.h,
+                       grad.radius,
+                       grad.feather,
+                       to_color(grad.sr, grad.sg, grad.sb, grad.sa),
+                       to_color(grad.er, grad.eg, grad.eb, grad.ea)};
+  put_bytes(pp_out, &paint, sizeof(box_paint_t));
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_radial(msg_cursor_t* p_in, byte** pp_out)
+{
+  radial_gradient_t grad;
+  if (!read_bytes_down(p_in, &grad, sizeof(radial_gradient_t)))
+    return false;
+  radial_paint_t paint = {grad.cx,
+                          grad.cy,
+                          grad.r_in,
+                          grad.r_out,
+                          to_color(grad.sr, grad.sg, grad.sb, grad.sa),
+                          to_color(grad.er, grad.eg, grad.eb, grad.ea)};
+  put_bytes(pp_out, &paint, sizeof(radial_paint_t));
+  return true;
+}
+
+//---------------------------------------------------------
+// a string the size of the padded space it sits in, with a null somewhere
+static bool copy_str(msg_cursor_t* p_in, byte** pp_out, uint32_t size)
+{
+  char* p_str = read_ptr_down(p_in, size);
+  if (p_str == NULL || (size & 3) != 0 || memchr(p_str, 0, size) == NULL)
+    return false;
+  put_bytes(pp_out, p_str, size);
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_image(msg_cursor_t* p_in, byte** pp_out)
+{
+  image_pattern_t img;
+  if (!read_bytes_down(p_in, &img, sizeof(image_pattern_t)))
+    return false;
+  image_paint_t paint = {img.ox,    img.oy,
+                         img.ex,    img.ey,
+                         img.angle, (float) img.alpha / 255.0,
+                         img.key_size};
+  put_bytes(pp_out, &paint, sizeof(image_paint_t));
+  return copy_str(p_in, pp_out, img.key_size);
+}
+
+//---------------------------------------------------------
+static bool decode_text(msg_cursor_t* p_in, byte** pp_out)
+{
+  text_t text_info;
+  if (!read_bytes_down(p_in, &text_info, sizeof(text_t)) ||
+      text_info.size > bytes_remaining(p_in))
+    return false;
+  put_bytes(pp_out, &text_info, sizeof(text_t));
+  // Text is padded to 32-bits
+  return copy_op(p_in, pp_out, (text_info.size + 3) & ~3);
+}
+
+//---------------------------------------------------------
+static bool decode_font(msg_cursor_t* p_in, byte** pp_out)
+{
+  GLuint name_length;
+  if (!read_bytes_down(p_in, &name_length, sizeof(GLuint)))
+    return false;
+  put_bytes(pp_out, &name_length, sizeof(GLuint));
+  return copy_str(p_in, pp_out, name_length);
+}
+
+//---------------------------------------------------------
+static bool decode_run_script(msg_cursor_t* p_in, byte** pp_out)
+{
+  // any id is fine. one with no script is skipped when it runs
+  GLuint id;
+  if (!read_bytes_down(p_in, &id, sizeof(GLuint)))
+    return false;
+  put_bytes(pp_out, &id, sizeof(GLuint));
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_points(msg_cursor_t* p_in, byte** pp_out)
+{
+  points_t points;
+  if (!read_bytes_down(p_in, &points, sizeof(points_t)))
+    return false;
+  if (points.count > bytes_remaining(p_in) / sizeof(xy_t))
+    return false;
+  put_bytes(pp_out, &points, sizeof(points_t));
+  return copy_op(p_in, pp_out, points.count * sizeof(xy_t));
+}
+
+//---------------------------------------------------------
+// the tints are colors like any other, so take the same room decoded as on the
+// wire
+static bool decode_instances(msg_cursor_t* p_in, byte** pp_out)
+{
+  instances_t instances;
+  if (!read_bytes_down(p_in, &instances, sizeof(instances_t)))
+    return false;
+  instances.flags &= INSTANCES_TINTED;
+  if (instances.count > bytes_remaining(p_in) / sizeof(matrix_t))
+    return false;
+  put_bytes(pp_out, &instances, sizeof(instances_t));
+  if (!copy_op(p_in, pp_out, instances.count * sizeof(matrix_t)))
+    return false;
+  if (!(instances.flags & INSTANCES_TINTED))
+    return true;
+  for (GLuint i = 0; i < instances.count; i++)
+  {
+    if (!decode_color(p_in, pp_out))
+      return false;
+  }
+  return true;
+}
+
+//---------------------------------------------------------
+// wire values that pick a nanovg enum. -1 for ones nanovg doesn't have, which
+// are dropped like they always were
+static int to_line_cap(uint32_t cap)
+{
+  switch (cap)
+  {
+    case 0:
+      return NVG_BUTT;
+    case 1:
+      return NVG_ROUND;
+    case 2:
+      return NVG_SQUARE;
+    default:
+      return -1;
+  }
+}
+
+static int to_line_join(uint32_t join)
+{
+  switch (join)
+  {
+    case 0:
+      return NVG_MITER;
+    case 1:
+      return NVG_ROUND;
+    case 2:
+      return NVG_BEVEL;
+    default:
+      return -1;
+  }
+}
+
+//---------------------------------------------------------
+static bool decode_enum(msg_cursor_t* p_in, byte** pp_out, uint32_t op,
+                        int (*convert)(uint32_t))
+{
+  uint32_t value;
+  if (!read_bytes_down(p_in, &value, sizeof(uint32_t)))
+    return false;
+  int nvg_value = convert(value);
+  if (nvg_value >= 0)
+  {
+    put_op(pp_out, op);
+    put_bytes(pp_out, &nvg_value, sizeof(int));
+  }
+  return true;
+}
+
+//---------------------------------------------------------
+static bool decode_winding(msg_cursor_t* p_in, byte** pp_out)
+{
+  int solid;
+  if (!read_bytes_down(p_in, &solid, sizeof(int)))
+    return false;
+  int winding = solid ? NVG_SOLID : NVG_HOLE;
+  put_bytes(pp_out, &winding, sizeof(int));
+  return true;
+}
+
+//---------------------------------------------------------
+// decode one op and its data. Returns false if the data is bad
+static bool decode_op(window_data_t* p_data, GLuint op, msg_cursor_t* p_in,
+                      byte** pp_out)
+{
+  char buff[200];
+
+  switch (op)
+  {
+    // no data
+    case OP_PUSH_STATE:
+    case OP_POP_STATE:
+    case OP_RESET_STATE:
+    case OP_STROKE_PAINT:
+    case OP_FILL_PAINT:
+    case OP_RESET_SCISSOR:
+    case OP_PATH_BEGIN:
+    case OP_PATH_CLOSE:
+    case OP_FILL:
+    case OP_STROKE:
+    case OP_TX_RESET:
+      put_op(pp_out, op);
+      return true;
+
+    // these do nothing, so aren't kept
+    case OP_ROUND_RECT_VAR:
+    case OP_TX_IDENTITY:
+      return true;
+
+    // enums are converted, and dropped if unknown
+    case OP_LINE_CAP:
+      return decode_enum(p_in, pp_out, op, to_line_cap);
+    case OP_LINE_JOIN:
+      return decode_enum(p_in, pp_out, op, to_line_join);
+
+    default:
+      break;
+  }
+
+  put_op(pp_out, op);
+  switch (op)
+  {
+    case OP_RUN_SCRIPT:
+      return decode_run_script(p_in, pp_out);
+    case OP_DRAW_INSTANCES:
+      return decode_instances(p_in, pp_out);
+
+    case OP_PAINT_LINEAR:
+      return decode_linear(p_in, pp_out);
+    case OP_PAINT_BOX:
+      return decode_box(p_in, pp_out);
+    case OP_PAINT_RADIAL:
+      return decode_radial(p_in, pp_out);
+    case OP_PAINT_IMAGE:
+    case OP_PAINT_DYNAMIC:
+      return decode_image(p_in, pp_out);
+
+    case OP_STROKE_COLOR:
+    case OP_FILL_COLOR:
+      return decode_color(p_in, pp_out);
+
+    case OP_PATH_WINDING:
+      return decode_winding(p_in, pp_out);
+    case OP_PATH_POLYLINE:
+    case OP_PATH_POLYGON:
+      return decode_points(p_in, pp_out);
+
+    case OP_STROKE_WIDTH:
+    case OP_MITER_LIMIT:
+    case OP_GLOBAL_ALPHA:
+    case OP_CIRCLE:
+    case OP_TX_ROTATE:
+    case OP_TX_SKEW_X:
+    case OP_TX_SKEW_Y:
+    case OP_FONT_BLUR:
+    case OP_FONT_SIZE:
+    case OP_TEXT_HEIGHT:
+      return copy_op(p_in, pp_out, sizeof(GLfloat));
+    case OP_TEXT_ALIGN:
+      return copy_op(p_in, pp_out, sizeof(uint32_t));
+
+    case OP_SCISSOR:
+    case OP_INTERSECT_SCISSOR:
+    case OP_RECT:
+      return copy_op(p_in, pp_out, sizeof(wh_t));
+    case OP_PATH_MOVE_TO:
+    case OP_PATH_LINE_TO:
+    case OP_TX_TRANSLATE:
+    case OP_TX_SCALE:
+      return copy_op(p_in, pp_out, sizeof(xy_t));
+    case OP_PATH_BEZIER_TO:
+      return copy_op(p_in, pp_out, sizeof(bezier_to_t));
+    case OP_PATH_QUADRATIC_TO:
+      return copy_op(p_in, pp_out, sizeof(quadratic_to_t));
+    case OP_PATH_ARC_TO:
+      return copy_op(p_in, pp_out, sizeof(arc_to_t));
+    case OP_TRIANGLE:
+      return copy_op(p_in, pp_out, sizeof(triangle_t));
+    case OP_ARC:
+    case OP_SECTOR:
+      return copy_op(p_in, pp_out, sizeof(arc_sector_t));
+    case OP_ROUND_RECT:
+      return copy_op(p_in, pp_out, sizeof(whr_t));
+    case OP_ELLIPSE:
+      return copy_op(p_in, pp_out, sizeof(ellipse_t));
+    case OP_TX_MATRIX:
+      return copy_op(p_in, pp_out, sizeof(matrix_t));
+
+    case OP_TEXT:
+      return decode_text(p_in, pp_out);
+    case OP_FONT:
+      return decode_font(p_in, pp_out);
+
+    // unknown. keep what came before it and stop
+    default:
+      sprintf(buff, "!!!Unknown script command: %d", op);
+      send_puts(buff);
+      *pp_out -= sizeof(uint32_t);
+      p_in->offset = p_in->length;
+      return true;
+  }
+}
+
+//=============================================================================
+// measuring
+//
+// Where a script draws is worked out from the decoded ops as they are made,
+// following its transforms and the styles it sets, the way nanovg would. The
+// sizes of text are guessed from the font size, at most one em across for
+// each byte and two ems high for each line. Anything that could be drawn
+// anywhere, like resetting the transform, marks the script unbounded.
+
+// nanovg's own limit
+#define MEASURE_STATES 32
+
+// styles the script has set itself
+#define KNOWN_WIDTH 0x01
+#define KNOWN_MITER 0x02
+#define KNOWN_SIZE 0x04
+#define KNOWN_BLUR 0x08
+#define KNOWN_HEIGHT 0x10
+
+typedef struct
+{
+  float xform[6];
+  float stroke_width;
+  float miter_limit;
+  float font_size;
+  float font_blur;
+  float line_height;
+  int   known;
+} measure_state_t;
+
+typedef struct
+{
+  measure_state_t  states[MEASURE_STATES];
+  int              depth;
+  float            path[4];
+  script_bounds_t* p_bounds;
+} measure_t;
+
+//---------------------------------------------------------
+static void empty_box(float* p_box)
+{
+  p_box[0] = FLT_MAX;
+  p_box[1] = FLT_MAX;
+  p_box[2] = -FLT_MAX;
+  p_box[3] = -FLT_MAX;
+}
+
+static bool box_is_empty(const float* p_box)
+{
+  return p_box[0] > p_box[2] || p_box[1] > p_box[3];
+}
+
+static void grow_box(float* p_box, const float* p_more)
+{
+  if (box_is_empty(p_more))
+    return;
+  p_box[0] = fminf(p_box[0], p_more[0]);
+  p_box[1] = fminf(p_box[1], p_more[1]);
+  p_box[2] = fmaxf(p_box[2], p_more[2]);
+  p_box[3] = fmaxf(p_box[3], p_more[3]);
+}
+
+static void pad_box(float* p_box, float by)
+{
+  if (box_is_empty(p_box))
+    return;
+  p_box[0] -= by;
+  p_box[1] -= by;
+  p_box[2] += by;
+  p_box[3] += by;
+}
+
+// the box around a box moved by a transform
+static void map_box(const float* xform, const float* p_box, float* p_out)
+{
+  empty_box(p_out);
+  if (box_is_empty(p_box))
+    return;
+  for (int i = 0; i < 4; i++)
+  {
+    float x, y;
+    nvgTransformPoint(&x, &y, xform, p_box[(i & 1) ? 2 : 0],
+                      p_box[(i & 2) ? 3 : 1]);
+    float point[4] = {x, y, x, y};
+    grow_box(p_out, point);
+  }
+}
+
+// no transform stretches anything further than this
+static float max_scale(const float* xform)
+{
+  return sqrtf(xform[0] * xform[0] + xform[1] * xform[1] +
+               xform[2] * xform[2] + xform[3] * xform[3]);
+}
+
+// how far a stroke reaches past its path. Miter joins reach the furthest,
+// and square caps reach further than half the width
+static float stroke_reach(float width, float miter_limit)
+{
+  return width * 0.5f * fmaxf(miter_limit, 2);
+}
+
+//---------------------------------------------------------
+static void start_measure(measure_t* p_measure, script_bounds_t* p_bounds)
+{
+  memset(p_bounds, 0, sizeof(script_bounds_t));
+  empty_box(p_bounds->fixed);
+  empty_box(p_bounds->stroke);
+  empty_box(p_bounds->text_at);
+  empty_box(p_bounds->text_em);
+
+  measure_state_t* p_state = &p_measure->states[0];
+  memset(p_state, 0, sizeof(measure_state_t));
+  nvgTransformIdentity(p_state->xform);
+  p_measure->depth    = 0;
+  p_measure->p_bounds = p_bounds;
+  empty_box(p_measure->path);
+}
+
+//---------------------------------------------------------
+static void measure_point(measure_t* p_measure, float x, float y)
+{
+  float* xform = p_measure->states[p_measure->depth].xform;
+  nvgTransformPoint(&x, &y, xform, x, y);
+  float point[4] = {x, y, x, y};
+  grow_box(p_measure->path, point);
+}
+
+static void measure_box(measure_t* p_measure, float x0, float y0, float x1,
+                        float y1)
+{
+  measure_point(p_measure, x0, y0);
+  measure_point(p_measure, x1, y0);
+  measure_point(p_measure, x0, y1);
+  measure_point(p_measure, x1, y1);
+}
+
+//---------------------------------------------------------
+static void measure_stroke(measure_t* p_measure)
+{
+  measure_state_t* p_state  = &p_measure->states[p_measure->depth];
+  script_bounds_t* p_bounds = p_measure->p_bounds;
+  float            scale    = max_scale(p_state->xform);
+
+  grow_box(p_bounds->stroke, p_measure->path);
+  if ((p_state->known & (KNOWN_WIDTH | KNOWN_MITER)) ==
+      (KNOWN_WIDTH | KNOWN_MITER))
+  {
+    float reach = stroke_reach(p_state->stroke_width, p_state->miter_limit);
+    p_bounds->stroke_reach = fmaxf(p_bounds->stroke_reach, reach * scale);
+    return;
+  }
+
+  p_bounds->stroke_scale = fmaxf(p_bounds->stroke_scale, scale);
+  if (p_state->known & KNOWN_WIDTH)
+    p_bounds->stroke_width =
+        fmaxf(p_bounds->stroke_width, p_state->stroke_width);
+  if (p_state->known & KNOWN_MITER)
+    p_bounds->stroke_miter =
+        fmaxf(p_bounds->stroke_miter, p_state->miter_limit);
+}
+
+//---------------------------------------------------------
+// text is broken into rows no wider than 1000 when it runs
+static void measure_text(measure_t* p_measure, const byte* p_data)
+{
+  measure_state_t* p_state  = &p_measure->states[p_measure->depth];
+  script_bounds_t* p_bounds = p_measure->p_bounds;
+  uint32_t         size     = ((text_t*) p_data)->size;
+  const byte*      p_text   = p_data + sizeof(text_t);
+
+  int rows = 1;
+  for (uint32_t i = 0; i < size; i++)
+    if (p_text[i] == '\n' || p_text[i] == '\r')
+      rows++;
+
+  // the text in ems, around where it starts. Without a size it isn't known
+  // if it wraps until it runs
+  float font_size = p_state->font_size;
+  bool  sized     = p_state->known & KNOWN_SIZE;
+  if (sized && size * font_size > 1000)
+    rows = size > 1 ? size : 1;
+  if (rows > 1 && !(p_state->known & KNOWN_HEIGHT))
+  {
+    p_bounds->unbounded = true;
+    return;
+  }
+  float line  = 2 * fabsf(p_state->line_height);
+  float em[4] = {-(float) size - 1, -2, (float) size + 1,
+                 (rows - 1) * line + 2};
+
+  float linear[6];
+  memcpy(linear, p_state->xform, sizeof(linear));
+  linear[4] = 0;
+  linear[5] = 0;
+  float scale = max_scale(p_state->xform);
+
+  float blur = 0;
+  if (p_state->known & KNOWN_BLUR)
+    blur = p_state->font_blur;
+  else
+    p_bounds->blur_scale = fmaxf(p_bounds->blur_scale, scale);
+
+  if (sized)
+  {
+    float local[4] = {em[0] * font_size - blur, em[1] * font_size - blur,
+                      em[2] * font_size + blur, em[3] * font_size + blur};
+    float box[4];
+    map_box(p_state->xform, local, box);
+    grow_box(p_bounds->fixed, box);
+    return;
+  }
+
+  float at[4] = {p_state->xform[4], p_state->xform[5], p_state->xform[4],
+                 p_state->xform[5]};
+  float box[4];
+  map_box(linear, em, box);
+  grow_box(p_bounds->text_at, at);
+  grow_box(p_bounds->text_em, box);
+  if (size > p_bounds->text_bytes)
+    p_bounds->text_bytes = size;
+  p_bounds->text_blur = fmaxf(p_bounds->text_blur, blur * scale);
+}
+
+//---------------------------------------------------------
+static void measure_transform(measure_t* p_measure, float* t)
+{
+  nvgTransformPremultiply(p_measure->states[p_measure->depth].xform, t);
+}
+
+//---------------------------------------------------------
+// p_op is a decoded op, followed by its data
+static void measure_op(measure_t* p_measure, const byte* p_op)
+{
+  script_bounds_t* p_bounds = p_measure->p_bounds;
+  measure_state_t* p_state  = &p_measure->states[p_measure->depth];
+  GLuint           op       = *(GLuint*) p_op;
+  const byte*      p_data   = p_op + sizeof(GLuint);
+  const GLfloat*   f        = (const GLfloat*) p_data;
+  float            t[6];
+
+  // state the script changes without saving it first is left for the script
+  // that ran it. So is the paint, which isn't part of the state
+  switch (op)
+  {
+    case OP_PUSH_STATE:
+    case OP_POP_STATE:
+    case OP_RUN_SCRIPT:
+    case OP_DRAW_INSTANCES:
+    case OP_PATH_BEGIN:
+    case OP_PATH_MOVE_TO:
+    case OP_PATH_LINE_TO:
+    case OP_PATH_BEZIER_TO:
+    case OP_PATH_QUADRATIC_TO:
+    case OP_PATH_ARC_TO:
+    case OP_PATH_CLOSE:
+    case OP_PATH_WINDING:
+    case OP_PATH_POLYLINE:
+    case OP_PATH_POLYGON:
+    case OP_FILL:
+    case OP_STROKE:
+    case OP_TRIANGLE:
+    case OP_ARC:
+    case OP_RECT:
+    case OP_ROUND_RECT:
+    case OP_ELLIPSE:
+    case OP_CIRCLE:
+    case OP_SECTOR:
+    case OP_TEXT:
+      break;
+    case OP_PAINT_LINEAR:
+    case OP_PAINT_BOX:
+    case OP_PAINT_RADIAL:
+    case OP_PAINT_IMAGE:
+    case OP_PAINT_DYNAMIC:
+      p_bounds->leaks = true;
+      break;
+    default:
+      if (p_measure->depth == 0)
+        p_bounds->leaks = true;
+      break;
+  }
+
+  switch (op)
+  {
+    case OP_PUSH_STATE:
+      if (p_measure->depth + 1 >= MEASURE_STATES)
+      {
+        p_bounds->unbounded = true;
+        return;
+      }
+      p_measure->states[p_measure->depth + 1] = *p_state;
+      p_measure->depth++;
+      return;
+    case OP_POP_STATE:
+      if (p_measure->depth == 0)
+      {
+        // back to a state from before the script ran
+        p_bounds->unbounded = true;
+        p_bounds->leaks     = true;
+        return;
+      }
+      p_measure->depth--;
+      return;
+    case OP_RESET_STATE:
+    case OP_TX_RESET:
+      p_bounds->unbounded = true;
+      return;
+
+    case OP_RUN_SCRIPT:
+    case OP_DRAW_INSTANCES:
+      p_bounds->runs_scripts = true;
+      return;
+
+    case OP_STROKE_WIDTH:
+      p_state->stroke_width = f[0];
+      p_state->known |= KNOWN_WIDTH;
+      return;
+    case OP_MITER_LIMIT:
+      p_state->miter_limit = f[0];
+      p_state->known |= KNOWN_MITER;
+      return;
+    case OP_FONT_SIZE:
+      p_state->font_size = f[0];
+      p_state->known |= KNOWN_SIZE;
+      return;
+    case OP_FONT_BLUR:
+      p_state->font_blur = f[0];
+      p_state->known |= KNOWN_BLUR;
+      return;
+    case OP_TEXT_HEIGHT:
+      p_state->line_height = f[0];
+      p_state->known |= KNOWN_HEIGHT;
+      return;
+
+    case OP_SCISSOR:
+    case OP_RESET_SCISSOR:
+      p_bounds->own_scissor = true;
+      return;
+
+    // paths. Points are transformed as they are added, like nanovg does
+    case OP_PATH_BEGIN:
+      empty_box(p_measure->path);
+      return;
+    case OP_PATH_MOVE_TO:
+    case OP_PATH_LINE_TO:
+      measure_point(p_measure, f[0], f[1]);
+      return;
+    case OP_PATH_POLYLINE:
+    case OP_PATH_POLYGON:
+      for (GLuint i = 0; i < ((const points_t*) p_data)->count; i++)
+        measure_point(p_measure, f[1 + i * 2], f[2 + i * 2]);
+      return;
+    case OP_PATH_BEZIER_TO:
+      measure_point(p_measure, f[0], f[1]);
+      measure_point(p_measure, f[2], f[3]);
+      measure_point(p_measure, f[4], f[5]);
+      return;
+    case OP_PATH_QUADRATIC_TO:
+      measure_point(p_measure, f[0], f[1]);
+      measure_point(p_measure, f[2], f[3]);
+      return;
+    case OP_PATH_ARC_TO:
+      // can reach a long way past its points
+      p_bounds->unbounded = true;
+      return;
+    case OP_TRIANGLE:
+      measure_point(p_measure, f[0], f[1]);
+      measure_point(p_measure, f[2], f[3]);
+      measure_point(p_measure, f[4], f[5]);
+      return;
+    case OP_RECT:
+    case OP_ROUND_RECT:
+      measure_box(p_measure, 0, 0, f[0], f[1]);
+      return;
+    case OP_ELLIPSE:
+      measure_box(p_measure, -f[0], -f[1], f[0], f[1]);
+      return;
+    case OP_CIRCLE:
+    case OP_ARC:
+      measure_box(p_measure, -f[0], -f[0], f[0], f[0]);
+      return;
+    case OP_SECTOR:
+      measure_box(p_measure, -f[0], -f[0], f[0], f[0]);
+      measure_point(p_measure, 0, 0);
+      return;
+
+    case OP_FILL:
+      grow_box(p_bounds->fixed, p_measure->path);
+      return;
+    case OP_STROKE:
+      measure_stroke(p_measure);
+      return;
+    case OP_TEXT:
+      measure_text(p_measure, p_data);
+      return;
+
+    case OP_TX_MATRIX:
+      memcpy(t, f, sizeof(t));
+      measure_transform(p_measure, t);
+      return;
+    case OP_TX_TRANSLATE:
+      nvgTransformTranslate(t, f[0], f[1]);
+      measure_transform(p_measure, t);
+      return;
+    case OP_TX_SCALE:
+      nvgTransformScale(t, f[0], f[1]);
+      measure_transform(p_measure, t);
+      return;
+    case OP_TX_ROTATE:
+      nvgTransformRotate(t, f[0]);
+      measure_transform(p_measure, t);
+      return;
+    case OP_TX_SKEW_X:
+      nvgTransformSkewX(t, f[0]);
+      measure_transform(p_measure, t);
+      return;
+    case OP_TX_SKEW_Y:
+      nvgTransformSkewY(t, f[0]);
+      measure_transform(p_measure, t);
+      return;
+
+    default:
+      return;
+  }
+}
+
+//---------------------------------------------------------
+static void finish_measure(measure_t* p_measure)
+{
+  // a script that doesn't pop everything it pushed leaves the state deeper
+  if (p_measure->depth != 0)
+    p_measure->p_bounds->leaks = true;
+}
+
+//=============================================================================
+// optimizing
+//
+// Scripts are compiled a primitive at a time, so they save and restore the
+// state around everything and set the same styles over and over. As each op
+// is decoded it is dropped if it can't change what is drawn: a style set to
+// the value it already has, a transform that does nothing, a path begun twice
+// or a gradient made again the same. A push and pop with nothing between them
+// that changes the state are dropped, and so is everything between them when
+// none of it outlasts the pop.
+//
+// Translates one after another are left alone. Added together they round
+// differently from the two steps, and that shows at the edges of shapes.
+//
+// The script is measured before this, and draws the same after it. The one
+// difference is when nanovg's state stack is already full, where it ignores a
+// save but not the restore.
+
+// how deep the pushes are followed
+#define OPTIMIZE_STATES 32
+
+// styles whose values are followed
+enum
+{
+  STYLE_FILL,
+  STYLE_STROKE,
+  STYLE_WIDTH,
+  STYLE_MITER,
+  STYLE_CAP,
+  STYLE_JOIN,
+  STYLE_ALPHA,
+  STYLE_BLUR,
+  STYLE_SIZE,
+  STYLE_ALIGN,
+  STYLE_HEIGHT,
+  STYLE_COUNT
+};
+
+typedef struct
+{
+  bool set;
+  byte value[sizeof(NVGcolor)];
+} style_t;
+
+typedef struct
+{
+  uint32_t at;       // where the push is in the decoded script
+  uint32_t count;    // ops before it
+  bool     changed;  // something since changed the state
+  bool     drew;     // something since does more than change the state
+  style_t  styles[STYLE_COUNT];
+} optimize_frame_t;
+
+typedef struct
+{
+  byte*            p_ops;
+  byte*            p_last;   // the op before this one. NULL if it can't be used
+  uint32_t         count;
+  int              depth;
+  int              deeper;   // pushes past OPTIMIZE_STATES
+  style_t          styles[STYLE_COUNT];
+  uint32_t         paint_op; // the gradient made last. 0 if not known
+  byte             paint[sizeof(box_paint_t)];
+  optimize_frame_t frames[OPTIMIZE_STATES];
+} optimize_t;
+
+static bool     optimizing   = true;
+static uint32_t ops_received = 0;
+static uint32_t ops_kept     = 0;
+
+//---------------------------------------------------------
+void set_optimizing(bool on)
+{
+  optimizing = on;
+}
+
+// ops in the scripts as they arrived, and left once decoded and optimized
+uint32_t get_ops_received()
+{
+  return ops_received;
+}
+
+uint32_t get_ops_kept()
+{
+  return ops_kept;
+}
+
+//---------------------------------------------------------
+static void start_optimize(optimize_t* p_opt, byte* p_ops)
+{
+  memset(p_opt, 0, offsetof(optimize_t, frames));
+  p_opt->p_ops = p_ops;
+}
+
+static int style_slot(uint32_t op)
+{
+  switch (op)
+  {
+    case OP_FILL_COLOR:
+      return STYLE_FILL;
+    case OP_STROKE_COLOR:
+      return STYLE_STROKE;
+    case OP_STROKE_WIDTH:
+      return STYLE_WIDTH;
+    case OP_MITER_LIMIT:
+      return STYLE_MITER;
+    case OP_LINE_CAP:
+      return STYLE_CAP;
+    case OP_LINE_JOIN:
+      return STYLE_JOIN;
+    case OP_GLOBAL_ALPHA:
+      return STYLE_ALPHA;
+    case OP_FONT_BLUR:
+      return STYLE_BLUR;
+    case OP_FONT_SIZE:
+      return STYLE_SIZE;
+    case OP_TEXT_ALIGN:
+      return STYLE_ALIGN;
+    case OP_TEXT_HEIGHT:
+      return STYLE_HEIGHT;
+    default:
+      return -1;
+  }
+}
+
+//---------------------------------------------------------
+// transforms that leave the transform exactly as it was
+static bool does_nothing(uint32_t op, const float* f)
+{
+  switch (op)
+  {
+    case OP_TX_TRANSLATE:
+      return f[0] == 0 && f[1] == 0;
+    case OP_TX_SCALE:
+      return f[0] == 1 && f[1] == 1;
+    case OP_TX_ROTATE:
+    case OP_TX_SKEW_X:
+    case OP_TX_SKEW_Y:
+      return f[0] == 0;
+    case OP_TX_MATRIX:
+      return f[0] == 1 && f[1] == 0 && f[2] == 0 && f[3] == 1 && f[4] == 0 &&
+             f[5] == 0;
+    default:
+      return false;
+  }
+}
+
+//---------------------------------------------------------
+// what the op does, for the push it is under
+static void note_effect(optimize_t* p_opt, bool changed, bool drew)
+{
+  if (p_opt->depth == 0)
+    return;
+  optimize_frame_t* p_frame = &p_opt->frames[p_opt->depth - 1];
+  p_frame->changed |= changed;
+  p_frame->drew |= drew;
+}
+
+static void forget_styles(optimize_t* p_opt)
+{
+  memset(p_opt->styles, 0, sizeof(p_opt->styles));
+}
+
+//---------------------------------------------------------
+static void optimize_push(optimize_t* p_opt, byte* p_op)
+{
+  if (p_opt->deeper > 0 || p_opt->depth == OPTIMIZE_STATES)
+  {
+    p_opt->deeper++;
+    return;
+  }
+
+  optimize_frame_t* p_frame = &p_opt->frames[p_opt->depth++];
+  p_frame->at      = p_op - p_opt->p_ops;
+  p_frame->count   = p_opt->count - 1;
+  p_frame->changed = false;
+  p_frame->drew    = false;
+  memcpy(p_frame->styles, p_opt->styles, sizeof(p_opt->styles));
+}
+
+//---------------------------------------------------------
+static void optimize_pop(optimize_t* p_opt, byte* p_op, byte** pp_out)
+{
+  p_opt->p_last = NULL;
+
+  // a push that isn't followed, or the state the script was run in. what
+  // comes back isn't known
+  if (p_opt->deeper > 0 || p_opt->depth == 0)
+  {
+    if (p_opt->deeper > 0)
+      p_opt->deeper--;
+    forget_styles(p_opt);
+    return;
+  }
+
+  // the styles come back. the paint doesn't, it isn't part of the state
+  optimize_frame_t* p_frame = &p_opt->frames[--p_opt->depth];
+  memcpy(p_opt->styles, p_frame->styles, sizeof(p_opt->styles));
+
+  byte* p_push = p_opt->p_ops + p_frame->at;
+  if (!p_frame->drew)
+  {
+    // nothing since the push lasts past the pop
+    *pp_out      = p_push;
+    p_opt->count = p_frame->count;
+  }
+  else if (!p_frame->changed)
+  {
+    // the pop would put back what is already there
+    memmove(p_push, p_push + sizeof(uint32_t),
+            p_op - p_push - sizeof(uint32_t));
+    *pp_out = p_op - sizeof(uint32_t);
+    p_opt->count -= 2;
+  }
+  note_effect(p_opt, false, p_frame->drew);
+}
+
+//---------------------------------------------------------
+// the op just decoded, from p_op up to *pp_out. It can be dropped, or folded
+// into the one before it
+static void optimize_op(optimize_t* p_opt, byte* p_op, byte** pp_out)
+{
+  byte* p_last = p_opt->p_last;
+  p_opt->p_last = p_op;
+  p_opt->count++;
+  if (!optimizing)
+    return;
+
+  uint32_t op;
+  memcpy(&op, p_op, sizeof(uint32_t));
+  byte*    p_value = p_op + sizeof(uint32_t);
+  uint32_t size    = *pp_out - p_value;
+
+  int slot = style_slot(op);
+  if (slot >= 0)
+  {
+    style_t* p_style = &p_opt->styles[slot];
+    if (p_style->set && memcmp(p_style->value, p_value, size) == 0)
+      goto drop;
+    p_style->set = true;
+    memcpy(p_style->value, p_value, size);
+    note_effect(p_opt, true, false);
+    return;
+  }
+
+  switch (op)
+  {
+    case OP_PUSH_STATE:
+      optimize_push(p_opt, p_op);
+      return;
+    case OP_POP_STATE:
+      optimize_pop(p_opt, p_op, pp_out);
+      return;
+
+    case OP_RESET_STATE:
+      forget_styles(p_opt);
+      note_effect(p_opt, true, false);
+      return;
+    case OP_FILL_PAINT:
+      p_opt->styles[STYLE_FILL].set = false;
+      note_effect(p_opt, true, false);
+      return;
+    case OP_STROKE_PAINT:
+      p_opt->styles[STYLE_STROKE].set = false;
+      note_effect(p_opt, true, false);
+      return;
+
+    // the paint is kept outside the state, so outlasts a pop
+    case OP_PAINT_LINEAR:
+    case OP_PAINT_BOX:
+    case OP_PAINT_RADIAL:
+      if (p_opt->paint_op == op && memcmp(p_opt->paint, p_value, size) == 0)
+        goto drop;
+      p_opt->paint_op = op;
+      memcpy(p_opt->paint, p_value, size);
+      note_effect(p_opt, false, true);
+      return;
+    case OP_PAINT_IMAGE:
+    case OP_PAINT_DYNAMIC:
+      p_opt->paint_op = 0;
+      note_effect(p_opt, false, true);
+      return;
+
+    case OP_TX_TRANSLATE:
+    case OP_TX_SCALE:
+    case OP_TX_ROTATE:
+    case OP_TX_SKEW_X:
+    case OP_TX_SKEW_Y:
+    case OP_TX_MATRIX:
+      if (does_nothing(op, (float*) p_value))
+        goto drop;
+      note_effect(p_opt, true, false);
+      return;
+    case OP_TX_RESET:
+    case OP_SCISSOR:
+    case OP_INTERSECT_SCISSOR:
+    case OP_RESET_SCISSOR:
+      note_effect(p_opt, true, false);
+      return;
+
+    // the path isn't part of the state either
+    case OP_PATH_BEGIN:
+      if (p_last != NULL && *(uint32_t*) p_last == OP_PATH_BEGIN)
+        goto drop;
+      note_effect(p_opt, false, true);
+      return;
+    case OP_PATH_MOVE_TO:
+    case OP_PATH_LINE_TO:
+    case OP_PATH_BEZIER_TO:
+    case OP_PATH_QUADRATIC_TO:
+    case OP_PATH_ARC_TO:
+    case OP_PATH_CLOSE:
+    case OP_PATH_WINDING:
+    case OP_PATH_POLYLINE:
+    case OP_PATH_POLYGON:
+    case OP_TRIANGLE:
+    case OP_ARC:
+    case OP_RECT:
+    case OP_ROUND_RECT:
+    case OP_ELLIPSE:
+    case OP_CIRCLE:
+    case OP_SECTOR:
+    case OP_FILL:
+    case OP_STROKE:
+    case OP_TEXT:
+      note_effect(p_opt, false, true);
+      return;
+
+    // a font that isn't loaded is a miss, which matters to retained drawing
+    case OP_FONT:
+      note_effect(p_opt, true, true);
+      return;
+
+    // anything else, like running a script, could do anything
+    default:
+      forget_styles(p_opt);
+      p_opt->paint_op = 0;
+      note_effect(p_opt, true, true);
+      return;
+  }
+
+drop:
+  *pp_out       = p_op;
+  p_opt->p_last = p_last;
+  p_opt->count--;
+}
+
+//---------------------------------------------------------
+// decode a script as it arrived into a new buffer, measure it and
+// optimize it
+static void* decode_script(window_data_t* p_data, void* p_script,
+                           uint32_t size, script_bounds_t* p_bounds)
+{
+  byte* p_ops = malloc(size + sizeof(uint32_t));
+  if (p_ops == NULL)
+    return NULL;
+
+  measure_t measure;
+  start_measure(&measure, p_bounds);
+  optimize_t optimize;
+  start_optimize(&optimize, p_ops);
+
+  msg_cursor_t in    = {p_script, size, 0};
+  byte*        p_out = p_ops;
+  GLuint       op;
+  while (read_bytes_down(&in, &op, sizeof(GLuint)) && op != OP_TERMINATE)
+  {
+    // cut short. drop whatever part of the op was written and stop there
+    byte* p_op = p_out;
+    ops_received++;
+    if (!decode_op(p_data, op, &in, &p_out))
+    {
+      p_out = p_op;
+      send_puts("decode_script BAD SCRIPT");
+      break;
+    }
+    if (p_out != p_op)
+    {
+      measure_op(&measure, p_op);
+      optimize_op(&optimize, p_op, &p_out);
+    }
+  }
+  put_op(&p_out, OP_TERMINATE);
+  finish_measure(&measure);
+  ops_kept += optimize.count;
+
+  return p_ops;
+}
+
+//=============================================================================
+// access functions for scripts
+
+static void free_script(script_t* p_entry)
+{
+  if (p_entry->p_script == NULL)
+    return;
+  free(p_entry->p_script);
+  free(p_entry->p_ops);
+  free_retained(p_entry->p_retained);
+  free_cached(p_entry);
+  p_entry->p_script   = NULL;
+  p_entry->p_ops      = NULL;
+  p_entry->p_retained = NULL;
+  p_entry->size     = 0;
+  p_entry->tag      = 0;
+}
+
+void delete_script(window_data_t* p_data, GLuint id)
+{
+  script_t* p_entry = find_script_slot(&p_data->scripts, id);
+  if (p_entry == NULL || p_entry->p_script == NULL)
+    return;
+  damage_script(p_entry);
+  free_script(p_entry);
+  p_data->scripts.live--;
+}
 
-PACK(typedef struct linear_gradient_t
+void delete_all(window_data_t* p_data)
 {
-  GLfloat sx;
-  GLfloat sy;
-  GLfloat ex;
-  GLfloat ey;
-  GLuint  sr;
-  GLuint  sg;
-  GLuint  sb;
-  GLuint  sa;
-  GLuint  er;
-  GLuint  eg;
-  GLuint  eb;
-  GLuint  ea;
-}) linear_gradient_t;
+  for_each_script(&p_data->scripts, free_script);
+  p_data->scripts.live = 0;
+  damage_all();
+}
 
-PACK(typedef struct box_gradient_t
+// takes ownership of p_script. It is kept as it arrived, so patches can be
+// made against it, and decoded to be run
+void put_script(window_data_t* p_data, GLuint id, void* p_script,
+                uint32_t size, uint32_t tag)
 {
-  GLfloat x;
-  GLfloat y;
-  GLfloat w;
-  GLfloat h;
-  GLfloat radius;
-  GLfloat feather;
-  GLuint  sr;
-  GLuint  sg;
-  GLuint  sb;
-  GLuint  sa;
-  GLuint  er;
-  GLuint  eg;
-  GLuint  eb;
-  GLuint  ea;
-}) box_gradient_t;
+  script_t* p_entry = make_script_slot(&p_data->scripts, id);
+  if (p_entry == NULL)
+  {
+    send_puts("put_script NO MEMORY");
+    free(p_script);
+    return;
+  }
 
-PACK(typedef struct radial_gradient_t
+  if (p_entry->p_script == NULL)
+  {
+    script_table_t* p_table = &p_data->scripts;
+    p_table->live++;
+    if (p_table->live > p_table->peak)
+      p_table->peak = p_table->live;
+  }
+  else
+  {
+    free_script(p_entry);
+  }
+
+  p_entry->p_script = p_script;
+  p_entry->size     = size;
+  p_entry->tag      = tag;
+  refresh_script(p_data, id);
+}
+
+// decode the script again after it was changed in place
+void refresh_script(window_data_t* p_data, GLuint id)
 {
-  GLfloat cx;
-  GLfloat cy;
-  GLfloat r_in;
-  GLfloat r_out;
-  GLuint  sr;
-  GLuint  sg;
-  GLuint  sb;
-  GLuint  sa;
-  GLuint  er;
-  GLuint  eg;
-  GLuint  eb;
-  GLuint  ea;
-}) radial_gradient_t;
+  script_t* p_entry = get_script_entry(p_data, id);
+  if (p_entry == NULL || p_entry->p_script == NULL)
+    return;
+  damage_script(p_entry);
+  free(p_entry->p_ops);
+  free_retained(p_entry->p_retained);
+  free_cached(p_entry);
+  p_entry->p_retained = NULL;
+  p_entry->p_ops = decode_script(p_data, p_entry->p_script, p_entry->size,
+                                 &p_entry->bounds);
+}
 
-PACK(typedef struct image_pattern_t
+void* get_script(window_data_t* p_data, GLuint id)
 {
-  GLfloat ox;
-  GLfloat oy;
-  GLfloat ex;
-  GLfloat ey;
-  GLfloat angle;
-  GLuint  alpha;
-  GLuint  key_size;
-}) image_pattern_t;
+  script_t* p_entry = find_script_slot(&p_data->scripts, id);
+  if (p_entry == NULL)
+    return NULL;
+  return p_entry->p_ops;
+}
 
-PACK(typedef struct text_t
+// NULL unless there is a script at the id
+script_t* get_script_entry(window_data_t* p_data, GLuint id)
 {
-  GLuint size;
-}) text_t;
+  script_t* p_entry = find_script_slot(&p_data->scripts, id);
+  if (p_entry == NULL || p_entry->p_script == NULL)
+    return NULL;
+  return p_entry;
+}
 
 //=============================================================================
-// operations
+// operations. These all run on decoded scripts
 
 //---------------------------------------------------------
 // run script
-void* internal_run_script(void* p_script, window_data_t* p_data)
+static void* internal_run_script(void* p_script, window_data_t* p_data,
+                                 retain_t* p_retain, drawn_t* p_drawn)
 {
   GLuint id = *(GLuint*) p_script;
+
+  retain_child(p_retain, p_data, id, &current_paint);
+  drawn_child(p_drawn, p_data);
+  uint32_t misses = draw_misses;
   run_script(id, p_data);
+  drawn_child_done(p_drawn, p_data);
+  retain_child_done(p_retain, p_data, &current_paint, draw_misses - misses);
+
   return (void *)((char *)p_script + sizeof(GLuint));
 }
 
 //---------------------------------------------------------
-// paint setup
+// run a script once for each of a list of transforms. Each instance runs the
+// way the script would have if run in its own push and pop with a new path, so
+// it is culled, replayed and drawn from its texture on its own, and what they
+// draw goes to the GL in as few draws as their paints allow
+void run_instances(window_data_t* p_data, const void* p_instances)
+{
+  NVGcontext*        p_ctx      = p_data->context.p_ctx;
+  const instances_t* p_header   = p_instances;
+  const matrix_t*    p_matrices = (const matrix_t*) (p_header + 1);
+  const NVGcolor*    p_tints    = (const NVGcolor*) (p_matrices +
+                                                    p_header->count);
+  NVGLmark           mark;
+
+  for (GLuint i = 0; i < p_header->count; i++)
+  {
+    const matrix_t* m = &p_matrices[i];
+    nvgSave(p_ctx);
+    nvgTransform(p_ctx, m->a, m->b, m->c, m->d, m->e, m->f);
+    nvgBeginPath(p_ctx);
+    nvglMark(p_ctx, &mark);
+    run_script(p_header->id, p_data);
+    if (p_header->flags & INSTANCES_TINTED)
+      nvglTint(p_ctx, &mark, p_tints[i]);
+    nvgRestore(p_ctx);
+  }
+}
 
-void* paint_linear(NVGcontext* p_ctx, void* p_script)
+// what the instances draw counts as drawn by this script. Damage only hears
+// where the last script that ran drew, which would miss all but one
+static void* internal_draw_instances(void* p_script, window_data_t* p_data,
+                                     retain_t* p_retain)
 {
-  linear_gradient_t* grad = (linear_gradient_t*) p_script;
+  instances_t* p_header = p_script;
 
-  current_paint =
-      nvgLinearGradient(p_ctx, grad->sx, grad->sy, grad->ex, grad->ey,
-                        nvgRGBA(grad->sr, grad->sg, grad->sb, grad->sa),
-                        nvgRGBA(grad->er, grad->eg, grad->eb, grad->ea));
+  retain_instances(p_retain, p_data, p_script, &current_paint);
+  uint32_t misses = draw_misses;
+  run_instances(p_data, p_script);
+  retain_child_done(p_retain, p_data, &current_paint, draw_misses - misses);
 
-  return (void *)((char *)p_script + sizeof(linear_gradient_t));
+  uint32_t size = sizeof(matrix_t);
+  if (p_header->flags & INSTANCES_TINTED)
+    size += sizeof(NVGcolor);
+  size = sizeof(instances_t) + p_header->count * size;
+  return (void *)((char *)p_script + size);
 }
 
-void* paint_box(NVGcontext* p_ctx, void* p_script)
+//---------------------------------------------------------
+// paint setup
+
+static void* paint_linear(NVGcontext* p_ctx, void* p_script)
 {
-  box_gradient_t* grad = (box_gradient_t*) p_script;
+  linear_paint_t* grad = (linear_paint_t*) p_script;
 
-  current_paint = nvgBoxGradient(
-      p_ctx, grad->x, grad->y, grad->w, grad->h, grad->radius, grad->feather,
-      nvgRGBA(grad->sr, grad->sg, grad->sb, grad->sa),
-      nvgRGBA(grad->er, grad->eg, grad->eb, grad->ea));
+  current_paint = nvgLinearGradient(p_ctx, grad->sx, grad->sy, grad->ex,
+                                    grad->ey, grad->inner, grad->outer);
 
-  return (void *)((char *)p_script + sizeof(box_gradient_t));
+  return (void *)((char *)p_script + sizeof(linear_paint_t));
 }
 
-void* paint_radial(NVGcontext* p_ctx, void* p_script)
+static void* paint_box(NVGcontext* p_ctx, void* p_script)
 {
-  radial_gradient_t* grad = (radial_gradient_t*) p_script;
+  box_paint_t* grad = (box_paint_t*) p_script;
 
   current_paint =
-      nvgRadialGradient(p_ctx, grad->cx, grad->cy, grad->r_in, grad->r_out,
-                        nvgRGBA(grad->sr, grad->sg, grad->sb, grad->sa),
-                        nvgRGBA(grad->er, grad->eg, grad->eb, grad->ea));
+      nvgBoxGradient(p_ctx, grad->x, grad->y, grad->w, grad->h, grad->radius,
+                     grad->feather, grad->inner, grad->outer);
 
-  return (void *)((char *)p_script + sizeof(radial_gradient_t));
+  return (void *)((char *)p_script + sizeof(box_paint_t));
 }
 
-void* paint_image(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
+static void* paint_radial(NVGcontext* p_ctx, void* p_script)
 {
-  image_pattern_t* img = (image_pattern_t*) p_script;
-  p_script = (void *)((char *)p_script + sizeof(image_pattern_t));
+  radial_paint_t* grad = (radial_paint_t*) p_script;
+
+  current_paint = nvgRadialGradient(p_ctx, grad->cx, grad->cy, grad->r_in,
+                                    grad->r_out, grad->inner, grad->outer);
 
-  float alpha = (float) img->alpha / 255.0;
+  return (void *)((char *)p_script + sizeof(radial_paint_t));
+}
+
+static void* paint_image(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
+{
+  image_paint_t* img = (image_paint_t*) p_script;
+  p_script = (void *)((char *)p_script + sizeof(image_paint_t));
 
   // get the image id from the hash.
   int id = get_tx_id(p_data->p_tx_ids, p_script);
@@ -363,6 +1751,7 @@ void* paint_image(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
   if (id < 0)
   {
     send_static_texture_miss(p_script);
+    draw_misses++;
   }
   else
   {
@@ -383,18 +1772,16 @@ void* paint_image(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
 
     // the id is loaded and found
     current_paint =
-        nvgImagePattern(p_ctx, ox, oy, ex, ey, img->angle, id, alpha);
+        nvgImagePattern(p_ctx, ox, oy, ex, ey, img->angle, id, img->alpha);
   }
 
   return (void *)((char *)p_script + img->key_size);
 }
 
-void* paint_dynamic(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
+static void* paint_dynamic(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
 {
-  image_pattern_t* img = (image_pattern_t*) p_script;
-  p_script = (void *)((char *)p_script + sizeof(image_pattern_t));
-
-  float alpha = (float) img->alpha / 255.0;
+  image_paint_t* img = (image_paint_t*) p_script;
+  p_script = (void *)((char *)p_script + sizeof(image_paint_t));
 
   // get the image id from the hash.
   int id = get_tx_id(p_data->p_tx_ids, p_script);
@@ -403,6 +1790,7 @@ void* paint_dynamic(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
   if (id < 0)
   {
     send_dynamic_texture_miss(p_script);
+    draw_misses++;
   }
   else
   {
@@ -423,7 +1811,7 @@ void* paint_dynamic(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
 
     // the id is loaded and found
     current_paint =
-        nvgImagePattern(p_ctx, ox, oy, ex, ey, img->angle, id, alpha);
+        nvgImagePattern(p_ctx, ox, oy, ex, ey, img->angle, id, img->alpha);
   }
 
   return (void *)((char *)p_script + img->key_size);
@@ -432,79 +1820,42 @@ void* paint_dynamic(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
 //---------------------------------------------------------
 // render styles
 
-void* shape_anti_alias(NVGcontext* p_ctx, void* p_script)
+static void* stroke_color(NVGcontext* p_ctx, void* p_script)
 {
-  nvgShapeAntiAlias(p_ctx, *(int*) p_script);
-  return (void *)((char *)p_script + sizeof(int));
-}
-
-void* stroke_color(NVGcontext* p_ctx, void* p_script)
-{
-  color_t* color = (color_t*) p_script;
-  nvgStrokeColor(p_ctx, nvgRGBA(color->r, color->g, color->b, color->a));
-  return (void *)((char *)p_script + sizeof(color_t));
+  nvgStrokeColor(p_ctx, *(NVGcolor*) p_script);
+  return (void *)((char *)p_script + sizeof(NVGcolor));
 }
 
-void* shape_width(NVGcontext* p_ctx, void* p_script)
+static void* shape_width(NVGcontext* p_ctx, void* p_script)
 {
   nvgStrokeWidth(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* fill_color(NVGcontext* p_ctx, void* p_script)
+static void* fill_color(NVGcontext* p_ctx, void* p_script)
 {
-  color_t* color = (color_t*) p_script;
-  nvgFillColor(p_ctx, nvgRGBA(color->r, color->g, color->b, color->a));
-  return (void *)((char *)p_script + sizeof(color_t));
+  nvgFillColor(p_ctx, *(NVGcolor*) p_script);
+  return (void *)((char *)p_script + sizeof(NVGcolor));
 }
 
-void* miter_limit(NVGcontext* p_ctx, void* p_script)
+static void* miter_limit(NVGcontext* p_ctx, void* p_script)
 {
   nvgMiterLimit(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* line_cap(NVGcontext* p_ctx, void* p_script)
+static void* line_cap(NVGcontext* p_ctx, void* p_script)
 {
-  uint32_t join = *(uint32_t*) p_script;
-  switch (join)
-  {
-    case 0:
-      nvgLineCap(p_ctx, NVG_BUTT);
-      break;
-    case 1:
-      nvgLineCap(p_ctx, NVG_ROUND);
-      break;
-    case 2:
-      nvgLineCap(p_ctx, NVG_SQUARE);
-      break;
-    default:
-      break;
-  }
-  return (void *)((char *)p_script + sizeof(uint32_t));
+  nvgLineCap(p_ctx, *(int*) p_script);
+  return (void *)((char *)p_script + sizeof(int));
 }
 
-void* line_join(NVGcontext* p_ctx, void* p_script)
+static void* line_join(NVGcontext* p_ctx, void* p_script)
 {
-  uint32_t join = *(uint32_t*) p_script;
-  switch (join)
-  {
-    case 0:
-      nvgLineJoin(p_ctx, NVG_MITER);
-      break;
-    case 1:
-      nvgLineJoin(p_ctx, NVG_ROUND);
-      break;
-    case 2:
-      nvgLineJoin(p_ctx, NVG_BEVEL);
-      break;
-    default:
-      break;
-  }
-  return (void *)((char *)p_script + sizeof(uint32_t));
+  nvgLineJoin(p_ctx, *(int*) p_script);
+  return (void *)((char *)p_script + sizeof(int));
 }
-
-void* global_alpha(NVGcontext* p_ctx, void* p_script)
+static void* global_alpha(NVGcontext* p_ctx, void* p_script)
 {
   nvgGlobalAlpha(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
@@ -513,14 +1864,14 @@ void* global_alpha(NVGcontext* p_ctx, void* p_script)
 //---------------------------------------------------------
 // scissors
 
-void* scissor(NVGcontext* p_ctx, void* p_script)
+static void* scissor(NVGcontext* p_ctx, void* p_script)
 {
   wh_t* wh = (wh_t*) p_script;
   nvgScissor(p_ctx, 0, 0, wh->w, wh->h);
   return (void *)((char *)p_script + sizeof(wh_t));
 }
 
-void* intersect_scissor(NVGcontext* p_ctx, void* p_script)
+static void* intersect_scissor(NVGcontext* p_ctx, void* p_script)
 {
   wh_t* wh = (wh_t*) p_script;
   nvgIntersectScissor(p_ctx, 0, 0, wh->w, wh->h);
@@ -530,21 +1881,30 @@ void* intersect_scissor(NVGcontext* p_ctx, void* p_script)
 //---------------------------------------------------------
 // paths
 
-void* move_to(NVGcontext* p_ctx, void* p_script)
+static void* move_to(NVGcontext* p_ctx, void* p_script)
 {
   xy_t* xywh = (xy_t*) p_script;
   nvgMoveTo(p_ctx, xywh->x, xywh->y);
   return (void *)((char *)p_script + sizeof(xy_t));
 }
 
-void* line_to(NVGcontext* p_ctx, void* p_script)
+static void* line_to(NVGcontext* p_ctx, void* p_script)
 {
   xy_t* xywh = (xy_t*) p_script;
   nvgLineTo(p_ctx, xywh->x, xywh->y);
   return (void *)((char *)p_script + sizeof(xy_t));
 }
 
-void* bezier_to(NVGcontext* p_ctx, void* p_script)
+// the points go to nanovg in one go
+static void* polyline(NVGcontext* p_ctx, void* p_script, int close)
+{
+  points_t* p_points = (points_t*) p_script;
+  nvgPolyline(p_ctx, (const float*) (p_points + 1), p_points->count, close);
+  return (void *)((char *)p_script + sizeof(points_t) +
+                  p_points->count * sizeof(xy_t));
+}
+
+static void* bezier_to(NVGcontext* p_ctx, void* p_script)
 {
   bezier_to_t* bezier = (bezier_to_t*) p_script;
   nvgBezierTo(p_ctx, bezier->c1x, bezier->c1y, bezier->c2x, bezier->c2y,
@@ -552,34 +1912,27 @@ void* bezier_to(NVGcontext* p_ctx, void* p_script)
   return (void *)((char *)p_script + sizeof(bezier_to_t));
 }
 
-void* quadratic_to(NVGcontext* p_ctx, void* p_script)
+static void* quadratic_to(NVGcontext* p_ctx, void* p_script)
 {
   quadratic_to_t* quad = (quadratic_to_t*) p_script;
   nvgQuadTo(p_ctx, quad->cx, quad->cy, quad->x, quad->y);
   return (void *)((char *)p_script + sizeof(quadratic_to_t));
 }
 
-void* arc_to(NVGcontext* p_ctx, void* p_script)
+static void* arc_to(NVGcontext* p_ctx, void* p_script)
 {
   arc_to_t* arc = (arc_to_t*) p_script;
   nvgArcTo(p_ctx, arc->x1, arc->y1, arc->x2, arc->y2, arc->radius);
   return (void *)((char *)p_script + sizeof(arc_to_t));
 }
 
-void* path_winding(NVGcontext* p_ctx, void* p_script)
+static void* path_winding(NVGcontext* p_ctx, void* p_script)
 {
-  if (*(int*) p_script)
-  {
-    nvgPathWinding(p_ctx, NVG_SOLID);
-  }
-  else
-  {
-    nvgPathWinding(p_ctx, NVG_HOLE);
-  }
+  nvgPathWinding(p_ctx, *(int*) p_script);
   return (void *)((char *)p_script + sizeof(int));
 }
 
-void* triangle(NVGcontext* p_ctx, void* p_script)
+static void* triangle(NVGcontext* p_ctx, void* p_script)
 {
   triangle_t* tri = (triangle_t*) p_script;
   nvgMoveTo(p_ctx, tri->x0, tri->y0);
@@ -589,175 +1942,177 @@ void* triangle(NVGcontext* p_ctx, void* p_script)
   return (void *)((char *)p_script + sizeof(triangle_t));
 }
 
-void* rect(NVGcontext* p_ctx, void* p_script)
+static void* rect(NVGcontext* p_ctx, void* p_script)
 {
   wh_t* wh = (wh_t*) p_script;
   nvgRect(p_ctx, 0, 0, wh->w, wh->h);
   return (void *)((char *)p_script + sizeof(wh_t));
 }
 
-void* round_rect(NVGcontext* p_ctx, void* p_script)
+static void* round_rect(NVGcontext* p_ctx, void* p_script)
 {
   whr_t* whr = (whr_t*) p_script;
   nvgRoundedRect(p_ctx, 0, 0, whr->w, whr->h, whr->r);
   return (void *)((char *)p_script + sizeof(whr_t));
 }
 
-void* ellipse(NVGcontext* p_ctx, void* p_script)
+static void* ellipse(NVGcontext* p_ctx, void* p_script)
 {
   ellipse_t* ellipse = (ellipse_t*) p_script;
   nvgEllipse(p_ctx, 0, 0, ellipse->rx, ellipse->ry);
   return (void *)((char *)p_script + sizeof(ellipse_t));
 }
 
-void* circle(NVGcontext* p_ctx, void* p_script)
+static void* circle(NVGcontext* p_ctx, void* p_script)
 {
   GLfloat radius = *(GLfloat*) p_script;
   nvgCircle(p_ctx, 0, 0, radius);
   return (void *)((char *)p_script + sizeof(GLfloat));
 }
 
-void* arc(NVGcontext* p_ctx, void* p_script)
-{
-  // bring sector data onto the stack
-  arc_sector_t sector = *(arc_sector_t*) p_script;
+// arcs are drawn as straight segments, as few as keep them within
+// ARC_TOLERANCE framebuffer pixels of the true curve
+#define ARC_TOLERANCE 0.1f
+#define ARC_MAX_SEGMENTS 1024
 
-  // clamp the angle to a circle
-  float angle = sector.finish - sector.start;
-  angle       = angle > TAU ? TAU : angle;
-  angle       = angle < -TAU ? -TAU : angle;
+static int arc_segments(NVGcontext* p_ctx, float ratio, float radius,
+                        float angle)
+{
+  // how big the radius is on screen
+  float xform[6];
+  nvgCurrentTransform(p_ctx, xform);
+  float scale  = fmaxf(sqrtf(xform[0] * xform[0] + xform[1] * xform[1]),
+                       sqrtf(xform[2] * xform[2] + xform[3] * xform[3]));
+  float pixels = radius * scale * ratio;
 
-  // calculate the number of segments
-  int   segment_count = log2(sector.radius) * fabsf(angle) * 2;
-  float increment     = angle / segment_count;
-  float a             = sector.start;
+  // also catches NaNs
+  if (angle == 0 || !(pixels > 0))
+    return 0;
 
-  // don't draw anything if the angle is so small that the segment_count is zero
-  if (segment_count > 0)
-  {
-    // Arc starts on the perimeter. Sector starts in the center.
-    for (int i = 0; i <= segment_count; ++i)
-    {
-      float px, py;
-      px = sector.radius * cos(a);
-      py = sector.radius * sin(a);
-      if (i == 0)
-      {
-        nvgMoveTo(p_ctx, px, py);
-      }
-      else
-      {
-        nvgLineTo(p_ctx, px, py);
-      }
-      a += increment;
-    }
-    // arc doesn't close
-  }
+  // the furthest a segment can turn and stay that close
+  float step = NVG_PI;
+  if (pixels > ARC_TOLERANCE)
+    step = 2 * acosf(1 - ARC_TOLERANCE / pixels);
 
-  return (void *)((char *)p_script + sizeof(arc_sector_t));
+  float segments = ceilf(fabsf(angle) / step);
+  return segments < ARC_MAX_SEGMENTS ? segments : ARC_MAX_SEGMENTS;
 }
 
-void* sector(NVGcontext* p_ctx, void* p_script)
+// each point is the last one turned a step further. Only the ends are worked
+// out directly, so the end lands where it should. false if nothing was drawn
+static bool arc_path(NVGcontext* p_ctx, window_data_t* p_data,
+                     arc_sector_t* p_sector, bool from_center)
 {
-  // bring sector data onto the stack
-  arc_sector_t sector = *(arc_sector_t*) p_script;
-
   // clamp the angle to a circle
-  float angle = sector.finish - sector.start;
+  float angle = p_sector->finish - p_sector->start;
   angle       = angle > TAU ? TAU : angle;
   angle       = angle < -TAU ? -TAU : angle;
 
-  // calculate the number of segments
-  int   segment_count = log2(sector.radius) * fabsf(angle) * 2;
-  float increment     = angle / segment_count;
-  float a             = sector.start;
+  float radius   = p_sector->radius;
+  int   segments = arc_segments(p_ctx, p_data->context.frame_ratio.x, radius,
+                                angle);
+
+  // don't draw anything if there is nothing to see
+  if (segments == 0)
+    return false;
+
+  float step_cos = cosf(angle / segments);
+  float step_sin = sinf(angle / segments);
+  float px       = radius * cosf(p_sector->start);
+  float py       = radius * sinf(p_sector->start);
 
-  // don't draw anything if the angle is so small that the segment_count is zero
-  if (segment_count > 0)
+  // Arc starts on the perimeter. Sector starts in the center.
+  if (from_center)
   {
-    // Arc starts on the perimeter. Sector starts in the center.
     nvgMoveTo(p_ctx, 0, 0);
+    nvgLineTo(p_ctx, px, py);
+  }
+  else
+  {
+    nvgMoveTo(p_ctx, px, py);
+  }
 
-    for (int i = 0; i <= segment_count; ++i)
-    {
-      float px, py;
-      px = sector.radius * cos(a);
-      py = sector.radius * sin(a);
-      nvgLineTo(p_ctx, px, py);
-      a += increment;
-    }
-    nvgClosePath(p_ctx);
+  for (int i = 1; i < segments; ++i)
+  {
+    float x = px * step_cos - py * step_sin;
+    py      = px * step_sin + py * step_cos;
+    px      = x;
+    nvgLineTo(p_ctx, px, py);
   }
+  nvgLineTo(p_ctx, radius * cosf(p_sector->start + angle),
+            radius * sinf(p_sector->start + angle));
+  return true;
+}
+
+static void* arc(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
+{
+  // arc doesn't close
+  arc_path(p_ctx, p_data, (arc_sector_t*) p_script, false);
+  return (void *)((char *)p_script + sizeof(arc_sector_t));
+}
 
+static void* sector(NVGcontext* p_ctx, void* p_script, window_data_t* p_data)
+{
+  if (arc_path(p_ctx, p_data, (arc_sector_t*) p_script, true))
+    nvgClosePath(p_ctx);
   return (void *)((char *)p_script + sizeof(arc_sector_t));
 }
 
-void* text(NVGcontext* p_ctx, void* p_script)
+static void* text(NVGcontext* p_ctx, void* p_script)
 {
   text_t* text_info = (text_t*) p_script;
   p_script = (void *)((char *)p_script + sizeof(text_t));
 
-  float       x     = 0;
-  float       y     = 0;
   const char* start = p_script;
-  const char* end   = start + text_info->size;
-  float       lineh;
-  nvgTextMetrics(p_ctx, NULL, NULL, &lineh);
-  NVGtextRow rows[3];
-  int        nrows, i;
-
-  // up to this code to break the lines...
-  while ((nrows = nvgTextBreakLines(p_ctx, start, end, 1000, rows, 3)))
-  {
-    for (i = 0; i < nrows; i++)
-    {
-      NVGtextRow* row = &rows[i];
-      nvgText(p_ctx, x, y, row->start, row->end);
-      y += lineh;
-    }
-    // Keep going...
-    start = rows[nrows - 1].next;
-  }
+  draw_text(p_ctx, start, start + text_info->size);
 
   // Text is padded to 32-bits
   return (void *)((char *)p_script + ((text_info->size + 3) & ~3));
 }
 
+// for scripts that run without drawing
+static void* skip_text(void* p_script)
+{
+  text_t* text_info = (text_t*) p_script;
+  return (void *)((char *)p_script + sizeof(text_t) +
+                  ((text_info->size + 3) & ~3));
+}
+
 //---------------------------------------------------------
 // transforms
-void* tx_rotate(NVGcontext* p_ctx, void* p_script)
+static void* tx_rotate(NVGcontext* p_ctx, void* p_script)
 {
   nvgRotate(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* tx_translate(NVGcontext* p_ctx, void* p_script)
+static void* tx_translate(NVGcontext* p_ctx, void* p_script)
 {
   xy_t* xy = (xy_t*) p_script;
   nvgTranslate(p_ctx, xy->x, xy->y);
   return (void *)((char *)p_script + sizeof(xy_t));
 }
 
-void* tx_scale(NVGcontext* p_ctx, void* p_script)
+static void* tx_scale(NVGcontext* p_ctx, void* p_script)
 {
   xy_t* xy = (xy_t*) p_script;
   nvgScale(p_ctx, xy->x, xy->y);
   return (void *)((char *)p_script + sizeof(xy_t));
 }
 
-void* tx_skew_x(NVGcontext* p_ctx, void* p_script)
+static void* tx_skew_x(NVGcontext* p_ctx, void* p_script)
 {
   nvgSkewX(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* tx_skew_y(NVGcontext* p_ctx, void* p_script)
+static void* tx_skew_y(NVGcontext* p_ctx, void* p_script)
 {
   nvgSkewY(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* tx_matrix(NVGcontext* p_ctx, void* p_script)
+static void* tx_matrix(NVGcontext* p_ctx, void* p_script)
 {
   matrix_t* tx = (matrix_t*) p_script;
   nvgTransform(p_ctx, tx->a, tx->b, tx->c, tx->d, tx->e, tx->f);
@@ -767,7 +2122,7 @@ void* tx_matrix(NVGcontext* p_ctx, void* p_script)
 //---------------------------------------------------------
 // font styles
 
-void* font(NVGcontext* p_ctx, void* p_script)
+static void* font(NVGcontext* p_ctx, void* p_script)
 {
   GLuint name_length = *(GLuint*) p_script;
   p_script = (void *)((char *)p_script + sizeof(GLuint));
@@ -782,260 +2137,573 @@ void* font(NVGcontext* p_ctx, void* p_script)
   {
     // the font is NOT loaded. Request it from the ex code above
     send_font_miss(p_script);
+    draw_misses++;
   }
 
   return (void *)((char *)p_script + name_length);
 }
 
-void* font_blur(NVGcontext* p_ctx, void* p_script)
+static void* font_blur(NVGcontext* p_ctx, void* p_script)
 {
   nvgFontBlur(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* font_size(NVGcontext* p_ctx, void* p_script)
+static void* font_size(NVGcontext* p_ctx, void* p_script)
 {
   nvgFontSize(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
-void* text_align(NVGcontext* p_ctx, void* p_script)
+static void* text_align(NVGcontext* p_ctx, void* p_script)
 {
   nvgTextAlign(p_ctx, *(uint32_t*) p_script);
   return (void *)((char *)p_script + sizeof(uint32_t));
 }
 
-void* text_height(NVGcontext* p_ctx, void* p_script)
+static void* text_height(NVGcontext* p_ctx, void* p_script)
 {
   nvgTextLineHeight(p_ctx, *(float*) p_script);
   return (void *)((char *)p_script + sizeof(float));
 }
 
+//=============================================================================
+// culling. A script is skipped if nothing it draws itself can be seen in the
+// window, or inside the scissor, in the state it runs in. One that runs other
+// scripts or leaves state behind still runs, just without drawing, since
+// those don't depend on where it draws.
+
+// how far antialiasing reaches past the drawing, in window coordinates
+#define CULL_MARGIN 2
+
+static bool     culling       = true;
+static uint32_t frame_skipped = 0;
+static uint32_t frame_drawn   = 0;
+
+//---------------------------------------------------------
+void set_culling(bool on)
+{
+  culling = on;
+}
+
+// scripts skipped and drawn in the last frame
+uint32_t get_skipped_scripts()
+{
+  return frame_skipped;
+}
+
+uint32_t get_drawn_scripts()
+{
+  return frame_drawn;
+}
+
+//---------------------------------------------------------
+static bool script_hidden(window_data_t* p_data, script_t* p_entry)
+{
+  script_bounds_t* p_bounds = &p_entry->bounds;
+  // a script being cached draws into its texture, wherever that is shown
+  if (!culling || p_bounds->unbounded || cache_recording())
+    return false;
+
+  NVGcontext* p_ctx = p_data->context.p_ctx;
+  float       xform[6], width, miter, size, blur, line;
+  nvgCurrentTransform(p_ctx, xform);
+  nvgCurrentReach(p_ctx, &width, &miter, &size, &blur, &line);
+
+  // text that might wrap into more rows than it was measured with
+  if (p_bounds->text_bytes * size > 1000)
+    return false;
+
+  // what it draws, finished off with the state it runs in
+  float local[4];
+  memcpy(local, p_bounds->fixed, sizeof(local));
+  if (!box_is_empty(p_bounds->text_at))
+  {
+    float text[4] = {p_bounds->text_at[0] + p_bounds->text_em[0] * size,
+                     p_bounds->text_at[1] + p_bounds->text_em[1] * size,
+                     p_bounds->text_at[2] + p_bounds->text_em[2] * size,
+                     p_bounds->text_at[3] + p_bounds->text_em[3] * size};
+    grow_box(local, text);
+  }
+  pad_box(local, fmaxf(p_bounds->text_blur, blur * p_bounds->blur_scale));
+
+  // strokes are widened on screen, after they are transformed
+  float reach = stroke_reach(fmaxf(width, p_bounds->stroke_width),
+                             fmaxf(miter, p_bounds->stroke_miter));
+  reach       = fmaxf(p_bounds->stroke_reach, reach * p_bounds->stroke_scale);
+
+  float screen[4], stroke[4];
+  map_box(xform, local, screen);
+  map_box(xform, p_bounds->stroke, stroke);
+  pad_box(stroke, reach * max_scale(xform));
+  grow_box(screen, stroke);
+
+  // one that only runs other scripts has nothing of its own to skip
+  if (box_is_empty(screen))
+    return !p_bounds->runs_scripts;
+  pad_box(screen, CULL_MARGIN);
+
+  float view[4] = {0, 0, p_data->context.window_width,
+                   p_data->context.window_height};
+  float scissor[4];
+  if (!p_bounds->own_scissor && nvgCurrentScissorBounds(p_ctx, scissor))
+  {
+    view[0] = fmaxf(view[0], scissor[0]);
+    view[1] = fmaxf(view[1], scissor[1]);
+    view[2] = fminf(view[2], scissor[2]);
+    view[3] = fminf(view[3], scissor[3]);
+  }
+  return screen[2] < view[0] || screen[0] > view[2] || screen[3] < view[1] ||
+         screen[1] > view[3];
+}
+
+//=============================================================================
+// op profile. Counts how often each op runs and how long it takes. Off unless
+// turned on, and costs nothing in the interpreter while it is off.
+
+static bool         profiling = false;
+static op_profile_t op_profile[PROFILE_OPS];
+static uint64_t     tick_histogram[PROFILE_BUCKETS];
+static int          profile_op    = -1;
+static uint64_t     profile_start = 0;
+
+//---------------------------------------------------------
+void set_script_profiling(bool on)
+{
+  profiling = on;
+}
+
+bool script_profiling()
+{
+  return profiling;
+}
+
+const op_profile_t* get_op_profile()
+{
+  return op_profile;
+}
+
+const uint64_t* get_tick_histogram()
+{
+  return tick_histogram;
+}
+
+//---------------------------------------------------------
+// charge the time since the last op started to that op. An op's time runs
+// until the next op starts, so a sub-script's ops are charged separately
+// from the run_script op that called them.
+static void profile_close(uint64_t now)
+{
+  if (profile_op < 0)
+    return;
+
+  uint64_t ticks = now - profile_start;
+  op_profile[profile_op].ticks += ticks;
+
+  // log2 buckets. The last one holds everything bigger
+  int bucket = 0;
+  while ((ticks >>= 1) && bucket < PROFILE_BUCKETS - 1)
+    bucket++;
+  tick_histogram[bucket]++;
+
+  profile_op = -1;
+}
+
+static void profile_open(GLuint op)
+{
+  uint64_t now = glfwGetTimerValue();
+  profile_close(now);
+  op_profile[op].count++;
+  profile_op    = op;
+  profile_start = now;
+}
+
 //=============================================================================
 // the main script function
 
+// GCC and Clang can jump straight from one op to the next through a table of
+// label addresses, which saves the bounds check and the shared indirect jump
+// of a switch. Everything else, or a build with SCRIPT_SWITCH_DISPATCH
+// defined, uses the switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SCRIPT_SWITCH_DISPATCH)
+#define DIRECT_THREADED
+#endif
+
+#ifdef DIRECT_THREADED
+#define OP_CASE(op) do_##op:
+#define NEXT_OP()                                                              \
+  op = *(GLuint*) p_script;                                                    \
+  p_script = (void*) ((char*) p_script + sizeof(GLuint));                      \
+  goto* p_dispatch[op]
+#else
+#define OP_CASE(op) case op:
+#define NEXT_OP() continue
+#endif
+
 //---------------------------------------------------------
 void run_script(GLuint script_id, window_data_t* p_data)
 {
-  char buff[200];
+  static int depth = 0;
+
+  // the root script starts the frame's counts
+  if (depth == 0)
+  {
+    frame_skipped = 0;
+    frame_drawn   = 0;
+  }
+
+  // whatever is being cached depends on this script, even if it isn't there
+  note_cached_script(p_data, script_id);
 
   // get the script in question. bail if it isn't there
-  void* p_script = get_script(p_data, script_id);
-  if (p_script == NULL)
+  script_t* p_entry = get_script_entry(p_data, script_id);
+  if (p_entry == NULL || p_entry->p_ops == NULL || depth >= MAX_SCRIPT_DEPTH)
   {
     // sprintf(buff, "Tried to render NULL script %d", script_id);
     // send_puts( buff );
     return;
   };
 
+  // skip it if nothing it draws can be seen
+  bool hidden = script_hidden(p_data, p_entry);
+  if (!hidden)
+  {
+    frame_drawn++;
+  }
+  else
+  {
+    frame_skipped++;
+    if (!p_entry->bounds.runs_scripts && !p_entry->bounds.leaks)
+      return;
+  }
+
   // setup
-  NVGcontext* p_ctx = p_data->context.p_ctx;
+  NVGcontext* p_ctx    = p_data->context.p_ctx;
+  void*       p_script = p_entry->p_ops;
+  GLuint      op;
+  retain_t    retain;
+  drawn_t     drawn;
+  depth++;
+  start_drawn(&drawn, p_data);
+
+  // draw it from its texture if it has one
+  if (draw_cached(p_data, p_entry, &current_paint))
+  {
+    finish_drawn(&drawn, p_data, p_entry);
+    depth--;
+    return;
+  }
+  bool caching = !hidden && start_cache(p_data, p_entry, &current_paint,
+                                        draw_misses, depth);
+
+  // draw it the way it was drawn last time if nothing it depends on changed.
+  // otherwise run it, and keep what it draws for next time
+  if (replay_script(p_data, p_entry, &current_paint))
+  {
+    if (caching)
+      finish_cache(p_data, p_entry, &current_paint, draw_misses);
+    finish_drawn(&drawn, p_data, p_entry);
+    depth--;
+    return;
+  }
+  // what runs without drawing isn't worth keeping
+  if (hidden)
+    retain.p_retained = NULL;
+  else
+    start_retain(&retain, p_data, &current_paint, draw_misses);
+
+#ifdef DIRECT_THREADED
+  // decoding only keeps known ops, and they all fit in a byte. Unknown ops
+  // default to done and the known ones override that.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+  static void* const dispatch[PROFILE_OPS] = {
+      [0 ... PROFILE_OPS - 1] = &&done,
+      [OP_PUSH_STATE]         = &&do_OP_PUSH_STATE,
+      [OP_POP_STATE]          = &&do_OP_POP_STATE,
+      [OP_RESET_STATE]        = &&do_OP_RESET_STATE,
+      [OP_RUN_SCRIPT]         = &&do_OP_RUN_SCRIPT,
+      [OP_DRAW_INSTANCES]     = &&do_OP_DRAW_INSTANCES,
+      [OP_PAINT_LINEAR]       = &&do_OP_PAINT_LINEAR,
+      [OP_PAINT_BOX]          = &&do_OP_PAINT_BOX,
+      [OP_PAINT_RADIAL]       = &&do_OP_PAINT_RADIAL,
+      [OP_PAINT_IMAGE]        = &&do_OP_PAINT_IMAGE,
+      [OP_PAINT_DYNAMIC]      = &&do_OP_PAINT_DYNAMIC,
+      [OP_STROKE_WIDTH]       = &&do_OP_STROKE_WIDTH,
+      [OP_STROKE_COLOR]       = &&do_OP_STROKE_COLOR,
+      [OP_STROKE_PAINT]       = &&do_OP_STROKE_PAINT,
+      [OP_FILL_COLOR]         = &&do_OP_FILL_COLOR,
+      [OP_FILL_PAINT]         = &&do_OP_FILL_PAINT,
+      [OP_MITER_LIMIT]        = &&do_OP_MITER_LIMIT,
+      [OP_LINE_CAP]           = &&do_OP_LINE_CAP,
+      [OP_LINE_JOIN]          = &&do_OP_LINE_JOIN,
+      [OP_GLOBAL_ALPHA]       = &&do_OP_GLOBAL_ALPHA,
+      [OP_SCISSOR]            = &&do_OP_SCISSOR,
+      [OP_INTERSECT_SCISSOR]  = &&do_OP_INTERSECT_SCISSOR,
+      [OP_RESET_SCISSOR]      = &&do_OP_RESET_SCISSOR,
+      [OP_PATH_BEGIN]         = &&do_OP_PATH_BEGIN,
+      [OP_PATH_MOVE_TO]       = &&do_OP_PATH_MOVE_TO,
+      [OP_PATH_LINE_TO]       = &&do_OP_PATH_LINE_TO,
+      [OP_PATH_BEZIER_TO]     = &&do_OP_PATH_BEZIER_TO,
+      [OP_PATH_QUADRATIC_TO]  = &&do_OP_PATH_QUADRATIC_TO,
+      [OP_PATH_ARC_TO]        = &&do_OP_PATH_ARC_TO,
+      [OP_PATH_CLOSE]         = &&do_OP_PATH_CLOSE,
+      [OP_PATH_WINDING]       = &&do_OP_PATH_WINDING,
+      [OP_PATH_POLYLINE]      = &&do_OP_PATH_POLYLINE,
+      [OP_PATH_POLYGON]       = &&do_OP_PATH_POLYGON,
+      [OP_FILL]               = &&do_OP_FILL,
+      [OP_STROKE]             = &&do_OP_STROKE,
+      [OP_TRIANGLE]           = &&do_OP_TRIANGLE,
+      [OP_ARC]                = &&do_OP_ARC,
+      [OP_RECT]               = &&do_OP_RECT,
+      [OP_ROUND_RECT]         = &&do_OP_ROUND_RECT,
+      [OP_ELLIPSE]            = &&do_OP_ELLIPSE,
+      [OP_CIRCLE]             = &&do_OP_CIRCLE,
+      [OP_SECTOR]             = &&do_OP_SECTOR,
+      [OP_TEXT]               = &&do_OP_TEXT,
+      [OP_TX_RESET]           = &&do_OP_TX_RESET,
+      [OP_TX_MATRIX]          = &&do_OP_TX_MATRIX,
+      [OP_TX_TRANSLATE]       = &&do_OP_TX_TRANSLATE,
+      [OP_TX_SCALE]           = &&do_OP_TX_SCALE,
+      [OP_TX_ROTATE]          = &&do_OP_TX_ROTATE,
+      [OP_TX_SKEW_X]          = &&do_OP_TX_SKEW_X,
+      [OP_TX_SKEW_Y]          = &&do_OP_TX_SKEW_Y,
+      [OP_FONT]               = &&do_OP_FONT,
+      [OP_FONT_BLUR]          = &&do_OP_FONT_BLUR,
+      [OP_FONT_SIZE]          = &&do_OP_FONT_SIZE,
+      [OP_TEXT_ALIGN]         = &&do_OP_TEXT_ALIGN,
+      [OP_TEXT_HEIGHT]        = &&do_OP_TEXT_HEIGHT,
+  };
+#pragma GCC diagnostic pop
 
-  // get the first op
-  GLuint op = *(GLuint*) p_script;
+  // while profiling, every op goes through the counter on its way to the
+  // real handler. Otherwise the handlers jump straight to each other.
+  static void* const profiled[PROFILE_OPS] = {
+      [0 ... PROFILE_OPS - 1] = &&profile,
+  };
+  void* const* p_dispatch = profiling ? profiled : dispatch;
 
   // loop though the script, running each command in turn.
   // recurse into more script calls if necessary
-  while (op != OP_TERMINATE)
-  {
+  NEXT_OP();
 
-    // advance the pointer past the op code
-    p_script = (void *)((char *)p_script + sizeof(GLuint));
+profile:
+  profile_open(op);
+  goto* dispatch[op];
+
+  {
+#else
+  // loop though the script, running each command in turn.
+  // recurse into more script calls if necessary
+  while (true)
+  {
+    op       = *(GLuint*) p_script;
+    p_script = (void*) ((char*) p_script + sizeof(GLuint));
+    if (profiling)
+      profile_open(op);
 
-    // take the appropriate action based on the command id
     switch (op)
     {
+#endif
       // state control
-      case OP_PUSH_STATE:
+      OP_CASE(OP_PUSH_STATE)
         nvgSave(p_ctx);
-        break;
-      case OP_POP_STATE:
+        NEXT_OP();
+      OP_CASE(OP_POP_STATE)
         nvgRestore(p_ctx);
-        break;
-      case OP_RESET_STATE:
+        NEXT_OP();
+      OP_CASE(OP_RESET_STATE)
         nvgReset(p_ctx);
-        break;
+        NEXT_OP();
 
       // script control
-      case OP_RUN_SCRIPT:
-        p_script = internal_run_script(p_script, p_data);
-        break;
+      OP_CASE(OP_RUN_SCRIPT)
+        p_script = internal_run_script(p_script, p_data, &retain, &drawn);
+        NEXT_OP();
+      OP_CASE(OP_DRAW_INSTANCES)
+        p_script = internal_draw_instances(p_script, p_data, &retain);
+        NEXT_OP();
 
       // render styles
-      case OP_PAINT_LINEAR:
+      OP_CASE(OP_PAINT_LINEAR)
         p_script = paint_linear(p_ctx, p_script);
-        break;
-      case OP_PAINT_BOX:
+        NEXT_OP();
+      OP_CASE(OP_PAINT_BOX)
         p_script = paint_box(p_ctx, p_script);
-        break;
-      case OP_PAINT_RADIAL:
+        NEXT_OP();
+      OP_CASE(OP_PAINT_RADIAL)
         p_script = paint_radial(p_ctx, p_script);
-        break;
-      case OP_PAINT_IMAGE:
+        NEXT_OP();
+      OP_CASE(OP_PAINT_IMAGE)
         p_script = paint_image(p_ctx, p_script, p_data);
-        break;
-      case OP_PAINT_DYNAMIC:
+        NEXT_OP();
+      OP_CASE(OP_PAINT_DYNAMIC)
         p_script = paint_dynamic(p_ctx, p_script, p_data);
-        break;
-
-      // case OP_ANTI_ALIAS:
-      //   p_script = shape_anti_alias(p_ctx, p_script);
-      //   break;
+        NEXT_OP();
 
-      case OP_STROKE_WIDTH:
+      OP_CASE(OP_STROKE_WIDTH)
         p_script = shape_width(p_ctx, p_script);
-        break;
-      case OP_STROKE_COLOR:
+        NEXT_OP();
+      OP_CASE(OP_STROKE_COLOR)
         p_script = stroke_color(p_ctx, p_script);
-        break;
-      case OP_STROKE_PAINT:
+        NEXT_OP();
+      OP_CASE(OP_STROKE_PAINT)
         nvgStrokePaint(p_ctx, current_paint);
-        break;
+        NEXT_OP();
 
-      case OP_FILL_COLOR:
+      OP_CASE(OP_FILL_COLOR)
         p_script = fill_color(p_ctx, p_script);
-        break;
-      case OP_FILL_PAINT:
+        NEXT_OP();
+      OP_CASE(OP_FILL_PAINT)
         nvgFillPaint(p_ctx, current_paint);
-        break;
+        NEXT_OP();
 
-      case OP_MITER_LIMIT:
+      OP_CASE(OP_MITER_LIMIT)
         p_script = miter_limit(p_ctx, p_script);
-        break;
-      case OP_LINE_CAP:
+        NEXT_OP();
+      OP_CASE(OP_LINE_CAP)
         p_script = line_cap(p_ctx, p_script);
-        break;
-      case OP_LINE_JOIN:
+        NEXT_OP();
+      OP_CASE(OP_LINE_JOIN)
         p_script = line_join(p_ctx, p_script);
-        break;
-      case OP_GLOBAL_ALPHA:
+        NEXT_OP();
+      OP_CASE(OP_GLOBAL_ALPHA)
         p_script = global_alpha(p_ctx, p_script);
-        break;
+        NEXT_OP();
 
       // scissoring
-      case OP_SCISSOR:
+      OP_CASE(OP_SCISSOR)
         p_script = scissor(p_ctx, p_script);
-        break;
-      case OP_INTERSECT_SCISSOR:
+        NEXT_OP();
+      OP_CASE(OP_INTERSECT_SCISSOR)
         p_script = intersect_scissor(p_ctx, p_script);
-        break;
-      case OP_RESET_SCISSOR:
+        NEXT_OP();
+      OP_CASE(OP_RESET_SCISSOR)
         nvgResetScissor(p_ctx);
-        break;
+        NEXT_OP();
 
       // path operations
-      case OP_PATH_BEGIN:
+      OP_CASE(OP_PATH_BEGIN)
         nvgBeginPath(p_ctx);
-        break;
+        NEXT_OP();
 
-      case OP_PATH_MOVE_TO:
+      OP_CASE(OP_PATH_MOVE_TO)
         p_script = move_to(p_ctx, p_script);
-        break;
-      case OP_PATH_LINE_TO:
+        NEXT_OP();
+      OP_CASE(OP_PATH_LINE_TO)
         p_script = line_to(p_ctx, p_script);
-        break;
-      case OP_PATH_BEZIER_TO:
+        NEXT_OP();
+      OP_CASE(OP_PATH_BEZIER_TO)
         p_script = bezier_to(p_ctx, p_script);
-        break;
-      case OP_PATH_QUADRATIC_TO:
+        NEXT_OP();
+      OP_CASE(OP_PATH_QUADRATIC_TO)
         p_script = quadratic_to(p_ctx, p_script);
-        break;
-      case OP_PATH_ARC_TO:
+        NEXT_OP();
+      OP_CASE(OP_PATH_ARC_TO)
         p_script = arc_to(p_ctx, p_script);
-        break;
-      case OP_PATH_CLOSE:
+        NEXT_OP();
+      OP_CASE(OP_PATH_CLOSE)
         nvgClosePath(p_ctx);
-        break;
-      case OP_PATH_WINDING:
+        NEXT_OP();
+      OP_CASE(OP_PATH_WINDING)
         p_script = path_winding(p_ctx, p_script);
-        break;
-
-      case OP_FILL:
-        nvgFill(p_ctx);
-        break;
-      case OP_STROKE:
-        nvgStroke(p_ctx);
-        break;
-
-      case OP_TRIANGLE:
+        NEXT_OP();
+      OP_CASE(OP_PATH_POLYLINE)
+        p_script = polyline(p_ctx, p_script, 0);
+        NEXT_OP();
+      OP_CASE(OP_PATH_POLYGON)
+        p_script = polyline(p_ctx, p_script, 1);
+        NEXT_OP();
+
+      OP_CASE(OP_FILL)
+        if (!hidden)
+          nvgFill(p_ctx);
+        NEXT_OP();
+      OP_CASE(OP_STROKE)
+        if (!hidden)
+          nvgStroke(p_ctx);
+        NEXT_OP();
+
+      OP_CASE(OP_TRIANGLE)
         p_script = triangle(p_ctx, p_script);
-        break;
-      case OP_ARC:
-        p_script = arc(p_ctx, p_script);
-        break;
-      case OP_RECT:
+        NEXT_OP();
+      OP_CASE(OP_ARC)
+        p_script = arc(p_ctx, p_script, p_data);
+        NEXT_OP();
+      OP_CASE(OP_RECT)
         p_script = rect(p_ctx, p_script);
-        break;
-      case OP_ROUND_RECT:
+        NEXT_OP();
+      OP_CASE(OP_ROUND_RECT)
         p_script = round_rect(p_ctx, p_script);
-        break;
-      case OP_ROUND_RECT_VAR:
-        break;
-      case OP_ELLIPSE:
+        NEXT_OP();
+      OP_CASE(OP_ELLIPSE)
         p_script = ellipse(p_ctx, p_script);
-        break;
-      case OP_CIRCLE:
+        NEXT_OP();
+      OP_CASE(OP_CIRCLE)
         p_script = circle(p_ctx, p_script);
-        break;
-      case OP_SECTOR:
-        p_script = sector(p_ctx, p_script);
-        break;
-      case OP_TEXT:
-        p_script = text(p_ctx, p_script);
-        break;
+        NEXT_OP();
+      OP_CASE(OP_SECTOR)
+        p_script = sector(p_ctx, p_script, p_data);
+        NEXT_OP();
+      OP_CASE(OP_TEXT)
+        p_script = hidden ? skip_text(p_script) : text(p_ctx, p_script);
+        NEXT_OP();
 
       // transform operations
-      case OP_TX_RESET:
+      OP_CASE(OP_TX_RESET)
         nvgResetTransform(p_ctx);
-        break;
-      case OP_TX_IDENTITY:
-        break;
-      case OP_TX_MATRIX:
+        NEXT_OP();
+      OP_CASE(OP_TX_MATRIX)
         p_script = tx_matrix(p_ctx, p_script);
-        break;
-      case OP_TX_TRANSLATE:
+        NEXT_OP();
+      OP_CASE(OP_TX_TRANSLATE)
         p_script = tx_translate(p_ctx, p_script);
-        break;
-      case OP_TX_SCALE:
+        NEXT_OP();
+      OP_CASE(OP_TX_SCALE)
         p_script = tx_scale(p_ctx, p_script);
-        break;
-      case OP_TX_ROTATE:
+        NEXT_OP();
+      OP_CASE(OP_TX_ROTATE)
         p_script = tx_rotate(p_ctx, p_script);
-        break;
-      case OP_TX_SKEW_X:
+        NEXT_OP();
+      OP_CASE(OP_TX_SKEW_X)
         p_script = tx_skew_x(p_ctx, p_script);
-        break;
-      case OP_TX_SKEW_Y:
+        NEXT_OP();
+      OP_CASE(OP_TX_SKEW_Y)
         p_script = tx_skew_y(p_ctx, p_script);
-        break;
+        NEXT_OP();
 
       // font styles
-      case OP_FONT:
+      OP_CASE(OP_FONT)
         p_script = font(p_ctx, p_script);
-        break;
-      case OP_FONT_BLUR:
+        NEXT_OP();
+      OP_CASE(OP_FONT_BLUR)
         p_script = font_blur(p_ctx, p_script);
-        break;
-      case OP_FONT_SIZE:
+        NEXT_OP();
+      OP_CASE(OP_FONT_SIZE)
         p_script = font_size(p_ctx, p_script);
-        break;
-      case OP_TEXT_ALIGN:
+        NEXT_OP();
+      OP_CASE(OP_TEXT_ALIGN)
         p_script = text_align(p_ctx, p_script);
-        break;
-      case OP_TEXT_HEIGHT:
+        NEXT_OP();
+      OP_CASE(OP_TEXT_HEIGHT)
         p_script = text_height(p_ctx, p_script);
-        break;
-
-      case OP_TERMINATE:
-        return;
+        NEXT_OP();
 
+#ifndef DIRECT_THREADED
+      // OP_TERMINATE. decoding only keeps the ops above
       default:
-        sprintf(buff, "!!!Unknown script command: %d", op);
-        send_puts(buff);
-        return;
+        goto done;
     }
-
-    // prep the next op code
-    op = *(GLuint*) p_script;
+#endif
   }
+
+done:
+  finish_retain(&retain, p_data, p_entry, &current_paint, draw_misses);
+  if (caching)
+    finish_cache(p_data, p_entry, &current_paint, draw_misses);
+  finish_drawn(&drawn, p_data, p_entry);
+
+  // the last op of the frame stops its clock when the root script ends
+  if (--depth == 0 && profiling)
+    profile_close(glfwGetTimerValue());
 }
@@ -9,13 +9,41 @@ functions to play a compiled render script
 #ifndef _RENDER_SCRIPTS_H
 #define _RENDER_SCRIPTS_H
 
+#include "comms.h"
 #include "types.h"
 
-void put_script(window_data_t* p_data, GLuint id, void* p_script);
+void put_script(window_data_t* p_data, GLuint id, void* p_script,
+                uint32_t size, uint32_t tag);
+void refresh_script(window_data_t* p_data, GLuint id);
 void* get_script(window_data_t* p_data, GLuint id);
+script_t* get_script_entry(window_data_t* p_data, GLuint id);
 void delete_script(window_data_t* p_data, GLuint id);
 void delete_all(window_data_t* p_data);
 
 void run_script(GLuint script_id, window_data_t* p_data);
+void run_instances(window_data_t* p_data, const void* p_instances);
+
+void set_culling(bool on);
+uint32_t get_skipped_scripts();
+uint32_t get_drawn_scripts();
+
+void set_optimizing(bool on);
+uint32_t get_ops_received();
+uint32_t get_ops_kept();
+
+// op profile. ops fit in a byte, times are in glfw timer ticks
+#define PROFILE_OPS 256
+#define PROFILE_BUCKETS 32
+
+typedef struct op_profile_t
+{
+  uint64_t count;
+  uint64_t ticks;
+} op_profile_t;
+
+void set_script_profiling(bool on);
+bool script_profiling();
+const op_profile_t* get_op_profile();
+const uint64_t* get_tick_histogram();
 
 #endif
\ No newline at end of file
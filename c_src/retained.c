@@ -0,0 +1,332 @@
+/*
+Retained drawing. What a script draws is kept so it can be drawn again
+without running the script, as long as it would come out the same.
+
+A script's drawing is kept in parts, split where it runs other scripts, or
+draws instances of one. The scripts it runs are not kept with it. They are
+run again each time, and may replay their own drawing, so changing one of
+them doesn't throw away the drawing of every script that uses it.
+
+Drawing is only reused when the state coming in is the same as when it was
+recorded, or the same moved by a translation, and the textures, text atlas
+and pixel ratio haven't changed since. The state the script leaves behind is
+kept too and put back after a replay. The script can't leave the state stack
+deeper or shallower than it found it, and can't have missed a texture or font
+while it was recorded.
+
+Everything here runs on the main thread.
+*/
+
+#include "retained.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "render_script.h"
+
+// big enough for nanovg's state
+#define RETAINED_STATE_SIZE 512
+
+typedef struct
+{
+  NVGLrecording* p_drawn;
+  bool           has_child;
+  GLuint         child_id;
+  const void*    p_instances; // in the script's decoded ops, which outlast this
+  int            depth;
+  NVGpaint       paint;
+  void*          p_state;
+} retained_part_t;
+
+typedef struct
+{
+  uint32_t         tx_generation;
+  int              atlas_generation;
+  float            ratio;
+  int              depth;
+  NVGpaint         paint_in;
+  NVGpaint         paint_out;
+  void*            p_state_in;
+  void*            p_state_out;
+  bool             ok;
+  uint32_t         size;
+  int              part_count;
+  int              part_space;
+  retained_part_t* p_parts;
+} retained_t;
+
+static bool     retained = true;
+static uint32_t hits     = 0;
+static uint32_t records  = 0;
+static uint32_t bytes    = 0;
+
+// scratch. never held across a run_script
+static byte state_now[RETAINED_STATE_SIZE];
+
+//---------------------------------------------------------
+void set_retained(bool on)
+{
+  retained = on && nvgStateSize() <= RETAINED_STATE_SIZE;
+}
+
+uint32_t get_retained_hits()
+{
+  return hits;
+}
+
+uint32_t get_retained_records()
+{
+  return records;
+}
+
+uint32_t get_retained_bytes()
+{
+  return bytes;
+}
+
+//---------------------------------------------------------
+static void destroy(retained_t* p_retained)
+{
+  for (int i = 0; i < p_retained->part_count; i++)
+  {
+    nvglDeleteRecording(p_retained->p_parts[i].p_drawn);
+    free(p_retained->p_parts[i].p_state);
+  }
+  free(p_retained->p_parts);
+  free(p_retained->p_state_in);
+  free(p_retained->p_state_out);
+  free(p_retained);
+}
+
+void free_retained(void* p_retained)
+{
+  if (p_retained == NULL)
+    return;
+  bytes -= ((retained_t*) p_retained)->size;
+  destroy(p_retained);
+}
+
+//---------------------------------------------------------
+// close off what was drawn since the mark as a new part
+static retained_part_t* add_part(retained_t* p_retained, NVGcontext* p_ctx,
+                                 NVGLmark* p_mark)
+{
+  if (p_retained->part_count == p_retained->part_space)
+  {
+    int              space   = p_retained->part_space * 2 + 2;
+    retained_part_t* p_parts = realloc(p_retained->p_parts,
+                                       sizeof(retained_part_t) * space);
+    if (p_parts == NULL)
+    {
+      p_retained->ok = false;
+      return NULL;
+    }
+    p_retained->p_parts    = p_parts;
+    p_retained->part_space = space;
+  }
+
+  NVGLrecording* p_drawn;
+  if (!nvglRecord(p_ctx, p_mark, &p_drawn))
+  {
+    p_retained->ok = false;
+    return NULL;
+  }
+
+  retained_part_t* p_part = &p_retained->p_parts[p_retained->part_count++];
+  memset(p_part, 0, sizeof(retained_part_t));
+  p_part->p_drawn = p_drawn;
+  p_retained->size += sizeof(retained_part_t) + nvglRecordingSize(p_drawn);
+  return p_part;
+}
+
+//=============================================================================
+// replaying
+
+//---------------------------------------------------------
+// draws what the script drew last time, if it would come out the same.
+// returns false if the script needs to be run
+bool replay_script(window_data_t* p_data, script_t* p_entry,
+                   NVGpaint* p_paint)
+{
+  retained_t* p_retained = p_entry->p_retained;
+  if (!retained || p_retained == NULL)
+    return false;
+
+  NVGcontext* p_ctx = p_data->context.p_ctx;
+  if (p_retained->tx_generation != p_data->tx_generation ||
+      p_retained->atlas_generation != nvgTextAtlasGeneration(p_ctx) ||
+      p_retained->ratio != p_data->context.frame_ratio.x ||
+      memcmp(&p_retained->paint_in, p_paint, sizeof(NVGpaint)) != 0)
+    return false;
+
+  float dx, dy;
+  nvgGetState(p_ctx, state_now);
+  if (!nvgStateMoved(p_retained->p_state_in, state_now, &dx, &dy))
+    return false;
+
+  hits++;
+  for (int i = 0; i < p_retained->part_count; i++)
+  {
+    retained_part_t* p_part = &p_retained->p_parts[i];
+    if (p_part->p_drawn != NULL)
+      nvglReplay(p_ctx, p_part->p_drawn, dx, dy);
+
+    // the scripts it ran are run again, in the state they ran in before
+    if (p_part->has_child)
+    {
+      nvgSave(p_ctx);
+      memcpy(state_now, p_part->p_state, nvgStateSize());
+      nvgTranslateState(state_now, dx, dy);
+      nvgSetState(p_ctx, state_now);
+      *p_paint = p_part->paint;
+      if (p_part->p_instances != NULL)
+        run_instances(p_data, p_part->p_instances);
+      else
+        run_script(p_part->child_id, p_data);
+      nvgRestore(p_ctx);
+    }
+  }
+
+  // leave things the way running it would have
+  memcpy(state_now, p_retained->p_state_out, nvgStateSize());
+  nvgTranslateState(state_now, dx, dy);
+  nvgSetState(p_ctx, state_now);
+  *p_paint = p_retained->paint_out;
+
+  return true;
+}
+
+//=============================================================================
+// recording
+
+//---------------------------------------------------------
+void start_retain(retain_t* p_retain, window_data_t* p_data,
+                  NVGpaint* p_paint, uint32_t misses)
+{
+  p_retain->p_retained = NULL;
+  if (!retained)
+    return;
+
+  NVGcontext* p_ctx      = p_data->context.p_ctx;
+  retained_t* p_retained = calloc(1, sizeof(retained_t));
+  if (p_retained == NULL)
+    return;
+  p_retained->p_state_in  = malloc(nvgStateSize());
+  p_retained->p_state_out = malloc(nvgStateSize());
+  if (p_retained->p_state_in == NULL || p_retained->p_state_out == NULL)
+  {
+    destroy(p_retained);
+    return;
+  }
+
+  p_retained->tx_generation    = p_data->tx_generation;
+  p_retained->atlas_generation = nvgTextAtlasGeneration(p_ctx);
+  p_retained->ratio            = p_data->context.frame_ratio.x;
+  p_retained->depth            = nvgStateDepth(p_ctx);
+  p_retained->paint_in         = *p_paint;
+  p_retained->ok               = true;
+  p_retained->size             = sizeof(retained_t) + nvgStateSize() * 2;
+  nvgGetState(p_ctx, p_retained->p_state_in);
+
+  p_retain->p_retained = p_retained;
+  p_retain->misses     = misses;
+  nvglMark(p_ctx, &p_retain->mark);
+}
+
+//---------------------------------------------------------
+// the script is about to run another one
+static retained_part_t* add_child(retain_t* p_retain, window_data_t* p_data,
+                                  GLuint id, NVGpaint* p_paint)
+{
+  retained_t* p_retained = p_retain->p_retained;
+  if (p_retained == NULL || !p_retained->ok)
+    return NULL;
+
+  NVGcontext*      p_ctx  = p_data->context.p_ctx;
+  retained_part_t* p_part = add_part(p_retained, p_ctx, &p_retain->mark);
+  if (p_part == NULL)
+    return NULL;
+
+  p_part->p_state = malloc(nvgStateSize());
+  if (p_part->p_state == NULL)
+  {
+    p_retained->ok = false;
+    return NULL;
+  }
+  nvgGetState(p_ctx, p_part->p_state);
+  p_part->has_child = true;
+  p_part->child_id  = id;
+  p_part->depth     = nvgStateDepth(p_ctx);
+  p_part->paint     = *p_paint;
+  p_retained->size += nvgStateSize();
+  return p_part;
+}
+
+void retain_child(retain_t* p_retain, window_data_t* p_data, GLuint id,
+                  NVGpaint* p_paint)
+{
+  add_child(p_retain, p_data, id, p_paint);
+}
+
+// or is about to draw instances of one. p_instances is the op's decoded data
+void retain_instances(retain_t* p_retain, window_data_t* p_data,
+                      const void* p_instances, NVGpaint* p_paint)
+{
+  retained_part_t* p_part = add_child(p_retain, p_data,
+                                      *(const GLuint*) p_instances, p_paint);
+  if (p_part != NULL)
+    p_part->p_instances = p_instances;
+}
+
+//---------------------------------------------------------
+// the other script is done. what it drew and missed isn't this one's. if it
+// left the state changed, what this one draws next depends on it, so this one
+// can't be kept
+void retain_child_done(retain_t* p_retain, window_data_t* p_data,
+                       NVGpaint* p_paint, uint32_t child_misses)
+{
+  retained_t* p_retained = p_retain->p_retained;
+  if (p_retained == NULL)
+    return;
+
+  NVGcontext* p_ctx = p_data->context.p_ctx;
+  nvglMark(p_ctx, &p_retain->mark);
+  p_retain->misses += child_misses;
+  if (!p_retained->ok)
+    return;
+
+  retained_part_t* p_part = &p_retained->p_parts[p_retained->part_count - 1];
+  nvgGetState(p_ctx, state_now);
+  if (nvgStateDepth(p_ctx) != p_part->depth ||
+      memcmp(state_now, p_part->p_state, nvgStateSize()) != 0 ||
+      memcmp(&p_part->paint, p_paint, sizeof(NVGpaint)) != 0)
+    p_retained->ok = false;
+}
+
+//---------------------------------------------------------
+// keep the drawing if it can be used again
+void finish_retain(retain_t* p_retain, window_data_t* p_data,
+                   script_t* p_entry, NVGpaint* p_paint, uint32_t misses)
+{
+  retained_t* p_retained = p_retain->p_retained;
+  if (p_retained == NULL)
+    return;
+
+  NVGcontext* p_ctx = p_data->context.p_ctx;
+  if (p_retained->ok)
+    add_part(p_retained, p_ctx, &p_retain->mark);
+
+  if (!p_retained->ok || misses != p_retain->misses ||
+      nvgStateDepth(p_ctx) != p_retained->depth)
+  {
+    destroy(p_retained);
+    return;
+  }
+
+  nvgGetState(p_ctx, p_retained->p_state_out);
+  p_retained->paint_out = *p_paint;
+  free_retained(p_entry->p_retained);
+  p_entry->p_retained = p_retained;
+  bytes += p_retained->size;
+  records++;
+}
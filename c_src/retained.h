@@ -0,0 +1,45 @@
+/*
+Retained drawing. What a script draws is kept so it can be drawn again
+without running the script, as long as it would come out the same.
+*/
+
+#ifndef _RETAINED_H
+#define _RETAINED_H
+
+#include "comms.h"
+#include "types.h"
+
+#ifndef NANOVG_GL_H
+#include "nanovg/nanovg_gl.h"
+#endif
+
+// the state of a script that is being recorded as it runs. Lives on the
+// stack of run_script
+typedef struct
+{
+  void*    p_retained;
+  NVGLmark mark;
+  uint32_t misses;
+} retain_t;
+
+void set_retained(bool on);
+void free_retained(void* p_retained);
+
+bool replay_script(window_data_t* p_data, script_t* p_entry,
+                   NVGpaint* p_paint);
+void start_retain(retain_t* p_retain, window_data_t* p_data,
+                  NVGpaint* p_paint, uint32_t misses);
+void retain_child(retain_t* p_retain, window_data_t* p_data, GLuint id,
+                  NVGpaint* p_paint);
+void retain_instances(retain_t* p_retain, window_data_t* p_data,
+                      const void* p_instances, NVGpaint* p_paint);
+void retain_child_done(retain_t* p_retain, window_data_t* p_data,
+                       NVGpaint* p_paint, uint32_t child_misses);
+void finish_retain(retain_t* p_retain, window_data_t* p_data,
+                   script_t* p_entry, NVGpaint* p_paint, uint32_t misses);
+
+uint32_t get_retained_hits();
+uint32_t get_retained_records();
+uint32_t get_retained_bytes();
+
+#endif
@@ -0,0 +1,564 @@
+/*
+Scripts cached as textures. A script that other scripts run, and that has
+stayed the same for CACHE_STABLE_FRAMES frames, is drawn once into a texture
+of its own. From then on it is drawn as one textured rectangle instead of
+being run, and that covers everything the scripts it runs draw too.
+
+The texture is only used while the state coming in is the same as when it
+was cached, or the same moved by whole pixels, and neither the script, the
+scripts it ran, the textures nor the pixel ratio have changed. Otherwise the
+texture is dropped and the script has to be stable again to get a new one.
+Scripts that leave the state changed, or missed a texture or font, aren't
+cached.
+
+A script is cached from the GPU calls it makes in a frame. They are drawn
+into the texture after that frame is done. Textures count against a budget
+of GPU memory, and the ones used longest ago make room for new ones.
+
+What nanovg draws in a frame is only sent to the GPU at the end of it, so a
+texture dropped during a frame is deleted after the frame is done. A texture
+that another instance of the script drew from this frame or the last is kept
+when it doesn't fit where the script is run now.
+
+Everything here runs on the main thread.
+*/
+
+#include "script_cache.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NANOVG_GL2
+#include "nanovg/nanovg_gl.h"
+
+#include "damage.h"
+#include "script_table.h"
+
+// how long a script stays the same before it is cached
+#define CACHE_STABLE_FRAMES 8
+
+// transparent pixels around the drawing, so the edges of the rectangle it is
+// drawn with don't touch it
+#define CACHE_MARGIN 2
+
+// big enough for nanovg's state
+#define CACHE_STATE_SIZE 512
+
+// a script the cached one ran, and when it last changed
+typedef struct
+{
+  GLuint   id;
+  uint32_t changed_frame;
+} cached_script_t;
+
+typedef struct
+{
+  script_t*        p_entry;
+  int              image;
+  NVGLrecording*   p_drawn;
+  float            bounds[4];
+  int              width;
+  int              height;
+  float            ratio;
+  uint32_t         tx_generation;
+  int              atlas_generation;
+  NVGpaint         paint_in;
+  byte             state_in[CACHE_STATE_SIZE];
+  bool             shown;
+  float            shown_at[4];
+  uint32_t         last_used;
+  int              script_count;
+  cached_script_t* p_scripts;
+} cached_t;
+
+static NVGcontext* p_ctx  = NULL;
+static uint32_t    budget = 0;
+static uint32_t    hits   = 0;
+static uint32_t    misses = 0;
+static uint32_t    bytes  = 0;
+
+// every cached script, to find the ones to drop when over budget
+static cached_t** pp_cached    = NULL;
+static int        cached_count = 0;
+static int        cached_space = 0;
+
+// the script being cached as it runs. Only one at a time
+static struct
+{
+  bool             on;
+  NVGLmark         mark;
+  uint32_t         misses;
+  int              depth;
+  int              atlas_generation;
+  NVGpaint         paint_in;
+  byte             state_in[CACHE_STATE_SIZE];
+  int              script_count;
+  int              script_space;
+  cached_script_t* p_scripts;
+} recording = {0};
+
+// what the textures are drawn with. The stencil is shared and grows to fit
+static GLuint fbo            = 0;
+static GLuint stencil        = 0;
+static int    stencil_width  = 0;
+static int    stencil_height = 0;
+
+// textures dropped since the last frame was done
+static int* p_dropped     = NULL;
+static int  dropped_count = 0;
+static int  dropped_space = 0;
+
+// scratch
+static byte state_now[CACHE_STATE_SIZE];
+
+//---------------------------------------------------------
+// 0 bytes turns caching off. So does a GL without framebuffer objects
+void set_cache_budget(window_data_t* p_data, uint32_t bytes)
+{
+  p_ctx  = p_data->context.p_ctx;
+  budget = bytes;
+  if (!p_data->context.glew_ok ||
+      !(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object) ||
+      nvgStateSize() > CACHE_STATE_SIZE)
+    budget = 0;
+}
+
+uint32_t get_cache_hits()
+{
+  return hits;
+}
+
+uint32_t get_cache_misses()
+{
+  return misses;
+}
+
+uint32_t get_cache_bytes()
+{
+  return bytes;
+}
+
+// true while a script is being cached. What it runs goes in its texture, so
+// has to be drawn whether it shows in the window or not
+bool cache_recording()
+{
+  return recording.on;
+}
+
+//---------------------------------------------------------
+// the frame may still draw from the image, so delete it once it is done
+static void drop_image(int image)
+{
+  if (dropped_count == dropped_space)
+  {
+    int  space = dropped_space * 2 + 16;
+    int* p     = realloc(p_dropped, sizeof(int) * space);
+    if (p == NULL)
+    {
+      nvgDeleteImage(p_ctx, image);
+      return;
+    }
+    p_dropped     = p;
+    dropped_space = space;
+  }
+  p_dropped[dropped_count++] = image;
+}
+
+static void delete_dropped()
+{
+  for (int i = 0; i < dropped_count; i++)
+    nvgDeleteImage(p_ctx, p_dropped[i]);
+  dropped_count = 0;
+}
+
+//---------------------------------------------------------
+// drop a script's texture. Where it was shown needs drawing again
+void free_cached(script_t* p_entry)
+{
+  cached_t* p_cached = p_entry->p_cached;
+  if (p_cached == NULL)
+    return;
+
+  for (int i = 0; i < cached_count; i++)
+  {
+    if (pp_cached[i] == p_cached)
+    {
+      pp_cached[i] = pp_cached[--cached_count];
+      break;
+    }
+  }
+
+  if (p_cached->shown)
+    damage_bounds(p_cached->shown_at);
+  if (p_cached->image != 0)
+    drop_image(p_cached->image);
+  nvglDeleteRecording(p_cached->p_drawn);
+  bytes -= p_cached->width * p_cached->height * 4;
+  free(p_cached->p_scripts);
+  free(p_cached);
+  p_entry->p_cached    = NULL;
+  p_entry->cache_frame = current_frame();
+}
+
+//---------------------------------------------------------
+// the texture can only be used if none of the scripts that were drawn into
+// it have changed since
+static bool scripts_same(window_data_t* p_data, cached_t* p_cached)
+{
+  for (int i = 0; i < p_cached->script_count; i++)
+  {
+    cached_script_t* p_script = &p_cached->p_scripts[i];
+    script_t* p_entry = find_script_slot(&p_data->scripts, p_script->id);
+    uint32_t  changed = p_entry != NULL ? p_entry->changed_frame : 0;
+    if (changed != p_script->changed_frame)
+      return false;
+  }
+  return true;
+}
+
+//=============================================================================
+// drawing from the cache
+
+//---------------------------------------------------------
+// draws the script from its texture if it would come out the same. Drops the
+// texture if it never will, or if nothing has drawn from it lately. returns
+// false if the script needs to be run
+bool draw_cached(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint)
+{
+  cached_t* p_cached = p_entry->p_cached;
+  if (p_cached == NULL || p_cached->image == 0)
+    return false;
+
+  float rx = p_data->context.frame_ratio.x;
+  float ry = p_data->context.frame_ratio.y;
+  if (p_cached->tx_generation != p_data->tx_generation ||
+      p_cached->ratio != rx || !scripts_same(p_data, p_cached))
+  {
+    misses++;
+    free_cached(p_entry);
+    return false;
+  }
+
+  // only right for where it was cached, or there moved by whole pixels
+  float    dx, dy;
+  uint32_t frame = current_frame();
+  nvgGetState(p_ctx, state_now);
+  if (memcmp(&p_cached->paint_in, p_paint, sizeof(NVGpaint)) != 0 ||
+      !nvgStateMoved(p_cached->state_in, state_now, &dx, &dy) ||
+      fabsf(dx * rx - roundf(dx * rx)) > 1e-3f ||
+      fabsf(dy * ry - roundf(dy * ry)) > 1e-3f)
+  {
+    misses++;
+    if (p_cached->last_used + 1 < frame)
+      free_cached(p_entry);
+    else if (p_cached->shown && p_cached->last_used != frame)
+    {
+      damage_bounds(p_cached->shown_at);
+      p_cached->shown = false;
+    }
+    return false;
+  }
+  dx = roundf(dx * rx) / rx;
+  dy = roundf(dy * ry) / ry;
+
+  float x = p_cached->bounds[0] + dx;
+  float y = p_cached->bounds[1] + dy;
+  float w = p_cached->bounds[2] - p_cached->bounds[0];
+  float h = p_cached->bounds[3] - p_cached->bounds[1];
+
+  // the alpha and scissor are already in the texture
+  nvgSave(p_ctx);
+  nvgResetTransform(p_ctx);
+  nvgResetScissor(p_ctx);
+  nvgGlobalAlpha(p_ctx, 1.0f);
+  nvgBeginPath(p_ctx);
+  nvgRect(p_ctx, x, y, w, h);
+  nvgFillPaint(p_ctx, nvgImagePattern(p_ctx, x, y, w, h, 0, p_cached->image,
+                                      1.0f));
+  nvgFill(p_ctx);
+  nvgRestore(p_ctx);
+
+  // the first time it is drawn this way, or moved, draw over where it was
+  float at[4] = {x, y, x + w, y + h};
+  if (!p_cached->shown || memcmp(at, p_cached->shown_at, sizeof(at)) != 0)
+  {
+    if (p_cached->shown)
+      damage_bounds(p_cached->shown_at);
+    damage_bounds(at);
+    memcpy(p_cached->shown_at, at, sizeof(at));
+    p_cached->shown = true;
+  }
+
+  p_cached->last_used = frame;
+  hits++;
+  return true;
+}
+
+//=============================================================================
+// caching
+
+//---------------------------------------------------------
+// every script that runs while one is being cached is drawn into it
+void note_cached_script(window_data_t* p_data, GLuint id)
+{
+  if (!recording.on)
+    return;
+
+  if (recording.script_count == recording.script_space)
+  {
+    int              space     = recording.script_space * 2 + 16;
+    cached_script_t* p_scripts = realloc(recording.p_scripts,
+                                         sizeof(cached_script_t) * space);
+    if (p_scripts == NULL)
+    {
+      recording.on = false;
+      return;
+    }
+    recording.p_scripts    = p_scripts;
+    recording.script_space = space;
+  }
+
+  script_t* p_entry = find_script_slot(&p_data->scripts, id);
+  cached_script_t* p_script = &recording.p_scripts[recording.script_count++];
+  p_script->id            = id;
+  p_script->changed_frame = p_entry != NULL ? p_entry->changed_frame : 0;
+}
+
+//---------------------------------------------------------
+// start caching the script as it runs, if it has been the same long enough.
+// returns true if it is being cached
+bool start_cache(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint,
+                 uint32_t draw_misses, int depth)
+{
+  uint32_t frame  = current_frame();
+  uint32_t stable = p_entry->changed_frame > p_entry->cache_frame
+                        ? p_entry->changed_frame
+                        : p_entry->cache_frame;
+  if (budget == 0 || recording.on || depth < 2 || p_entry->p_cached != NULL ||
+      frame < stable + CACHE_STABLE_FRAMES)
+    return false;
+
+  recording.on               = true;
+  recording.misses           = draw_misses;
+  recording.depth            = nvgStateDepth(p_ctx);
+  recording.atlas_generation = nvgTextAtlasGeneration(p_ctx);
+  recording.paint_in         = *p_paint;
+  recording.script_count     = 0;
+  nvgGetState(p_ctx, recording.state_in);
+  nvglMark(p_ctx, &recording.mark);
+  return true;
+}
+
+//---------------------------------------------------------
+// make room under the budget by dropping the textures used longest ago. The
+// ones used this frame stay, or they would only be cached again
+static bool make_room(uint32_t size)
+{
+  if (size > budget)
+    return false;
+  uint32_t frame = current_frame();
+  while (bytes + size > budget)
+  {
+    int oldest = -1;
+    for (int i = 0; i < cached_count; i++)
+    {
+      if (pp_cached[i]->last_used != frame &&
+          (oldest < 0 || pp_cached[i]->last_used < pp_cached[oldest]->last_used))
+        oldest = i;
+    }
+    if (oldest < 0)
+      return false;
+    free_cached(pp_cached[oldest]->p_entry);
+  }
+  return true;
+}
+
+//---------------------------------------------------------
+// keep what the script drew, to be drawn into its texture after the frame
+void finish_cache(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint,
+                  uint32_t draw_misses)
+{
+  if (!recording.on)
+    return;
+  recording.on = false;
+
+  // try again after it has been stable for a while longer
+  p_entry->cache_frame = current_frame();
+
+  nvgGetState(p_ctx, state_now);
+  if (draw_misses != recording.misses ||
+      nvgStateDepth(p_ctx) != recording.depth ||
+      nvgTextAtlasGeneration(p_ctx) != recording.atlas_generation ||
+      memcmp(&recording.paint_in, p_paint, sizeof(NVGpaint)) != 0 ||
+      memcmp(recording.state_in, state_now, nvgStateSize()) != 0)
+    return;
+
+  float drawn[4] = {1e30f, 1e30f, -1e30f, -1e30f};
+  nvglBounds(p_ctx, &recording.mark, drawn);
+  if (drawn[0] > drawn[2] || drawn[1] > drawn[3])
+    return;
+
+  // whole pixels, so the texture lines up with the screen
+  float rx = p_data->context.frame_ratio.x;
+  float ry = p_data->context.frame_ratio.y;
+  int   x0 = (int) floorf(drawn[0] * rx) - CACHE_MARGIN;
+  int   y0 = (int) floorf(drawn[1] * ry) - CACHE_MARGIN;
+  int   x1 = (int) ceilf(drawn[2] * rx) + CACHE_MARGIN;
+  int   y1 = (int) ceilf(drawn[3] * ry) + CACHE_MARGIN;
+  int   w  = x1 - x0;
+  int   h  = y1 - y0;
+  GLint max_size;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  if (w > max_size || h > max_size || !make_room(w * h * 4))
+    return;
+
+  if (cached_count == cached_space)
+  {
+    int        space = cached_space * 2 + 16;
+    cached_t** pp    = realloc(pp_cached, sizeof(cached_t*) * space);
+    if (pp == NULL)
+      return;
+    pp_cached    = pp;
+    cached_space = space;
+  }
+
+  cached_t*        p_cached  = calloc(1, sizeof(cached_t));
+  cached_script_t* p_scripts = malloc(sizeof(cached_script_t) *
+                                      (recording.script_count + 1));
+  NVGLrecording*   p_drawn   = NULL;
+  if (p_cached == NULL || p_scripts == NULL ||
+      !nvglRecord(p_ctx, &recording.mark, &p_drawn) || p_drawn == NULL)
+  {
+    free(p_cached);
+    free(p_scripts);
+    return;
+  }
+
+  p_cached->p_entry          = p_entry;
+  p_cached->p_drawn          = p_drawn;
+  p_cached->bounds[0]        = x0 / rx;
+  p_cached->bounds[1]        = y0 / ry;
+  p_cached->bounds[2]        = x1 / rx;
+  p_cached->bounds[3]        = y1 / ry;
+  p_cached->width            = w;
+  p_cached->height           = h;
+  p_cached->ratio            = rx;
+  p_cached->tx_generation    = p_data->tx_generation;
+  p_cached->atlas_generation = recording.atlas_generation;
+  p_cached->paint_in         = recording.paint_in;
+  p_cached->last_used        = current_frame();
+  p_cached->script_count     = recording.script_count;
+  p_cached->p_scripts        = p_scripts;
+  memcpy(p_cached->state_in, recording.state_in, nvgStateSize());
+  memcpy(p_scripts, recording.p_scripts,
+         sizeof(cached_script_t) * recording.script_count);
+
+  pp_cached[cached_count++] = p_cached;
+  p_entry->p_cached         = p_cached;
+  bytes += w * h * 4;
+}
+
+//=============================================================================
+// textures
+
+//---------------------------------------------------------
+static bool fit_stencil(int width, int height)
+{
+  if (width <= stencil_width && height <= stencil_height)
+    return true;
+
+  if (stencil_width > width)
+    width = stencil_width;
+  if (stencil_height > height)
+    height = stencil_height;
+
+  if (stencil == 0)
+    glGenRenderbuffers(1, &stencil);
+  glBindRenderbuffer(GL_RENDERBUFFER, stencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  stencil_width  = width;
+  stencil_height = height;
+  return true;
+}
+
+//---------------------------------------------------------
+static bool draw_texture(cached_t* p_cached)
+{
+  // glyphs are drawn from the text atlas. It may have been replaced
+  if (p_cached->atlas_generation != nvgTextAtlasGeneration(p_ctx))
+    return false;
+
+  p_cached->image = nvgCreateImageRGBA(
+      p_ctx, p_cached->width, p_cached->height,
+      NVG_IMAGE_PREMULTIPLIED | NVG_IMAGE_FLIPY, NULL);
+  if (p_cached->image == 0)
+    return false;
+
+  fit_stencil(p_cached->width, p_cached->height);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         nvglImageHandleGL2(p_ctx, p_cached->image), 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, stencil);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    return false;
+
+  glViewport(0, 0, p_cached->width, p_cached->height);
+  glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+  // the same calls, moved so the drawing starts at the texture's corner
+  nvgBeginFrame(p_ctx, p_cached->bounds[2] - p_cached->bounds[0],
+                p_cached->bounds[3] - p_cached->bounds[1], p_cached->ratio);
+  bool ok = nvglReplay(p_ctx, p_cached->p_drawn, -p_cached->bounds[0],
+                       -p_cached->bounds[1]);
+  nvgEndFrame(p_ctx);
+  return ok;
+}
+
+//---------------------------------------------------------
+// the frame is done. Draw the scripts cached during it into their textures,
+// and delete the ones dropped
+void draw_caches(window_data_t* p_data)
+{
+  bool    started = false;
+  GLint   viewport[4];
+  GLfloat clear_color[4];
+
+  for (int i = 0; i < cached_count; i++)
+  {
+    cached_t* p_cached = pp_cached[i];
+    if (p_cached->p_drawn == NULL)
+      continue;
+
+    if (!started)
+    {
+      glGetIntegerv(GL_VIEWPORT, viewport);
+      glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+      glClearColor(0, 0, 0, 0);
+      if (fbo == 0)
+        glGenFramebuffers(1, &fbo);
+      started = true;
+    }
+
+    bool ok = draw_texture(p_cached);
+    nvglDeleteRecording(p_cached->p_drawn);
+    p_cached->p_drawn = NULL;
+    if (!ok)
+    {
+      free_cached(p_cached->p_entry);
+      i--;
+    }
+  }
+
+  if (started)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clear_color[0], clear_color[1], clear_color[2],
+                 clear_color[3]);
+  }
+
+  delete_dropped();
+}
@@ -0,0 +1,29 @@
+/*
+Scripts cached as textures. A script that other scripts run, and that has
+stayed the same for a while, is drawn once into a texture and then drawn
+from that.
+*/
+
+#ifndef _SCRIPT_CACHE_H
+#define _SCRIPT_CACHE_H
+
+#include "comms.h"
+#include "types.h"
+
+void set_cache_budget(window_data_t* p_data, uint32_t bytes);
+void free_cached(script_t* p_entry);
+
+void note_cached_script(window_data_t* p_data, GLuint id);
+bool draw_cached(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint);
+bool start_cache(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint,
+                 uint32_t misses, int depth);
+void finish_cache(window_data_t* p_data, script_t* p_entry, NVGpaint* p_paint,
+                  uint32_t misses);
+void draw_caches(window_data_t* p_data);
+bool cache_recording();
+
+uint32_t get_cache_hits();
+uint32_t get_cache_misses();
+uint32_t get_cache_bytes();
+
+#endif
@@ -0,0 +1,88 @@
+/*
+Finding scripts by id. See script_table_t in types.h
+
+Pages are made the first time an id in them is used and kept after that, so
+a table that is reused doesn't churn memory. Everything here runs on the
+main thread.
+*/
+
+#include "script_table.h"
+
+#include <stdlib.h>
+
+#define DIR_INDEX(id) ((id) >> (SCRIPT_DIR_BITS + SCRIPT_PAGE_BITS))
+#define PAGE_INDEX(id) (((id) >> SCRIPT_PAGE_BITS) & (SCRIPT_DIR_SIZE - 1))
+#define SLOT_INDEX(id) ((id) & (SCRIPT_PAGE_SIZE - 1))
+
+//---------------------------------------------------------
+// NULL if nothing was ever put at the id
+script_t* find_script_slot(script_table_t* p_table, uint32_t id)
+{
+  script_t** p_dir = p_table->p_dirs[DIR_INDEX(id)];
+  if (p_dir == NULL)
+    return NULL;
+
+  script_t* p_page = p_dir[PAGE_INDEX(id)];
+  if (p_page == NULL)
+    return NULL;
+
+  return &p_page[SLOT_INDEX(id)];
+}
+
+//---------------------------------------------------------
+// NULL only if out of memory
+script_t* make_script_slot(script_table_t* p_table, uint32_t id)
+{
+  script_t** p_dir = p_table->p_dirs[DIR_INDEX(id)];
+  if (p_dir == NULL)
+  {
+    p_dir = calloc(SCRIPT_DIR_SIZE, sizeof(script_t*));
+    if (p_dir == NULL)
+      return NULL;
+    p_table->p_dirs[DIR_INDEX(id)] = p_dir;
+  }
+
+  script_t* p_page = p_dir[PAGE_INDEX(id)];
+  if (p_page == NULL)
+  {
+    p_page = calloc(SCRIPT_PAGE_SIZE, sizeof(script_t));
+    if (p_page == NULL)
+      return NULL;
+    p_dir[PAGE_INDEX(id)] = p_page;
+  }
+
+  return &p_page[SLOT_INDEX(id)];
+}
+
+//---------------------------------------------------------
+// make the pages for ids below count up front
+void reserve_scripts(script_table_t* p_table, uint32_t count)
+{
+  for (uint32_t id = 0; id < count; id += SCRIPT_PAGE_SIZE)
+  {
+    if (make_script_slot(p_table, id) == NULL)
+      return;
+  }
+}
+
+//---------------------------------------------------------
+// every slot in every page, used or not
+void for_each_script(script_table_t* p_table, void (*fn)(script_t*))
+{
+  for (int d = 0; d < SCRIPT_DIR_SIZE; d++)
+  {
+    script_t** p_dir = p_table->p_dirs[d];
+    if (p_dir == NULL)
+      continue;
+
+    for (int p = 0; p < SCRIPT_DIR_SIZE; p++)
+    {
+      script_t* p_page = p_dir[p];
+      if (p_page == NULL)
+        continue;
+
+      for (int s = 0; s < SCRIPT_PAGE_SIZE; s++)
+        fn(&p_page[s]);
+    }
+  }
+}
@@ -0,0 +1,16 @@
+/*
+Finding scripts by id. See script_table_t in types.h
+*/
+
+#ifndef _SCRIPT_TABLE_H
+#define _SCRIPT_TABLE_H
+
+#include "comms.h"
+#include "types.h"
+
+script_t* find_script_slot(script_table_t* p_table, uint32_t id);
+script_t* make_script_slot(script_table_t* p_table, uint32_t id);
+void reserve_scripts(script_table_t* p_table, uint32_t count);
+void for_each_script(script_table_t* p_table, void (*fn)(script_t*));
+
+#endif
@@ -0,0 +1,227 @@
+/*
+Laid out text. Breaking text into rows and working out where each glyph goes
+is most of the cost of drawing it, and a label is drawn with the same font,
+size and string frame after frame. So each text is laid out once, into quads
+in its own coordinates with their places in the text atlas, and drawn from
+those after that. The transform and fill come from the state it's drawn in,
+so the same layout serves wherever the text is drawn.
+
+A layout is found by everything it depends on, which is the font, size,
+letter spacing, blur, alignment, line height, the scale glyphs are rendered
+at and the string itself. When the atlas is reset, every layout points at
+glyphs that are gone, so they are all thrown away. The ones used least
+recently go first when there are too many.
+
+Text that can't be laid out, because the atlas is full, is drawn the way it
+always was, which grows the atlas.
+
+Everything here runs on the main thread.
+*/
+
+#include "text_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uthash.h"
+
+// text is broken into rows no wider than this
+#define TEXT_ROW_WIDTH    1000
+#define TEXT_CACHE_BYTES  (4 * 1024 * 1024)
+
+typedef struct
+{
+  UT_hash_handle hh;
+  uint32_t       key_size;
+  uint32_t       size;
+  int            count;
+  NVGglyphQuad*  p_quads;
+  byte*          p_key;
+} layout_t;
+
+static layout_t* p_layouts        = NULL;
+static int       atlas_generation = -1;
+static uint32_t  hits             = 0;
+static uint32_t  misses           = 0;
+static uint32_t  bytes            = 0;
+
+// scratch
+static byte*         p_key      = NULL;
+static uint32_t      key_space  = 0;
+static NVGglyphQuad* p_quads    = NULL;
+static uint32_t      quad_space = 0;
+
+//---------------------------------------------------------
+uint32_t get_text_hits()
+{
+  return hits;
+}
+
+uint32_t get_text_misses()
+{
+  return misses;
+}
+
+uint32_t get_text_bytes()
+{
+  return bytes;
+}
+
+//---------------------------------------------------------
+static void drop(layout_t* p_layout)
+{
+  HASH_DEL(p_layouts, p_layout);
+  bytes -= p_layout->size;
+  free(p_layout);
+}
+
+static void drop_all()
+{
+  layout_t* p_layout;
+  layout_t* p_tmp;
+  HASH_ITER(hh, p_layouts, p_layout, p_tmp)
+  {
+    drop(p_layout);
+  }
+}
+
+//---------------------------------------------------------
+static bool grow_scratch(void** pp, uint32_t* p_space, uint32_t size)
+{
+  if (size <= *p_space)
+    return true;
+  void* p = realloc(*pp, size);
+  if (p == NULL)
+    return false;
+  *pp      = p;
+  *p_space = size;
+  return true;
+}
+
+//---------------------------------------------------------
+// the rows, the way nvgText would draw them. false if the atlas is full
+static bool lay_out(NVGcontext* p_ctx, const char* start, const char* end,
+                    int* p_count)
+{
+  // never more glyphs than bytes
+  uint32_t most = end - start;
+  if (!grow_scratch((void**) &p_quads, &quad_space,
+                    sizeof(NVGglyphQuad) * (most + 1)))
+    return false;
+
+  float y = 0;
+  float lineh;
+  nvgTextMetrics(p_ctx, NULL, NULL, &lineh);
+  NVGtextRow rows[3];
+  int        nrows, i;
+  int        count = 0;
+
+  while ((nrows = nvgTextBreakLines(p_ctx, start, end, TEXT_ROW_WIDTH, rows,
+                                    3)))
+  {
+    for (i = 0; i < nrows; i++)
+    {
+      int n = nvgTextGlyphQuads(p_ctx, 0, y, rows[i].start, rows[i].end,
+                                p_quads + count, most - count);
+      if (n < 0)
+        return false;
+      count += n;
+      y += lineh;
+    }
+    start = rows[nrows - 1].next;
+  }
+
+  *p_count = count;
+  return true;
+}
+
+//---------------------------------------------------------
+static void draw_rows(NVGcontext* p_ctx, const char* start, const char* end)
+{
+  float y = 0;
+  float lineh;
+  nvgTextMetrics(p_ctx, NULL, NULL, &lineh);
+  NVGtextRow rows[3];
+  int        nrows, i;
+
+  while ((nrows = nvgTextBreakLines(p_ctx, start, end, TEXT_ROW_WIDTH, rows,
+                                    3)))
+  {
+    for (i = 0; i < nrows; i++)
+    {
+      nvgText(p_ctx, 0, y, rows[i].start, rows[i].end);
+      y += lineh;
+    }
+    start = rows[nrows - 1].next;
+  }
+}
+
+//---------------------------------------------------------
+void draw_text(NVGcontext* p_ctx, const char* start, const char* end)
+{
+  int generation = nvgTextAtlasGeneration(p_ctx);
+  if (generation != atlas_generation)
+  {
+    drop_all();
+    atlas_generation = generation;
+  }
+
+  // the key is the style, then the string
+  NVGtextStyle style;
+  nvgCurrentTextStyle(p_ctx, &style);
+  uint32_t key_size = sizeof(NVGtextStyle) + (end - start);
+  if (!grow_scratch((void**) &p_key, &key_space, key_size))
+  {
+    draw_rows(p_ctx, start, end);
+    return;
+  }
+  memcpy(p_key, &style, sizeof(NVGtextStyle));
+  memcpy(p_key + sizeof(NVGtextStyle), start, end - start);
+
+  layout_t* p_layout;
+  HASH_FIND(hh, p_layouts, p_key, key_size, p_layout);
+  if (p_layout != NULL)
+  {
+    // most recently used last
+    HASH_DEL(p_layouts, p_layout);
+    HASH_ADD_KEYPTR(hh, p_layouts, p_layout->p_key, p_layout->key_size,
+                    p_layout);
+    hits++;
+    nvgDrawGlyphQuads(p_ctx, p_layout->p_quads, p_layout->count);
+    return;
+  }
+
+  misses++;
+  int count;
+  if (!lay_out(p_ctx, start, end, &count))
+  {
+    draw_rows(p_ctx, start, end);
+    return;
+  }
+
+  uint32_t quads_size = sizeof(NVGglyphQuad) * count;
+  uint32_t size       = sizeof(layout_t) + quads_size + key_size;
+  p_layout            = malloc(size);
+  if (p_layout != NULL && size <= TEXT_CACHE_BYTES)
+  {
+    memset(p_layout, 0, sizeof(layout_t));
+    p_layout->key_size = key_size;
+    p_layout->size     = size;
+    p_layout->count    = count;
+    p_layout->p_quads  = (NVGglyphQuad*) (p_layout + 1);
+    p_layout->p_key    = (byte*) p_layout->p_quads + quads_size;
+    memcpy(p_layout->p_quads, p_quads, quads_size);
+    memcpy(p_layout->p_key, p_key, key_size);
+
+    while (p_layouts != NULL && bytes + size > TEXT_CACHE_BYTES)
+      drop(p_layouts);
+    HASH_ADD_KEYPTR(hh, p_layouts, p_layout->p_key, key_size, p_layout);
+    bytes += size;
+  }
+  else
+  {
+    free(p_layout);
+  }
+
+  nvgDrawGlyphQuads(p_ctx, p_quads, count);
+}
@@ -0,0 +1,18 @@
+/*
+Laid out text. Text is laid out into glyph quads once and drawn from them
+while its font, size and string stay the same.
+*/
+
+#ifndef _TEXT_CACHE_H
+#define _TEXT_CACHE_H
+
+#include "comms.h"
+#include "types.h"
+
+void draw_text(NVGcontext* p_ctx, const char* start, const char* end);
+
+uint32_t get_text_hits();
+uint32_t get_text_misses();
+uint32_t get_text_bytes();
+
+#endif
@@ -7,6 +7,7 @@ Functions to load textures onto the graphics card
 */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdio.h>
 
@@ -95,44 +96,27 @@ static tx_id_t* delete_tx_id(tx_id_t* p_tx_ids, char* p_key)
 }
 
 //=============================================================================
+// loading the textures. Shared by the whole and the chunked messages
 
 //---------------------------------------------------------
-void receive_put_tx_blob(int* p_msg_length, GLFWwindow* window)
+// decode an image file (png, jpg...) and store it under the key
+static void put_tx_file(window_data_t* p_data, char* p_key, GLuint key_size,
+                        void* p_tx_file, GLuint file_size)
 {
-  window_data_t* p_data = glfwGetWindowUserPointer(window);
-  if (p_data == NULL)
-  {
-    send_puts("receive_put_tx_file BAD WINDOW");
-    return;
-  }
-  NVGcontext* p_ctx = p_data->context.p_ctx;
-
-  // read in the data from the stream
-  GLuint key_size;
-  GLuint file_size;
-  read_bytes_down(&key_size, sizeof(GLuint), p_msg_length);
-  read_bytes_down(&file_size, sizeof(GLuint), p_msg_length);
-
-  // Allocate and read the key. Need to free from now on
-  char* p_key = malloc(key_size);
-  read_bytes_down(p_key, key_size, p_msg_length);
-
-  // Allocate and read the main data. Need to free from now on
-  void* p_tx_file = malloc(file_size);
-  read_bytes_down(p_tx_file, file_size, p_msg_length);
-
   // load the texture
-  int id = nvgCreateImageMem(p_ctx, NVG_IMAGE_GENERATE_MIPMAPS, p_tx_file,
-                             file_size);
+  int id = nvgCreateImageMem(p_data->context.p_ctx, NVG_IMAGE_GENERATE_MIPMAPS,
+                             p_tx_file, file_size);
 
   // store the key/id pair
   int old_id;
   p_data->p_tx_ids = put_tx_id(p_data->p_tx_ids, p_key, key_size, id, &old_id);
-
-  free(p_key);
-  free(p_tx_file);
+  p_data->tx_generation++;
 }
 
+// the largest texture that can be streamed in, and the most the pixels of any
+// texture can take once expanded to four bytes each
+#define MAX_TX_UPLOAD_SIZE 0x40000000
+
 //---------------------------------------------------------
 PACK(typedef struct tx_pixels_t
 {
@@ -143,39 +127,41 @@ PACK(typedef struct tx_pixels_t
   GLuint height;
 }) tx_pixels_t;
 
-void receive_put_tx_pixels(int* p_msg_length, GLFWwindow* window)
+//---------------------------------------------------------
+// check the pixels described by the header are all there
+static bool valid_tx_pixels(tx_pixels_t* p_header)
 {
-  window_data_t* p_data = glfwGetWindowUserPointer(window);
-  if (p_data == NULL)
-  {
-    send_puts("receive_put_tx_file BAD WINDOW");
-    return;
-  }
-  NVGcontext* p_ctx = p_data->context.p_ctx;
-
-  // read in the data from the stream
-  tx_pixels_t header;
-  read_bytes_down(&header, sizeof(tx_pixels_t), p_msg_length);
-  GLuint pixel_count = header.width * header.height;
-
-  // Allocate and read the key. Need to free from now on
-  char* p_key = malloc(header.key_size);
-  read_bytes_down(p_key, header.key_size, p_msg_length);
+  uint64_t count  = (uint64_t) p_header->width * p_header->height;
+  uint64_t needed = count * p_header->depth;
+  return p_header->depth >= 1 && p_header->depth <= 4 &&
+         needed <= p_header->pixel_size && count * 4 <= MAX_TX_UPLOAD_SIZE;
+}
 
-  // Allocate and read the main data. Need to free from now on
-  unsigned char* p_tx_pixels = malloc(header.pixel_size);
-  read_bytes_down(p_tx_pixels, header.pixel_size, p_msg_length);
+//---------------------------------------------------------
+// upload raw pixels of any depth and store them under the key
+static void put_tx_pixels(window_data_t* p_data, char* p_key,
+                          tx_pixels_t* p_header, unsigned char* p_tx_source)
+{
+  GLuint pixel_count = p_header->width * p_header->height;
 
   // expand the texture as appropriate depending on the depth
-  GLuint src_i;
-  GLuint dst_i;
-  unsigned char* p_tx_source = p_tx_pixels;
-  switch (header.depth)
+  GLuint         src_i;
+  GLuint         dst_i;
+  unsigned char* p_tx_pixels = p_tx_source;
+  if (p_header->depth != 4)
+  {
+    p_tx_pixels = malloc(pixel_count * 4);
+    if (p_tx_pixels == NULL)
+    {
+      send_puts("put_tx_pixels NO MEMORY");
+      return;
+    }
+  }
+  switch (p_header->depth)
   {
     case 4: // already good
       break;
     case 3:
-      p_tx_pixels = malloc(pixel_count * 4);
       for( unsigned int i = 0; i < pixel_count; i++ ) {
         dst_i = i * 4;
         src_i = i * 3;
@@ -184,10 +170,8 @@ void receive_put_tx_pixels(int* p_msg_length, GLFWwindow* window)
         p_tx_pixels[dst_i + 2] = p_tx_source[src_i + 2];
         p_tx_pixels[dst_i + 3] = 0xff;
       }
-      free(p_tx_source);
       break;
     case 2:
-      p_tx_pixels = malloc(pixel_count * 4);
       for( unsigned int i = 0; i < pixel_count; i++ ) {
         dst_i = i * 4;
         src_i = i * 2;
@@ -196,10 +180,8 @@ void receive_put_tx_pixels(int* p_msg_length, GLFWwindow* window)
         p_tx_pixels[dst_i + 2] = p_tx_source[src_i];
         p_tx_pixels[dst_i + 3] = p_tx_source[src_i + 1];
       }
-      free(p_tx_source);
       break;
     case 1:
-      p_tx_pixels = malloc(pixel_count * 4);
       for( unsigned int i = 0; i < pixel_count; i++ ) {
         dst_i = i * 4;
         p_tx_pixels[dst_i] = p_tx_source[i];
@@ -207,24 +189,321 @@ void receive_put_tx_pixels(int* p_msg_length, GLFWwindow* window)
         p_tx_pixels[dst_i + 2] = p_tx_source[i];
         p_tx_pixels[dst_i + 3] = 0xff;
       }
-      free(p_tx_source);
       break;
   }
 
   // load the texture
-  int id = nvgCreateImageRGBA(p_ctx, header.width, header.height,
-    NVG_IMAGE_GENERATE_MIPMAPS, p_tx_pixels);
+  int id = nvgCreateImageRGBA(p_data->context.p_ctx, p_header->width,
+    p_header->height, NVG_IMAGE_GENERATE_MIPMAPS, p_tx_pixels);
 
   // store the key/id pair
   int old_id;
-  p_data->p_tx_ids = put_tx_id(p_data->p_tx_ids, p_key, header.key_size, id, &old_id);
+  p_data->p_tx_ids = put_tx_id(p_data->p_tx_ids, p_key, p_header->key_size, id, &old_id);
+  p_data->tx_generation++;
+
+  // only the expanded copies were allocated here
+  if (p_tx_pixels != p_tx_source)
+    free(p_tx_pixels);
+}
+
+//=============================================================================
+// whole textures in a single message
+
+//---------------------------------------------------------
+void receive_put_tx_blob(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_put_tx_file BAD WINDOW");
+    return;
+  }
+
+  // read in the data from the message
+  GLuint key_size  = 0;
+  GLuint file_size = 0;
+  read_bytes_down(p_msg, &key_size, sizeof(GLuint));
+  read_bytes_down(p_msg, &file_size, sizeof(GLuint));
+
+  // the key and file are used straight out of the message
+  char* p_key     = read_str_down(p_msg, key_size);
+  void* p_tx_file = read_ptr_down(p_msg, file_size);
+  if (p_key == NULL || p_tx_file == NULL)
+  {
+    send_puts("receive_put_tx_blob BAD MESSAGE");
+    return;
+  }
+
+  put_tx_file(p_data, p_key, key_size, p_tx_file, file_size);
+}
+
+//---------------------------------------------------------
+void receive_put_tx_pixels(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_put_tx_file BAD WINDOW");
+    return;
+  }
+
+  // read in the data from the message
+  tx_pixels_t header;
+  if (!read_bytes_down(p_msg, &header, sizeof(tx_pixels_t)))
+    return;
+
+  // the key and pixels are used straight out of the message
+  char*          p_key       = read_str_down(p_msg, header.key_size);
+  unsigned char* p_tx_source = read_ptr_down(p_msg, header.pixel_size);
+  if (p_key == NULL || p_tx_source == NULL || !valid_tx_pixels(&header))
+  {
+    send_puts("receive_put_tx_pixels BAD MESSAGE");
+    return;
+  }
+
+  put_tx_pixels(p_data, p_key, &header, p_tx_source);
+}
+
+//=============================================================================
+// textures streamed in over several messages
+//
+// A big texture can take a whole frame or more just to copy in. Instead it
+// can be sent as a CMD_PUT_TX_BEGIN, any number of CMD_PUT_TX_CHUNKs and a
+// CMD_PUT_TX_COMMIT. The main loop keeps drawing between the chunks, and
+// nothing changes on screen until the commit loads the texture. An upload
+// that can't be finished reports its texture missing, which has the caller
+// send it again from the start.
+//
+// Uploads that never get their commit are dropped when the same texture
+// starts again, and the oldest when too many are pending.
+
+// how many uploads can be waiting for their commit at once
+#define MAX_TX_UPLOADS 16
+
+//---------------------------------------------------------
+typedef struct
+{
+  uint32_t       upload_id;
+  tx_pixels_t    header; // depth 0 means the data is an image file
+  uint32_t       received;
+  bool           failed;
+  unsigned char* p_data;
+  char*          p_key;
+  UT_hash_handle hh;
+} tx_upload_t;
+
+//---------------------------------------------------------
+static tx_upload_t* get_upload(window_data_t* p_data, uint32_t upload_id)
+{
+  tx_upload_t* found  = NULL;
+  tx_upload_t* p_list = p_data->p_tx_uploads;
+  HASH_FIND(hh, p_list, &upload_id, sizeof(uint32_t), found);
+  return found;
+}
+
+//---------------------------------------------------------
+static void free_upload(window_data_t* p_data, tx_upload_t* p_upload)
+{
+  tx_upload_t* p_list = p_data->p_tx_uploads;
+  HASH_DEL(p_list, p_upload);
+  p_data->p_tx_uploads = p_list;
+  free(p_upload->p_data);
+  free(p_upload->p_key);
+  free(p_upload);
+}
+
+//---------------------------------------------------------
+void free_tx_uploads(window_data_t* p_data)
+{
+  tx_upload_t* p_upload;
+  tx_upload_t* p_tmp;
+  tx_upload_t* p_list = p_data->p_tx_uploads;
+  HASH_ITER(hh, p_list, p_upload, p_tmp)
+  {
+    free_upload(p_data, p_upload);
+  }
+}
 
-  free(p_key);
-  free(p_tx_pixels);
+//---------------------------------------------------------
+// the rest of the upload is ignored until its commit
+static void fail_upload(tx_upload_t* p_upload)
+{
+  send_texture_lost(p_upload->p_key, p_upload->header.depth == 0);
+  free(p_upload->p_data);
+  p_upload->p_data = NULL;
+  p_upload->failed = true;
 }
 
 //---------------------------------------------------------
-void receive_free_tx_id(int* p_msg_length, GLFWwindow* window)
+PACK(typedef struct tx_begin_t
+{
+  GLuint upload_id;
+  GLuint key_size;
+  GLuint size;
+  GLuint depth;
+  GLuint width;
+  GLuint height;
+}) tx_begin_t;
+
+void receive_put_tx_begin(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_put_tx_begin BAD WINDOW");
+    return;
+  }
+
+  tx_begin_t begin;
+  if (!read_bytes_down(p_msg, &begin, sizeof(tx_begin_t)))
+    return;
+
+  tx_pixels_t header = {
+      begin.key_size, begin.size, begin.depth, begin.width, begin.height};
+
+  char* p_key = read_str_down(p_msg, begin.key_size);
+  if (p_key == NULL || begin.size == 0 || begin.size > MAX_TX_UPLOAD_SIZE ||
+      (begin.depth != 0 && !valid_tx_pixels(&header)))
+  {
+    send_puts("receive_put_tx_begin BAD MESSAGE");
+    return;
+  }
+
+  // starting over with the same id or the same texture drops what was sent
+  // before. Past the limit, so does the oldest upload, which is first
+  tx_upload_t* p_upload;
+  tx_upload_t* p_tmp;
+  tx_upload_t* p_list = p_data->p_tx_uploads;
+  HASH_ITER(hh, p_list, p_upload, p_tmp)
+  {
+    if (p_upload->upload_id == begin.upload_id ||
+        strcmp(p_upload->p_key, p_key) == 0)
+      free_upload(p_data, p_upload);
+  }
+  p_list = p_data->p_tx_uploads;
+  if (HASH_COUNT(p_list) >= MAX_TX_UPLOADS)
+  {
+    send_puts("receive_put_tx_begin TOO MANY UPLOADS");
+    if (!p_list->failed)
+      send_texture_lost(p_list->p_key, p_list->header.depth == 0);
+    free_upload(p_data, p_list);
+  }
+
+  p_upload = malloc(sizeof(tx_upload_t));
+  if (p_upload == NULL)
+  {
+    send_puts("receive_put_tx_begin OUT OF MEMORY");
+    return;
+  }
+  memset(p_upload, 0, sizeof(tx_upload_t));
+  p_upload->upload_id = begin.upload_id;
+  p_upload->header    = header;
+  p_upload->p_data    = malloc(begin.size);
+  p_upload->p_key     = malloc(begin.key_size);
+  if (p_upload->p_data == NULL || p_upload->p_key == NULL)
+  {
+    send_puts("receive_put_tx_begin OUT OF MEMORY");
+    free(p_upload->p_data);
+    free(p_upload->p_key);
+    free(p_upload);
+    return;
+  }
+  memcpy(p_upload->p_key, p_key, begin.key_size);
+
+  p_list = p_data->p_tx_uploads;
+  HASH_ADD(hh, p_list, upload_id, sizeof(uint32_t), p_upload);
+  p_data->p_tx_uploads = p_list;
+}
+
+//---------------------------------------------------------
+PACK(typedef struct tx_chunk_t
+{
+  GLuint upload_id;
+  GLuint offset;
+  GLuint length;
+}) tx_chunk_t;
+
+// chunks have to arrive in order. One that doesn't fails the upload
+void receive_put_tx_chunk(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_put_tx_chunk BAD WINDOW");
+    return;
+  }
+
+  tx_chunk_t chunk;
+  if (!read_bytes_down(p_msg, &chunk, sizeof(tx_chunk_t)))
+    return;
+
+  tx_upload_t* p_upload = get_upload(p_data, chunk.upload_id);
+  void*        p_bytes  = read_ptr_down(p_msg, chunk.length);
+  if (p_upload == NULL || p_bytes == NULL)
+  {
+    send_puts("receive_put_tx_chunk BAD MESSAGE");
+    return;
+  }
+  if (p_upload->failed)
+    return;
+  if (chunk.offset != p_upload->received ||
+      chunk.length > p_upload->header.pixel_size - p_upload->received)
+  {
+    send_puts("receive_put_tx_chunk BAD OFFSET");
+    fail_upload(p_upload);
+    return;
+  }
+
+  memcpy(p_upload->p_data + chunk.offset, p_bytes, chunk.length);
+  p_upload->received += chunk.length;
+}
+
+//---------------------------------------------------------
+void receive_put_tx_commit(msg_cursor_t* p_msg, GLFWwindow* window)
+{
+  window_data_t* p_data = glfwGetWindowUserPointer(window);
+  if (p_data == NULL)
+  {
+    send_puts("receive_put_tx_commit BAD WINDOW");
+    return;
+  }
+
+  GLuint upload_id;
+  if (!read_bytes_down(p_msg, &upload_id, sizeof(GLuint)))
+    return;
+
+  tx_upload_t* p_upload = get_upload(p_data, upload_id);
+  if (p_upload == NULL)
+  {
+    send_puts("receive_put_tx_commit BAD MESSAGE");
+    return;
+  }
+
+  tx_pixels_t* p_header = &p_upload->header;
+  if (p_upload->failed)
+  {
+    // already reported
+  }
+  else if (p_upload->received != p_header->pixel_size)
+  {
+    send_puts("receive_put_tx_commit INCOMPLETE");
+    fail_upload(p_upload);
+  }
+  else if (p_header->depth == 0)
+  {
+    put_tx_file(p_data, p_upload->p_key, p_header->key_size, p_upload->p_data,
+                p_header->pixel_size);
+  }
+  else
+  {
+    put_tx_pixels(p_data, p_upload->p_key, p_header, p_upload->p_data);
+  }
+
+  free_upload(p_data, p_upload);
+}
+
+//---------------------------------------------------------
+void receive_free_tx_id(msg_cursor_t* p_msg, GLFWwindow* window)
 {
   window_data_t* p_data = glfwGetWindowUserPointer(window);
   if (p_data == NULL)
@@ -235,18 +514,21 @@ void receive_free_tx_id(int* p_msg_length, GLFWwindow* window)
   NVGcontext* p_ctx = p_data->context.p_ctx;
 
   GLuint key_size;
-  read_bytes_down(&key_size, sizeof(GLuint), p_msg_length);
+  if (!read_bytes_down(p_msg, &key_size, sizeof(GLuint)))
+    return;
 
-  // Allocate and read the key. Need to free from now on
-  char* p_key = malloc(key_size);
-  read_bytes_down(p_key, key_size, p_msg_length);
+  char* p_key = read_str_down(p_msg, key_size);
+  if (p_key == NULL)
+  {
+    send_puts("receive_free_tx_id BAD MESSAGE");
+    return;
+  }
 
   int id = get_tx_id(p_data->p_tx_ids, p_key);
   if (id >= 0)
   {
     p_data->p_tx_ids = delete_tx_id(p_data->p_tx_ids, p_key);
     nvgDeleteImage(p_ctx, id);
+    p_data->tx_generation++;
   }
-
-  free(p_key);
 }
@@ -11,8 +11,12 @@ Functions to load textures onto the graphics card
 
 int get_tx_id(void* p_tx_ids, char* p_key);
 
-void receive_put_tx_blob(int* p_msg_length, GLFWwindow* window);
-void receive_put_tx_pixels(int* p_msg_length, GLFWwindow* window);
-void receive_free_tx_id(int* p_msg_length, GLFWwindow* window);
+void receive_put_tx_blob(msg_cursor_t* p_msg, GLFWwindow* window);
+void receive_put_tx_pixels(msg_cursor_t* p_msg, GLFWwindow* window);
+void receive_free_tx_id(msg_cursor_t* p_msg, GLFWwindow* window);
+void receive_put_tx_begin(msg_cursor_t* p_msg, GLFWwindow* window);
+void receive_put_tx_chunk(msg_cursor_t* p_msg, GLFWwindow* window);
+void receive_put_tx_commit(msg_cursor_t* p_msg, GLFWwindow* window);
+void free_tx_uploads(window_data_t* p_data);
 
 #endif
\ No newline at end of file
@@ -48,20 +48,106 @@ typedef struct
   void*       p_fonts;
 } context_t;
 
+//---------------------------------------------------------
+// how far a script's own drawing reaches, in the space it is run in. Worked
+// out when it is decoded. Strokes and text drawn with a width or size the
+// script doesn't set itself are finished off when it runs, with the state it
+// runs in. Boxes are min x, min y, max x, max y, and empty if min > max.
+typedef struct
+{
+  float    fixed[4];     // drawing whose size is known
+  float    stroke[4];    // paths that are stroked
+  float    stroke_reach; // how far the strokes with a known width reach
+  float    stroke_scale; // and the most the others are scaled by
+  float    stroke_width; // the widest width and miter limit they set
+  float    stroke_miter;
+  float    text_at[4];   // where text with an inherited size starts
+  float    text_em[4];   // and how far it reaches from there, in ems
+  uint32_t text_bytes;   // the longest of that text
+  float    text_blur;    // how far a blur it sets reaches
+  float    blur_scale;   // the most text with an inherited blur is scaled by
+  bool     unbounded;    // can draw anywhere
+  bool     own_scissor;  // sets a scissor instead of narrowing the one it gets
+  bool     runs_scripts;
+  bool     leaks;        // leaves state behind for the script that ran it
+} script_bounds_t;
+
+//---------------------------------------------------------
+// a resident render script. p_script is the script as it arrived, which
+// patches are made against. The tag is set by patches so a patch can tell
+// if it is being applied to the script it was made against. p_ops is what
+// actually runs, decoded from p_script. p_retained is what it drew last time,
+// kept so it can be drawn again without running it. drawn is where it and the
+// scripts it ran drew in frame drawn_frame. changed_frame is the first frame
+// after it last changed. p_cached is its texture, if it is cached as one, and
+// cache_frame the last frame it lost one. bounds is where it draws, to skip it
+// when that can't be seen.
+typedef struct
+{
+  void*           p_script;
+  void*           p_ops;
+  void*           p_retained;
+  void*           p_cached;
+  uint32_t        size;
+  uint32_t        tag;
+  float           drawn[4];
+  uint32_t        drawn_frame;
+  uint32_t        changed_frame;
+  uint32_t        cache_frame;
+  script_bounds_t bounds;
+} script_t;
+
+//---------------------------------------------------------
+// scripts by id. A radix table in three levels, so any 32 bit id can be used
+// and only the pages with scripts in them take memory. The top 12 bits of an
+// id pick a directory, the next 12 a page and the low 8 the script.
+#define SCRIPT_PAGE_BITS 8
+#define SCRIPT_DIR_BITS 12
+#define SCRIPT_PAGE_SIZE (1 << SCRIPT_PAGE_BITS)
+#define SCRIPT_DIR_SIZE (1 << SCRIPT_DIR_BITS)
+
+typedef struct
+{
+  script_t** p_dirs[SCRIPT_DIR_SIZE];
+  uint32_t   live;
+  uint32_t   peak;
+} script_table_t;
+
+//---------------------------------------------------------
+// high rate input is held here and sent up at most once a frame
+typedef struct
+{
+  bool   reshaped;
+  bool   cursor_moved;
+  float  cursor_x;
+  float  cursor_y;
+  double cursor_time;
+  bool   scrolled;
+  float  scroll_x;
+  float  scroll_y;
+  float  scroll_pos_x;
+  float  scroll_pos_y;
+  double scroll_time;
+  double next_send;
+} pending_input_t;
+
 //---------------------------------------------------------
 // the data pointed to by the window private data pointer
 typedef struct
 {
-  bool      keep_going;
-  bool      redraw;
-  uint32_t  input_flags;
-  float     last_x;
-  float     last_y;
-  void**    p_scripts;
-  int       root_script;
-  int       num_scripts;
-  void*     p_tx_ids;
-  context_t context;
+  bool            keep_going;
+  bool            redraw;
+  uint32_t        input_flags;
+  float           last_x;
+  float           last_y;
+  pending_input_t pending;
+  double          frame_time;
+  script_table_t  scripts;
+  int             root_script;
+  void*           p_tx_ids;
+  void*           p_tx_uploads;
+  uint32_t        tx_generation;
+  context_t       context;
 } window_data_t;
 
 #endif // RENDER_GLFW_TYPES
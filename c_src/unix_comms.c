@@ -1,5 +1,10 @@
 #include "comms.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 //=============================================================================
 // raw comms with host app
 // from erl_comm.c
@@ -35,44 +40,263 @@ int write_exact(byte* buf, int len)
 }
 
 //---------------------------------------------------------
-// Starts by using select to see if there is any data to be read
-// if not in timeout, then returns with -1
+// write several buffers out as one message stream with a single writev
+// in the common case. Picks up where it left off after a partial write.
+int write_parts(out_part_t* p_parts, int count)
+{
+  struct iovec iov[count];
+  int          total = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    iov[i].iov_base = (void*) p_parts[i].p_data;
+    iov[i].iov_len  = p_parts[i].length;
+    total += p_parts[i].length;
+  }
+
+  struct iovec* p_iov = iov;
+  int           wrote = 0;
+  while (wrote < total)
+  {
+    ssize_t i = writev(1, p_iov, count);
+    if (i <= 0)
+      return (i);
+    wrote += i;
+
+    // step past whatever was fully written
+    while (count > 0 && (size_t) i >= p_iov->iov_len)
+    {
+      i -= p_iov->iov_len;
+      p_iov++;
+      count--;
+    }
+    if (count > 0)
+    {
+      p_iov->iov_base = (byte*) p_iov->iov_base + i;
+      p_iov->iov_len -= i;
+    }
+  }
+
+  return (total);
+}
+
+//=============================================================================
+// framed message reading
+//
+// Every message from erlang is prefixed with a 4 byte big-endian length.
+// Rather than pulling each field off the pipe with its own read, whatever is
+// waiting on stdin is read in one go into a growable buffer and complete
+// messages are handed out of it from there.
+
+// start with 64k. If a big message (fonts, textures) grew the buffer past
+// 4mb, let it shrink back down once it has been drained.
+#define IN_BUFFER_MIN_SIZE 0x10000
+#define IN_BUFFER_IDLE_SIZE 0x400000
+
+static byte*  p_in_buffer = NULL;
+static size_t in_capacity = 0;
+static size_t in_start    = 0;
+static size_t in_end      = 0;
+
+//---------------------------------------------------------
+// make sure there is room for at least "needed" bytes of unconsumed data.
+// consumed bytes are dropped from the front of the buffer first, which
+// invalidates any message handed out earlier.
+static bool reserve_in_buffer(size_t needed)
+{
+  // slide the unconsumed bytes down to the front
+  if (in_start > 0)
+  {
+    memmove(p_in_buffer, p_in_buffer + in_start, in_end - in_start);
+    in_end -= in_start;
+    in_start = 0;
+  }
+
+  // release an oversized buffer once it is empty
+  if (in_end == 0 && in_capacity > IN_BUFFER_IDLE_SIZE &&
+      needed <= IN_BUFFER_MIN_SIZE)
+  {
+    free(p_in_buffer);
+    p_in_buffer = NULL;
+    in_capacity = 0;
+  }
+
+  if (needed <= in_capacity)
+    return true;
+
+  size_t capacity = in_capacity ? in_capacity : IN_BUFFER_MIN_SIZE;
+  while (capacity < needed)
+    capacity *= 2;
+
+  byte* p_buffer = realloc(p_in_buffer, capacity);
+  if (p_buffer == NULL)
+    return false;
+
+  p_in_buffer = p_buffer;
+  in_capacity = capacity;
+  return true;
+}
+
+//---------------------------------------------------------
+// Read the next complete message into p_msg. If nothing is buffered, starts
+// by using select to see if there is any data to be read. If not in timeout,
+// then returns false. A NULL timeout waits until there is.
 // Setting the timeout too high means input will be laggy as you
 // are starving the input polling. Setting it too low means using
 // energy for no purpose. Probably best if set similar to the
 // frame rate
-int read_msg_length(struct timeval * ptv)
+bool read_msg(msg_cursor_t* p_msg, struct timeval* ptv)
 {
-  byte buff[4];
+  // only wait on the pipe if there isn't part of a message already here
+  if (in_end == in_start)
+  {
+    fd_set rfds;
 
-  fd_set rfds;
-  int    retval;
+    // Watch stdin (fd 0) to see when it has input.
+    FD_ZERO(&rfds);
+    FD_SET(0, &rfds);
 
-  // Watch stdin (fd 0) to see when it has input.
-  FD_ZERO(&rfds);
-  FD_SET(0, &rfds);
+    // look for data. -1 is an error, 0 is no data within the timeout
+    if (select(1, &rfds, NULL, NULL, ptv) <= 0)
+      return false;
+  }
 
-  // look for data
-  retval = select(1, &rfds, NULL, NULL, ptv);
-  if (retval == -1)
+  while (true)
   {
-    return -1; // error
+    size_t   buffered = in_end - in_start;
+    uint32_t len      = 0;
+
+    if (buffered >= sizeof(uint32_t))
+    {
+      // length from erlang is always big endian
+      memcpy(&len, p_in_buffer + in_start, sizeof(uint32_t));
+      swap_little_endian_uint(&len);
+
+      // is the whole message here?
+      if (buffered - sizeof(uint32_t) >= len)
+      {
+        p_msg->p_data = p_in_buffer + in_start + sizeof(uint32_t);
+        p_msg->length = len;
+        p_msg->offset = 0;
+        in_start += sizeof(uint32_t) + len;
+        return true;
+      }
+    }
+
+    // make room for the rest of the message, then take whatever is waiting.
+    // the caller writes whole packets, so this won't block for long.
+    size_t needed = buffered >= sizeof(uint32_t)
+                        ? sizeof(uint32_t) + (size_t) len
+                        : IN_BUFFER_MIN_SIZE;
+    if (!reserve_in_buffer(needed))
+      return false;
+
+    ssize_t got = read(0, p_in_buffer + in_end, in_capacity - in_end);
+    if (got <= 0)
+      return false;
+    in_end += got;
   }
-  else if (retval)
-  {
-    if (read_exact(buff, 4) != 4)
-      return (-1);
-    // length from erlang is always big endian
-    uint32_t len = *((uint32_t*) &buff);
-    swap_little_endian_uint(&len);
+}
+
+//=============================================================================
+// shared memory ring
+//
+// Optionally, the caller creates a POSIX shared memory object and writes bulk
+// messages (scripts, textures, fonts) into it instead of down the pipe. Only a
+// small descriptor comes down the pipe. Once a message has been dispatched,
+// the released position is written back into the header so the caller knows
+// it can reuse the space.
+
+#define SHM_MAGIC 0x53484D31 // "SHM1"
+#define SHM_HEADER_SIZE 64
+
+typedef struct
+{
+  uint32_t          magic;
+  uint32_t          data_size;
+  volatile uint32_t released;
+} shm_header_t;
 
-    return len;
+static shm_header_t* p_shm      = NULL;
+static byte*         p_shm_data = NULL;
+
+//---------------------------------------------------------
+// map the named shared memory object. The name is unlinked right away. Both
+// sides already have it open, and this way it can't be left behind.
+bool map_shm(const char* name)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return false;
+  shm_unlink(name);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= SHM_HEADER_SIZE)
+  {
+    close(fd);
+    return false;
   }
-  else
+
+  void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  shm_header_t* p_header = p;
+  if (p_header->magic != SHM_MAGIC ||
+      p_header->data_size > st.st_size - SHM_HEADER_SIZE)
   {
-    // no data within the timeout
-    return -1;
+    munmap(p, st.st_size);
+    return false;
   }
+
+  p_shm      = p_header;
+  p_shm_data = (byte*) p + SHM_HEADER_SIZE;
+  return true;
+}
+
+//---------------------------------------------------------
+// returns a pointer to a message in the ring, or NULL if it isn't mapped or
+// the range is bad
+byte* get_shm(uint32_t offset, uint32_t length)
+{
+  if (p_shm == NULL || offset > p_shm->data_size ||
+      length > p_shm->data_size - offset)
+    return NULL;
+  return p_shm_data + offset;
+}
+
+//---------------------------------------------------------
+// let the caller reuse everything up to position
+void release_shm(uint32_t position)
+{
+  if (p_shm == NULL)
+    return;
+  __sync_synchronize();
+  p_shm->released = position;
+}
+
+//=============================================================================
+// reader thread
+
+//---------------------------------------------------------
+// start comms_thread reading from stdin. It runs until the process exits, so
+// there is nothing to join.
+bool start_comms_thread(GLFWwindow* window)
+{
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, comms_thread, window) != 0)
+    return false;
+  pthread_detach(thread);
+  return true;
+}
+
+//---------------------------------------------------------
+// wait a moment for the main thread to make room in the queue
+void comms_backoff()
+{
+  struct timeval tv = {0, 1000};
+  select(0, NULL, NULL, NULL, &tv);
 }
 
 //---------------------------------------------------------
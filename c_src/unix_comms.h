@@ -8,8 +8,10 @@
   #include <stdio.h>
   #include <unistd.h>
   #include <poll.h>
+  #include <pthread.h>
   #include <sys/time.h>
   #include <sys/select.h>
+  #include <sys/uio.h>
   #include <stdint.h>
   #include <string.h>
 
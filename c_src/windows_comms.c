@@ -1,5 +1,7 @@
 #include "comms.h"
 
+#include <stdlib.h>
+
 //---------------------------------------------------------
 int read_exact(byte* buf, int len)
 {
@@ -32,31 +34,110 @@ int write_exact(byte* buf, int len)
 }
 
 //---------------------------------------------------------
-// Starts by using select to see if there is any data to be read
-// if not in timeout, then returns with -1
-// Setting the timeout too high means input will be laggy as you
-// are starving the input polling. Setting it too low means using
-// energy for no purpose. Probably best if set similar to the
-// frame rate
-int read_msg_length(struct timeval * ptv)
+// no writev here. stdout is buffered, so write the parts and flush once
+int write_parts(out_part_t* p_parts, int count)
 {
+  int total = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    size_t wrote = 0;
+    while (wrote < p_parts[i].length)
+    {
+      size_t n = fwrite((byte*) p_parts[i].p_data + wrote, sizeof(byte),
+                        p_parts[i].length - wrote, stdout);
+      if (n == 0)
+        return (-1);
+      wrote += n;
+    }
+    total += wrote;
+  }
+
+  fflush(stdout);
+  return (total);
+}
+
+//---------------------------------------------------------
+// Read the next complete message into a growable buffer and point p_msg at
+// it. The message is only valid until the next call.
+// Uses PeekNamedPipe to see if there is any data to be read
+// if not, then returns false. A NULL timeout blocks until there is.
+bool read_msg(msg_cursor_t* p_msg, struct timeval* ptv)
+{
+  static byte*  p_in_buffer = NULL;
+  static size_t in_capacity = 0;
+
   DWORD bytesAvailable = 0;
   HANDLE h_stdin = GetStdHandle(STD_INPUT_HANDLE);
 
-  if (PeekNamedPipe(h_stdin, NULL, 0, NULL, &bytesAvailable, NULL) && bytesAvailable) {
-      byte buff[4];
+  if (ptv != NULL &&
+      (!PeekNamedPipe(h_stdin, NULL, 0, NULL, &bytesAvailable, NULL) || !bytesAvailable))
+    return false;
 
-      if (read_exact(buff, 4) != 4)
-      return (-1);
+  byte buff[4];
+  if (read_exact(buff, 4) != 4)
+    return false;
 
-      // length from erlang is always big endian
-      uint32_t len = *((uint32_t*) &buff);
-      swap_little_endian_uint(&len);
+  // length from erlang is always big endian
+  uint32_t len = *((uint32_t*) &buff);
+  swap_little_endian_uint(&len);
 
-      return len;
+  if (len > in_capacity)
+  {
+    byte* p_buffer = realloc(p_in_buffer, len);
+    if (p_buffer == NULL)
+      return false;
+    p_in_buffer = p_buffer;
+    in_capacity = len;
   }
 
-  return -1;
+  if (len > 0 && read_exact(p_in_buffer, len) != (int) len)
+    return false;
+
+  p_msg->p_data = p_in_buffer;
+  p_msg->length = len;
+  p_msg->offset = 0;
+  return true;
+}
+
+//---------------------------------------------------------
+// the shared memory transport isn't supported here. The caller only uses it
+// when it has been mapped, so everything stays on the pipe.
+bool map_shm(const char* name)
+{
+  return false;
+}
+
+byte* get_shm(uint32_t offset, uint32_t length)
+{
+  return NULL;
+}
+
+void release_shm(uint32_t position) {}
+
+//---------------------------------------------------------
+static DWORD WINAPI comms_thread_proc(LPVOID window)
+{
+  comms_thread(window);
+  return 0;
+}
+
+//---------------------------------------------------------
+// start comms_thread reading from stdin. It runs until the process exits
+bool start_comms_thread(GLFWwindow* window)
+{
+  HANDLE thread = CreateThread(NULL, 0, comms_thread_proc, window, 0, NULL);
+  if (thread == NULL)
+    return false;
+  CloseHandle(thread);
+  return true;
+}
+
+//---------------------------------------------------------
+// wait a moment for the main thread to make room in the queue
+void comms_backoff()
+{
+  Sleep(1);
 }
 
 //---------------------------------------------------------
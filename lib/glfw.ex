@@ -30,6 +30,8 @@ defmodule Scenic.Driver.Glfw do
 
   @default_sync 15
 
+  @default_max_idle 1000
+
   # ============================================================================
   # client callable api
 
@@ -76,8 +78,45 @@ defmodule Scenic.Driver.Glfw do
         true -> @default_block_size
       end
 
-    port_args =
-      to_charlist(" #{width} #{height} #{inspect(title)} #{resizeable} #{dl_block_size}")
+    max_idle =
+      cond do
+        is_integer(config[:max_idle]) and config[:max_idle] >= 0 -> config[:max_idle]
+        true -> @default_max_idle
+      end
+
+    # optionally keep the last script sent for each graph, so changes can go
+    # down as patches instead of whole scripts
+    scripts =
+      case config[:patch_scripts] do
+        true -> Glfw.Patch.new_table()
+        _ -> nil
+      end
+
+    # optionally share a memory ring with the driver for bulk messages.
+    # it is only used once the driver says it was able to map it.
+    shm_ring =
+      with size when is_integer(size) and size > 0 <- config[:shm_size],
+           {:ok, pid} <- Glfw.Shm.start_link(size) do
+        pid
+      else
+        _ -> nil
+      end
+
+    # anything newer than the positional arguments goes in the environment, so
+    # a driver that doesn't know it just doesn't see it.
+    # optionally count and time the script ops. shows up in the stats.
+    # cache_budget is how many bytes of textures may hold cached scripts
+    port_env =
+      [
+        {'SCENIC_DRIVER_GLFW_MAX_IDLE', to_charlist(max_idle)},
+        shm_ring && {'SCENIC_DRIVER_GLFW_SHM', to_charlist(Glfw.Shm.name(shm_ring))},
+        config[:profile_scripts] == true && {'SCENIC_DRIVER_GLFW_PROFILE', '1'},
+        is_integer(config[:cache_budget]) && config[:cache_budget] >= 0 &&
+          {'SCENIC_DRIVER_GLFW_CACHE_BUDGET', to_charlist(config[:cache_budget])}
+      ]
+      |> Enum.filter(& &1)
+
+    port_args = to_charlist(" #{width} #{height} #{inspect(title)} #{resizeable} #{dl_block_size}")
 
     # request put and delete notifications from the cache
     Cache.Static.Font.subscribe(:all)
@@ -86,19 +125,19 @@ defmodule Scenic.Driver.Glfw do
     # open and initialize the window
     Process.flag(:trap_exit, true)
     executable = :code.priv_dir(:scenic_driver_glfw) ++ @port ++ port_args
-    port = Port.open({:spawn, executable}, [:binary, {:packet, 4}])
+    port = Port.open({:spawn, executable}, [:binary, {:packet, 4}, {:env, port_env}])
 
     state = %{
       inputs: 0x0000,
       port: port,
       closing: false,
       ready: false,
-      debounce: %{},
       root_ref: nil,
       dl_block_size: dl_block_size,
       start_dl: nil,
       end_dl: nil,
       last_used_dl: nil,
+      free_dls: [],
       dl_map: %{},
       used_dls: %{},
       clear_color: @default_clear_color,
@@ -112,6 +151,11 @@ defmodule Scenic.Driver.Glfw do
       window: {width, height},
       frame: {width, height},
       screen_factor: 1.0,
+      shm_ring: shm_ring,
+      shm: nil,
+      batch: false,
+      driver_info: nil,
+      scripts: scripts,
       viewport: viewport
     }
 
@@ -161,11 +205,6 @@ defmodule Scenic.Driver.Glfw do
     Glfw.Graph.handle_flush_dirty(state)
   end
 
-  # --------------------------------------------------------
-  def handle_info({:debounce, type}, %{ready: true} = state) do
-    Glfw.Input.handle_debounce(type, state)
-  end
-
   # --------------------------------------------------------
   def handle_info({msg_port, {:data, msg}}, %{port: port} = state) when msg_port == port do
     msg
@@ -7,6 +7,8 @@
 # and complicated
 #
 defmodule Scenic.Driver.Glfw.Cache do
+  use Bitwise
+
   alias Scenic.Driver.Glfw
   alias Scenic.Cache.Static
   alias Scenic.Cache.Dynamic
@@ -17,13 +19,23 @@ defmodule Scenic.Driver.Glfw.Cache do
   @cmd_put_tx_file 0x34
   @cmd_put_tx_raw 0x35
 
+  @cmd_put_tx_begin 0x3A
+  @cmd_put_tx_chunk 0x3B
+  @cmd_put_tx_commit 0x3C
+
+  @cap_tx_chunks 0x10
+
+  # textures bigger than this are streamed to the driver in pieces of this
+  # size when it can take them that way, so they don't hold up its frames
+  @tx_chunk_size 0x40000
+
   # import IEx
 
   # ============================================================================
 
   # --------------------------------------------------------
   def handle_cast({Static.Texture, :put, key}, %{port: port, ready: true} = state) do
-    load_static_texture(key, port)
+    load_static_texture(key, port, state[:shm], chunked?(state))
     {:noreply, state}
   end
 
@@ -42,7 +54,7 @@ defmodule Scenic.Driver.Glfw.Cache do
 
   # --------------------------------------------------------
   def handle_cast({Scenic.Cache.Dynamic.Texture, :put, key}, %{port: port, ready: true} = state) do
-    load_dynamic_texture(key, port)
+    load_dynamic_texture(key, port, state[:shm], chunked?(state))
     {:noreply, state}
   end
 
@@ -71,25 +83,31 @@ defmodule Scenic.Driver.Glfw.Cache do
   # ============================================================================
 
   # --------------------------------------------------------
-  def load_static_texture(key, port) do
+  def load_static_texture(key, port, shm \\ nil, chunked \\ false) do
     # Static.Texture.subscribe(key, :all)
     with {:ok, data} <- Static.Texture.fetch(key) do
-      <<
-        @cmd_put_tx_file::unsigned-integer-size(32)-native,
-        byte_size(key) + 1::unsigned-integer-size(32)-native,
-        byte_size(data)::unsigned-integer-size(32)-native,
-        key::binary,
-        0::size(8),
-        data::binary
-      >>
-      |> Glfw.Port.send(port)
+      case chunked and byte_size(data) > @tx_chunk_size do
+        true ->
+          send_chunked(key, data, {0, 0, 0}, port, shm)
+
+        false ->
+          <<
+            @cmd_put_tx_file::unsigned-integer-size(32)-native,
+            byte_size(key) + 1::unsigned-integer-size(32)-native,
+            byte_size(data)::unsigned-integer-size(32)-native,
+            key::binary,
+            0::size(8),
+            data::binary
+          >>
+          |> Glfw.Port.send_bulk(port, shm)
+      end
     else
       err -> IO.inspect(err, label: "load_static_texture")
     end
   end
 
   # --------------------------------------------------------
-  def load_dynamic_texture(key, port) do
+  def load_dynamic_texture(key, port, shm \\ nil, chunked \\ false) do
     with {:ok, {type, width, height, pixels, _}} <- Dynamic.Texture.fetch(key) do
       depth =
         case type do
@@ -99,20 +117,83 @@ defmodule Scenic.Driver.Glfw.Cache do
           :rgba -> 4
         end
 
-      <<
-        @cmd_put_tx_raw::unsigned-integer-size(32)-native,
-        byte_size(key) + 1::unsigned-integer-size(32)-native,
-        byte_size(pixels)::unsigned-integer-size(32)-native,
-        depth::unsigned-integer-size(32)-native,
-        width::unsigned-integer-size(32)-native,
-        height::unsigned-integer-size(32)-native,
-        key::binary,
-        0::size(8),
-        pixels::binary
-      >>
-      |> Glfw.Port.send(port)
+      case chunked and byte_size(pixels) > @tx_chunk_size do
+        true ->
+          send_chunked(key, pixels, {depth, width, height}, port, shm)
+
+        false ->
+          <<
+            @cmd_put_tx_raw::unsigned-integer-size(32)-native,
+            byte_size(key) + 1::unsigned-integer-size(32)-native,
+            byte_size(pixels)::unsigned-integer-size(32)-native,
+            depth::unsigned-integer-size(32)-native,
+            width::unsigned-integer-size(32)-native,
+            height::unsigned-integer-size(32)-native,
+            key::binary,
+            0::size(8),
+            pixels::binary
+          >>
+          |> Glfw.Port.send_bulk(port, shm)
+      end
     else
       err -> IO.inspect(err, label: "load_dynamic_texture")
     end
   end
+
+  # --------------------------------------------------------
+  # true if the driver can take textures in pieces
+  @doc false
+  def chunked?(%{driver_info: %{caps: caps}}), do: (caps &&& @cap_tx_chunks) != 0
+  def chunked?(_), do: false
+
+  # --------------------------------------------------------
+  # stream a texture down in pieces. The driver keeps drawing while they
+  # arrive and only swaps the texture in at the commit. A depth of 0 means
+  # data is an image file rather than raw pixels. If the driver can't finish
+  # the upload it reports the texture missing, and the miss sends it again.
+  defp send_chunked(key, data, {depth, width, height}, port, shm) do
+    upload_id = System.unique_integer([:positive]) &&& 0xFFFFFFFF
+
+    <<
+      @cmd_put_tx_begin::unsigned-integer-size(32)-native,
+      upload_id::unsigned-integer-size(32)-native,
+      byte_size(key) + 1::unsigned-integer-size(32)-native,
+      byte_size(data)::unsigned-integer-size(32)-native,
+      depth::unsigned-integer-size(32)-native,
+      width::unsigned-integer-size(32)-native,
+      height::unsigned-integer-size(32)-native,
+      key::binary,
+      0::size(8)
+    >>
+    |> Glfw.Port.send(port)
+
+    send_chunks(upload_id, data, 0, port, shm)
+
+    <<
+      @cmd_put_tx_commit::unsigned-integer-size(32)-native,
+      upload_id::unsigned-integer-size(32)-native
+    >>
+    |> Glfw.Port.send(port)
+  end
+
+  defp send_chunks(_upload_id, data, offset, _port, _shm) when offset >= byte_size(data) do
+    :ok
+  end
+
+  defp send_chunks(upload_id, data, offset, port, shm) do
+    len = min(@tx_chunk_size, byte_size(data) - offset)
+
+    [
+      <<
+        @cmd_put_tx_chunk::unsigned-integer-size(32)-native,
+        upload_id::unsigned-integer-size(32)-native,
+        offset::unsigned-integer-size(32)-native,
+        len::unsigned-integer-size(32)-native
+      >>,
+      binary_part(data, offset, len)
+    ]
+    |> Glfw.Port.send_bulk(port, shm)
+
+    send_chunks(upload_id, data, offset + len, port, shm)
+  end
 end
@@ -8,6 +8,8 @@
 #
 
 defmodule Scenic.Driver.Glfw.Compile do
+  use Bitwise
+
   alias Scenic.Primitive
 
   require Logger
@@ -21,6 +23,7 @@ defmodule Scenic.Driver.Glfw.Compile do
   # @op_reset_state             0x03
 
   @op_run_script 0x04
+  @op_draw_instances 0x05
 
   # render styles
   @op_paint_linear 0x06
@@ -56,6 +59,8 @@ defmodule Scenic.Driver.Glfw.Compile do
   @op_path_arc_to 0x25
   @op_path_close 0x26
   @op_path_winding 0x27
+  @op_path_polyline 0x28
+  @op_path_polygon 0x2B
 
   @op_fill 0x29
   @op_stroke 0x2A
@@ -90,6 +95,10 @@ defmodule Scenic.Driver.Glfw.Compile do
 
   @op_terminate 0xFF
 
+  # script encodings the driver can take beyond the plain ops
+  @encoding_instances 0x02
+  @encoding_polylines 0x04
+
   # ============================================================================
 
   # --------------------------------------------------------
@@ -171,8 +180,14 @@ defmodule Scenic.Driver.Glfw.Compile do
 
   # --------------------------------------------------------
   defp do_compile_primitive(ops, %{data: {Primitive.Group, ids}}, graph, state) do
-    Enum.reduce(ids, ops, fn id, ops ->
-      compile_primitive(ops, graph[id], graph, state)
+    ids
+    |> group_instances(graph, state)
+    |> Enum.reduce(ops, fn
+      {:instances, script_id, offsets}, ops ->
+        op_draw_instances(ops, script_id, offsets)
+
+      id, ops ->
+        compile_primitive(ops, graph[id], graph, state)
     end)
   end
 
@@ -235,8 +250,16 @@ defmodule Scenic.Driver.Glfw.Compile do
     op_sector(ops, radius, start, finish)
   end
 
-  defp do_compile_primitive(ops, %{data: {Primitive.Path, actions}}, _, _) do
-    Enum.reduce(actions, ops, fn
+  defp do_compile_primitive(ops, %{data: {Primitive.Path, actions}}, _, state) do
+    actions
+    |> path_polylines(encoding?(state, @encoding_polylines))
+    |> Enum.reduce(ops, fn
+      {:polyline, points}, ops ->
+        op_path_points(ops, @op_path_polyline, points)
+
+      {:polygon, points}, ops ->
+        op_path_points(ops, @op_path_polygon, points)
+
       :begin, ops ->
         op_path_begin(ops)
 
@@ -317,6 +340,87 @@ defmodule Scenic.Driver.Glfw.Compile do
     ops
   end
 
+  # --------------------------------------------------------
+  # true if the driver can take scripts with this encoding
+  defp encoding?(%{driver_info: %{encodings: encodings}}, encoding),
+    do: (encodings &&& encoding) != 0
+
+  defp encoding?(_, _), do: false
+
+  # --------------------------------------------------------
+  # runs of children that draw the same graph, only moved, are drawn as
+  # instances of it when the driver can take them
+  defp group_instances(ids, graph, state) do
+    case encoding?(state, @encoding_instances) do
+      true ->
+        ids
+        |> Enum.chunk_by(&instance_of(graph[&1], state))
+        |> Enum.flat_map(fn [id | _] = run ->
+          case instance_of(graph[id], state) do
+            script_id when is_integer(script_id) and length(run) > 1 ->
+              [{:instances, script_id, Enum.map(run, &instance_offset(graph[&1]))}]
+
+            _ ->
+              run
+          end
+        end)
+
+      false ->
+        ids
+    end
+  end
+
+  # the script a child runs, if it does nothing else but move
+  defp instance_of(%{data: {Primitive.SceneRef, {:graph, _, _} = graph_key}} = p, %{
+         dl_map: dl_map
+       }) do
+    with styles when styles == %{} <- Map.get(p, :styles, %{}),
+         txs when txs == %{} <- Map.delete(Map.get(p, :transforms, %{}), :translate) do
+      dl_map[graph_key]
+    else
+      _ -> nil
+    end
+  end
+
+  defp instance_of(_, _), do: nil
+
+  defp instance_offset(p) do
+    p
+    |> Map.get(:transforms, %{})
+    |> Map.get(:translate, {0, 0})
+  end
+
+  # --------------------------------------------------------
+  # a move_to and the line_tos after it go as one list of points when the
+  # driver can take them that way. A close_path right after makes it a polygon
+  defp path_polylines(actions, false), do: actions
+  defp path_polylines(actions, true), do: collect_polylines(actions, [])
+
+  defp collect_polylines([], out), do: Enum.reverse(out)
+
+  defp collect_polylines([{:move_to, x, y} | actions], out) do
+    case take_line_tos(actions, [{x, y}]) do
+      {[_, _ | _] = points, [:close_path | actions]} ->
+        collect_polylines(actions, [{:polygon, Enum.reverse(points)} | out])
+
+      {[_, _ | _] = points, actions} ->
+        collect_polylines(actions, [{:polyline, Enum.reverse(points)} | out])
+
+      _ ->
+        collect_polylines(actions, [{:move_to, x, y} | out])
+    end
+  end
+
+  defp collect_polylines([action | actions], out) do
+    collect_polylines(actions, [action | out])
+  end
+
+  defp take_line_tos([{:line_to, x, y} | actions], points) do
+    take_line_tos(actions, [{x, y} | points])
+  end
+
+  defp take_line_tos(actions, points), do: {points, actions}
+
   # ============================================================================
   defp compile_styles(ops, %{styles: styles}) do
     Enum.reduce(styles, ops, fn {key, value}, ops -> do_compile_style(ops, key, value) end)
@@ -537,6 +641,34 @@ defmodule Scenic.Driver.Glfw.Compile do
   #   | ops]
   # end
 
+  # --------------------------------------------------------
+  # each instance is moved by a 2x3 matrix. These only translate, and have no
+  # tint
+  defp op_draw_instances(ops, script_id, offsets) do
+    matrices =
+      for {dx, dy} <- offsets, into: <<>> do
+        <<
+          1.0::float-size(32)-native,
+          0.0::float-size(32)-native,
+          0.0::float-size(32)-native,
+          1.0::float-size(32)-native,
+          dx::float-size(32)-native,
+          dy::float-size(32)-native
+        >>
+      end
+
+    [
+      <<
+        @op_draw_instances::unsigned-integer-size(32)-native,
+        script_id::unsigned-integer-size(32)-native,
+        length(offsets)::unsigned-integer-size(32)-native,
+        0::unsigned-integer-size(32)-native,
+        matrices::binary
+      >>
+      | ops
+    ]
+  end
+
   # --------------------------------------------------------
   defp op_paint_linear(ops, sx, sy, ex, ey, {sr, sg, sb, sa}, {er, eg, eb, ea}) do
     [
@@ -892,6 +1024,22 @@ defmodule Scenic.Driver.Glfw.Compile do
     ]
   end
 
+  defp op_path_points(ops, op, points) do
+    packed =
+      for {x, y} <- points, into: <<>> do
+        <<x::float-size(32)-native, y::float-size(32)-native>>
+      end
+
+    [
+      <<
+        op::unsigned-integer-size(32)-native,
+        length(points)::unsigned-integer-size(32)-native,
+        packed::binary
+      >>
+      | ops
+    ]
+  end
+
   defp op_path_bezier_to(ops, c1x, c1y, c2x, c2y, x, y) do
     [
       <<
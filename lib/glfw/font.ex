@@ -17,12 +17,12 @@ defmodule Scenic.Driver.Glfw.Font do
   @cmd_free_font 0x39
 
   # --------------------------------------------------------
-  def load_font(font_key, port)
+  def load_font(font_key, port, shm \\ nil)
 
-  def load_font(hash, port) when is_bitstring(hash) do
+  def load_font(hash, port, shm) when is_bitstring(hash) do
     case Cache.Static.Font.fetch(hash) do
       {:ok, font} ->
-        do_load_font(font, hash, port)
+        do_load_font(font, hash, port, shm)
 
       _ ->
         font_folder =
@@ -31,12 +31,12 @@ defmodule Scenic.Driver.Glfw.Font do
 
         with {:ok, ^hash} <- Cache.Static.Font.load(font_folder, hash),
              {:ok, font} <- Cache.Static.Font.fetch(hash) do
-          do_load_font(font, hash, port)
+          do_load_font(font, hash, port, shm)
         end
     end
   end
 
-  defp do_load_font(font_blob, font_hash, port) do
+  defp do_load_font(font_blob, font_hash, port, shm) do
     <<
       @cmd_load_font_blob::unsigned-integer-size(32)-native,
       byte_size(font_hash) + 1::unsigned-integer-size(32)-native,
@@ -46,7 +46,7 @@ defmodule Scenic.Driver.Glfw.Font do
       0::size(8),
       font_blob::binary
     >>
-    |> Glfw.Port.send(port)
+    |> Glfw.Port.send_bulk(port, shm)
   end
 
   # --------------------------------------------------------
@@ -65,34 +65,16 @@ defmodule Scenic.Driver.Glfw.Graph do
   # --------------------------------------------------------
   def handle_cast(
         :update_clear_color,
-        %{port: port, master_ref: master_graph_key, clear_color: old_clear_color} = state
+        %{port: port, clear_color: old_clear_color} = state
       ) do
-    with {:ok, master_graph} <- ViewPort.Tables.get_graph(master_graph_key),
-         {:ok, %{data: {Primitive.SceneRef, root_key}}} <- Map.fetch(master_graph, 1),
-         {:ok, graph} <- ViewPort.Tables.get_graph(root_key) do
-      root_group = graph[0]
-
-      clear_color =
-        (root_group
-         |> Map.get(:styles, %{})
-         |> Map.get(:clear_color) ||
-           root_group
-           |> Map.get(:styles, %{})
-           |> Map.get(:theme, %{})
-           |> Map.get(:background, :black))
-        |> Primitive.Style.Paint.Color.normalize()
-
-      if clear_color != old_clear_color do
+    case fetch_clear_color(state) do
+      {:ok, clear_color} when clear_color != old_clear_color ->
         # the color has changed. deal with it
         Port.clear_color(port, clear_color)
         {:noreply, %{state | clear_color: clear_color}}
-      else
-        # hasn't changed. Don't do anything
-        {:noreply, state}
-      end
-    else
+
       _ ->
-        # the graph isn't in the table. don't do anything
+        # hasn't changed or the graph isn't in the table. Don't do anything
         {:noreply, state}
     end
   end
@@ -120,12 +102,10 @@ defmodule Scenic.Driver.Glfw.Graph do
       |> Enum.uniq()
       |> Enum.reverse()
 
-    # render immediatly - sets graph_key as the root
+    # render immediatly - sets graph_key as the root and updates the
+    # clear color along with it
     state = render_graphs(keys, state, graph_key)
 
-    # update the clear color
-    GenServer.cast(self(), :update_clear_color)
-
     # {:noreply, %{state | root_ref: graph_key}}
     {:noreply, state}
   end
@@ -178,10 +158,12 @@ defmodule Scenic.Driver.Glfw.Graph do
         dl_id ->
           # clear the dl
           Port.clear_dl(port, dl_id)
+          Glfw.Patch.forget(state[:scripts], dl_id)
           # free the dl to go back into the pool
           state
           |> Utilities.Map.delete_in([:dl_map, graph_key])
           |> Utilities.Map.delete_in([:used_dls, dl_id])
+          |> Map.update!(:free_dls, &[dl_id | &1])
       end
 
     ViewPort.Tables.unsubscribe(graph_key, self())
@@ -201,6 +183,32 @@ defmodule Scenic.Driver.Glfw.Graph do
   # ============================================================================
   # render utilities
 
+  # --------------------------------------------------------
+  # the clear color is set on the root group of the root scene
+  defp fetch_clear_color(%{master_ref: master_graph_key}) do
+    with {:ok, master_graph} <- ViewPort.Tables.get_graph(master_graph_key),
+         {:ok, %{data: {Primitive.SceneRef, root_key}}} <- Map.fetch(master_graph, 1),
+         {:ok, graph} <- ViewPort.Tables.get_graph(root_key) do
+      root_group = graph[0]
+
+      clear_color =
+        (root_group
+         |> Map.get(:styles, %{})
+         |> Map.get(:clear_color) ||
+           root_group
+           |> Map.get(:styles, %{})
+           |> Map.get(:theme, %{})
+           |> Map.get(:background, :black))
+        |> Primitive.Style.Paint.Color.normalize()
+
+      {:ok, clear_color}
+    else
+      _ -> :error
+    end
+  end
+
+  defp fetch_clear_color(_), do: :error
+
   # --------------------------------------------------------
   # recursively build a list of all graphs keys
   defp recursive_graph_keys(graph_key, keys \\ []) do
@@ -252,21 +260,40 @@ defmodule Scenic.Driver.Glfw.Graph do
     # the C code is busy doing it's work
     driver = self()
 
-    root_id =
+    # setting a new root brings its clear color along with it
+    {state, root_msgs} =
       case root_key do
-        nil -> nil
-        key -> get_dl_id(key, state)
+        nil -> {state, []}
+        key -> root_msgs(key, state)
       end
 
+    # everything goes to the driver as one batch if it can take one, so it
+    # shows up all at once
     Task.start_link(fn ->
-      Enum.each(keys, &render_one_graph(driver, &1, state))
-      if root_id, do: Port.set_root_dl(port, root_id)
+      keys
+      |> Enum.map(&render_one_graph(driver, &1, state))
+      |> Enum.reject(&is_nil/1)
+      |> Kernel.++(root_msgs)
+      |> Port.send_all(port, state)
     end)
 
     # IO.puts "RENDER #{inspect(ids, charlists: :as_lists)}"
     %{state | currently_drawing: ids, draw_busy: true}
   end
 
+  # --------------------------------------------------------
+  defp root_msgs(root_key, %{clear_color: old_clear_color} = state) do
+    set_root = Port.set_root_dl_msg(get_dl_id(root_key, state))
+
+    case fetch_clear_color(state) do
+      {:ok, clear_color} when clear_color != old_clear_color ->
+        {%{state | clear_color: clear_color}, [set_root, Port.clear_color_msg(clear_color)]}
+
+      _ ->
+        {state, [set_root]}
+    end
+  end
+
   # --------------------------------------------------------
   # register the graph and its refswith the C driver. return the updated dl_map
   # do nothing if the graph is already registered.
@@ -294,7 +321,7 @@ defmodule Scenic.Driver.Glfw.Graph do
           state
           |> put_in([:dl_map, graph_key], dl_id)
           |> put_in([:used_dls, dl_id], graph_key)
-          |> Map.put(:last_used_dl, dl_id)
+          |> take_dl_id(dl_id)
 
         render_graphs([graph_key], state)
 
@@ -304,46 +331,32 @@ defmodule Scenic.Driver.Glfw.Graph do
     end
   end
 
-  defp find_open_dl_id(%{last_used_dl: last_used_dl} = state) do
-    do_find_open_dl_id(last_used_dl + 1, last_used_dl, state)
-  end
-
-  defp do_find_open_dl_id(try_id, stop_id, _) when try_id == stop_id do
-    {:error, :no_dl_id_free}
-  end
+  # freed ids are used again first. Otherwise take the next one that was never
+  # used, as long as the driver can hold it
+  defp find_open_dl_id(%{free_dls: [dl_id | _]}), do: {:ok, dl_id}
 
-  defp do_find_open_dl_id(
-         try_id,
-         stop_id,
-         %{
-           start_dl: start_dl,
-           end_dl: end_dl
-         } = state
-       )
-       when try_id > end_dl do
-    do_find_open_dl_id(start_dl, stop_id, state)
+  defp find_open_dl_id(%{last_used_dl: last_used_dl, end_dl: end_dl})
+       when last_used_dl < end_dl do
+    {:ok, last_used_dl + 1}
   end
 
-  defp do_find_open_dl_id(try_id, stop_id, %{used_dls: used_dls} = state) do
-    case used_dls[try_id] do
-      nil ->
-        # found one!
-        {:ok, try_id}
+  defp find_open_dl_id(_), do: {:error, :no_dl_id_free}
 
-      _ ->
-        # keep looking
-        do_find_open_dl_id(try_id + 1, stop_id, state)
-    end
+  defp take_dl_id(%{free_dls: [dl_id | free]} = state, dl_id) do
+    %{state | free_dls: free}
   end
 
+  defp take_dl_id(state, dl_id), do: Map.put(state, :last_used_dl, dl_id)
+
   # --------------------------------------------------------
   defp get_dl_id({:graph, _, _} = key, %{dl_map: dl_map}) do
     dl_map[key]
   end
 
   # --------------------------------------------------------
-  # render_one_graph renders one graph out to the C port.
-  # It uses data in state but doesn't transform it
+  # render_one_graph compiles one graph into the message for the C port.
+  # It uses data in state but doesn't transform it. Returns nil if there
+  # is nothing to send
   defp render_one_graph(
          driver,
          graph_key,
@@ -366,14 +379,21 @@ defmodule Scenic.Driver.Glfw.Graph do
       # hack the driver into the state map
       state = Map.put(state, :driver, driver)
 
-      [
-        <<
-          @cmd_render_graph::unsigned-integer-size(32)-native,
-          dl_id::unsigned-integer-size(32)-native
-        >>,
-        Glfw.Compile.graph(graph, graph_key, state)
-      ]
-      |> Port.send(port)
+      script = Glfw.Compile.graph(graph, graph_key, state)
+
+      case state[:scripts] do
+        nil ->
+          [
+            <<
+              @cmd_render_graph::unsigned-integer-size(32)-native,
+              dl_id::unsigned-integer-size(32)-native
+            >>,
+            script
+          ]
+
+        scripts ->
+          Glfw.Patch.script_msg(scripts, dl_id, script)
+      end
     else
       _ ->
         # the C driver didn't get called.
@@ -389,6 +409,7 @@ defmodule Scenic.Driver.Glfw.Graph do
         >>
 
         Process.send(driver, {port, {:data, msg}}, [])
+        nil
     end
   end
 
@@ -7,10 +7,10 @@
 defmodule Scenic.Driver.Glfw.Input do
   use Bitwise
 
+  alias Scenic.Driver.Glfw
   alias Scenic.Driver.Glfw.Cache
   alias Scenic.Driver.Glfw.Font
   alias Scenic.ViewPort
-  alias Scenic.Utilities
 
   require Logger
 
@@ -25,6 +25,7 @@ defmodule Scenic.Driver.Glfw.Input do
   @msg_reshape_id 0x05
   @msg_ready_id 0x06
   @msg_draw_ready_id 0x07
+  @msg_script_miss_id 0x08
 
   @msg_key_id 0x0A
   @msg_char_id 0x0B
@@ -33,67 +34,29 @@ defmodule Scenic.Driver.Glfw.Input do
   @msg_mouse_scroll_id 0x0E
   @msg_cursor_enter_id 0x0F
 
-  @msg_static_texture_miss 0x20
-  @msg_dynamic_texture_miss 0x21
+  @msg_event_batch_id 0x11
 
-  @msg_font_miss 0x22
+  # capabilities and script encodings the driver advertises when ready
+  @cap_shm 0x01
+  @cap_batch 0x02
+  @cap_patch_script 0x04
 
-  @debounce_speed 16
+  @encoding_ops 0x01
 
-  # ============================================================================
-  # debounce input
+  # size of each event's own fields in an event batch record
+  @event_sizes %{
+    @msg_key_id => 16,
+    @msg_char_id => 8,
+    @msg_cursor_pos_id => 8,
+    @msg_mouse_button_id => 20,
+    @msg_mouse_scroll_id => 16,
+    @msg_cursor_enter_id => 12
+  }
 
-  # --------------------------------------------------------
-  def handle_debounce(
-        type,
-        %{
-          draw_busy: true
-        } = state
-      ) do
-    # effectively skip a frame
-    Process.send_after(self(), {:debounce, type}, @debounce_speed)
-    {:noreply, state}
-  end
-
-  def handle_debounce(
-        type,
-        %{
-          debounce: debounce,
-          viewport: viewport,
-          draw_busy: false
-        } = state
-      ) do
-    case debounce[type] do
-      nil ->
-        :ok
-
-      msg ->
-        ViewPort.input(viewport, msg)
-    end
-
-    state = Utilities.Map.delete_in(state, [:debounce, type])
-    {:noreply, state}
-  end
-
-  # --------------------------------------------------------
-  defp debounce_input(
-         {type, _} = msg,
-         %{
-           debounce: debounce
-         } = state
-       ) do
-    state =
-      case debounce[type] do
-        nil ->
-          Process.send_after(self(), {:debounce, type}, @debounce_speed)
-          put_in(state, [:debounce, type], msg)
-
-        _ ->
-          put_in(state, [:debounce, type], msg)
-      end
+  @msg_static_texture_miss 0x20
+  @msg_dynamic_texture_miss 0x21
 
-    {:noreply, state}
-  end
+  @msg_font_miss 0x22
 
   # ============================================================================
 
@@ -101,28 +64,55 @@ defmodule Scenic.Driver.Glfw.Input do
   def handle_port_message(msg, state)
 
   # --------------------------------------------------------
+  # the driver says what it can do along with being ready. Optional fast paths
+  # are only used when it advertises them.
   def handle_port_message(
         <<
           @msg_ready_id::unsigned-integer-size(32)-native,
-          start_dl::integer-size(32)-native
+          start_dl::integer-size(32)-native,
+          _shm_mapped::unsigned-integer-size(32)-native,
+          version::unsigned-integer-size(32)-native,
+          caps::unsigned-integer-size(32)-native,
+          max_scripts::unsigned-integer-size(32)-native,
+          max_texture_size::unsigned-integer-size(32)-native,
+          encodings::unsigned-integer-size(32)-native
         >>,
-        %{
-          viewport: viewport,
-          dl_block_size: dl_block_size
-        } = state
+        state
       ) do
-    state =
+    driver_ready(
+      start_dl,
+      %{
+        version: version,
+        caps: caps,
+        max_scripts: max_scripts,
+        max_texture_size: max_texture_size,
+        encodings: encodings
+      },
       state
-      |> Map.put(:ready, true)
-      |> Map.put(:start_dl, start_dl)
-      |> Map.put(:end_dl, start_dl + dl_block_size - 1)
-      |> Map.put(:last_used_dl, start_dl)
-
-    # |> Glfw.Font.initialize()
-
-    GenServer.cast(viewport, {:driver_ready, self()})
+    )
+  end
 
-    {:noreply, state}
+  # --------------------------------------------------------
+  # a driver from before the handshake. It sends only where its scripts start
+  # and has none of the optional features
+  def handle_port_message(
+        <<
+          @msg_ready_id::unsigned-integer-size(32)-native,
+          start_dl::integer-size(32)-native
+        >>,
+        %{dl_block_size: dl_block_size} = state
+      ) do
+    driver_ready(
+      start_dl,
+      %{
+        version: 0,
+        caps: 0,
+        max_scripts: dl_block_size,
+        max_texture_size: 0,
+        encodings: @encoding_ops
+      },
+      state
+    )
   end
 
   # --------------------------------------------------------
@@ -148,6 +138,26 @@ defmodule Scenic.Driver.Glfw.Input do
     end
   end
 
+  # --------------------------------------------------------
+  # a patch didn't match the driver's copy of the script. Forget what we
+  # think it has and send the graph again whole.
+  def handle_port_message(
+        <<
+          @msg_script_miss_id::unsigned-integer-size(32)-native,
+          id::unsigned-integer-size(32)-native
+        >>,
+        %{used_dls: used_dls} = state
+      ) do
+    Glfw.Patch.forget(state[:scripts], id)
+
+    case used_dls[id] do
+      nil -> :ok
+      graph_key -> GenServer.cast(self(), {:update_graph, graph_key})
+    end
+
+    {:noreply, state}
+  end
+
   # --------------------------------------------------------
   def handle_port_message(
         <<
@@ -157,7 +167,7 @@ defmodule Scenic.Driver.Glfw.Input do
           frame_width::unsigned-integer-size(32)-native,
           frame_height::unsigned-integer-size(32)-native
         >>,
-        state
+        %{viewport: viewport} = state
       ) do
     state =
       state
@@ -165,7 +175,30 @@ defmodule Scenic.Driver.Glfw.Input do
       |> Map.put(:frame, {frame_width, frame_height})
       |> Map.put(:screen_factor, frame_width / window_width)
 
-    debounce_input({:viewport_reshape, {window_width, window_height}}, state)
+    # the driver already sends these at most once a frame
+    ViewPort.input(viewport, {:viewport_reshape, {window_width, window_height}})
+
+    {:noreply, state}
+  end
+
+  # --------------------------------------------------------
+  # all the input from one pass of the driver's main loop. Each record is the
+  # id the event would have been sent with on its own, when it happened in
+  # seconds on the driver's clock, and the event's fields padded to 20 bytes.
+  def handle_port_message(
+        <<@msg_event_batch_id::unsigned-integer-size(32)-native, events::binary>>,
+        state
+      ) do
+    state =
+      for <<id::unsigned-integer-size(32)-native, time::float-size(64)-native,
+            data::binary-size(20) <- events>>,
+          reduce: state do
+        state ->
+          size = Map.get(@event_sizes, id, 20)
+          msg = <<id::unsigned-integer-size(32)-native, binary_part(data, 0, size)::binary>>
+          {:noreply, state} = handle_port_message(msg, state)
+          Map.put(state, :last_input_time, time)
+      end
 
     {:noreply, state}
   end
@@ -214,7 +247,7 @@ defmodule Scenic.Driver.Glfw.Input do
         %{port: port} = state
       ) do
     Scenic.Cache.Static.Texture.subscribe(key, :all)
-    Cache.load_static_texture(key, port)
+    Cache.load_static_texture(key, port, state[:shm], Cache.chunked?(state))
     {:noreply, state}
   end
 
@@ -226,7 +259,7 @@ defmodule Scenic.Driver.Glfw.Input do
         %{port: port} = state
       ) do
     Scenic.Cache.Dynamic.Texture.subscribe(key, :all)
-    Cache.load_dynamic_texture(key, port)
+    Cache.load_dynamic_texture(key, port, state[:shm], Cache.chunked?(state))
     {:noreply, state}
   end
 
@@ -235,7 +268,7 @@ defmodule Scenic.Driver.Glfw.Input do
         <<@msg_font_miss::unsigned-integer-size(32)-native>> <> key,
         %{port: port} = state
       ) do
-    Font.load_font(key, port)
+    Font.load_font(key, port, state[:shm])
     {:noreply, state}
   end
 
@@ -281,9 +314,11 @@ defmodule Scenic.Driver.Glfw.Input do
           x::float-native-size(32),
           y::float-native-size(32)
         >>,
-        state
+        %{viewport: viewport} = state
       ) do
-    debounce_input({:cursor_pos, {x, y}}, state)
+    ViewPort.input(viewport, {:cursor_pos, {x, y}})
+
+    {:noreply, state}
   end
 
   # --------------------------------------------------------
@@ -315,9 +350,9 @@ defmodule Scenic.Driver.Glfw.Input do
           x_pos::float-native-size(32),
           y_pos::float-native-size(32)
         >>,
-        state
+        %{viewport: viewport} = state
       ) do
-    debounce_input({:cursor_scroll, {{x_offset, y_offset}, {x_pos, y_pos}}}, state)
+    ViewPort.input(viewport, {:cursor_scroll, {{x_offset, y_offset}, {x_pos, y_pos}}})
 
     {:noreply, state}
   end
@@ -524,4 +559,52 @@ defmodule Scenic.Driver.Glfw.Input do
   #  defp input_type_to_flags( :cursor_enter ),    do: 0x0020
   #  defp input_type_to_flags( :all ),            do: 0xFFFF
   #  defp input_type_to_flags( type ), do: raise Error, message: "Unknown input type: #{inspect(type)}"
+
+  # --------------------------------------------------------
+  defp driver_ready(start_dl, %{caps: caps, max_scripts: max_scripts} = info, state) do
+    # only send bulk messages through shared memory if the driver mapped it
+    shm =
+      case {caps &&& @cap_shm, state[:shm_ring]} do
+        {_, nil} ->
+          nil
+
+        {0, pid} ->
+          GenServer.stop(pid)
+          nil
+
+        {_, pid} ->
+          pid
+      end
+
+    # only keep copies of scripts to patch against if the driver can patch
+    scripts =
+      case {caps &&& @cap_patch_script, state[:scripts]} do
+        {_, nil} ->
+          nil
+
+        {0, table} ->
+          :ets.delete(table)
+          nil
+
+        {_, table} ->
+          table
+      end
+
+    state =
+      state
+      |> Map.put(:ready, true)
+      |> Map.put(:driver_info, info)
+      |> Map.put(:start_dl, start_dl)
+      |> Map.put(:end_dl, start_dl + max_scripts - 1)
+      |> Map.put(:last_used_dl, start_dl)
+      |> Map.put(:shm, shm)
+      |> Map.put(:scripts, scripts)
+      |> Map.put(:batch, (caps &&& @cap_batch) != 0)
+
+    # |> Glfw.Font.initialize()
+
+    GenServer.cast(state.viewport, {:driver_ready, self()})
+
+    {:noreply, state}
+  end
 end
@@ -0,0 +1,136 @@
+#
+#  sends changed scripts to the C driver as patches against the copy it
+#  already has, instead of sending the whole script again.
+#
+# The last script sent for each id is kept in an ets table along with a tag.
+# A patch names the tag it was made against and the tag of the result. If the
+# driver's copy doesn't match, it says so and the graph is sent again whole.
+#
+defmodule Scenic.Driver.Glfw.Patch do
+  @cmd_patch_script 0x04
+
+  # size of the pieces the changed part of a script is compared in
+  @chunk_size 64
+
+  # bytes of header in front of each edit
+  @edit_header_size 12
+
+  # --------------------------------------------------------
+  @doc false
+  def new_table(), do: :ets.new(:scenic_driver_glfw_scripts, [:set, :public])
+
+  # --------------------------------------------------------
+  @doc false
+  def forget(nil, _dl_id), do: :ok
+  def forget(table, dl_id), do: :ets.delete(table, dl_id)
+
+  # --------------------------------------------------------
+  # build the message that turns the driver's script dl_id into script
+  @doc false
+  def script_msg(table, dl_id, script) do
+    script = IO.iodata_to_binary(script)
+    tag = next_tag(table)
+
+    msg =
+      with [{^dl_id, base_tag, base}] <- :ets.lookup(table, dl_id),
+           edits = diff(base, script),
+           true <- patch_size(edits) < div(byte_size(script), 2) do
+        encode(dl_id, base_tag, tag, byte_size(base), edits)
+      else
+        # nothing to patch against, or not worth it
+        _ -> encode(dl_id, 0, tag, 0, [{0, 0, script}])
+      end
+
+    :ets.insert(table, {dl_id, tag, script})
+    msg
+  end
+
+  # tags are never 0. That means there is no base
+  defp next_tag(table) do
+    :ets.update_counter(table, :tag, {2, 1, 0xFFFFFFFF, 1}, {:tag, 0})
+  end
+
+  # --------------------------------------------------------
+  # work out the edits that turn base into script. Each is
+  # {offset in base, bytes to delete, bytes to insert}
+  @doc false
+  def diff(base, script) do
+    base_size = byte_size(base)
+    script_size = byte_size(script)
+
+    # trim what is the same at both ends. Don't let the ends overlap
+    prefix = :binary.longest_common_prefix([base, script])
+    suffix = :binary.longest_common_suffix([base, script])
+    suffix = min(suffix, min(base_size, script_size) - prefix)
+
+    delete_len = base_size - prefix - suffix
+    insert_len = script_size - prefix - suffix
+
+    cond do
+      delete_len == 0 and insert_len == 0 ->
+        []
+
+      # nothing moved. only send the pieces that changed
+      delete_len == insert_len ->
+        diff_chunks(base, script, prefix, prefix + insert_len, [])
+
+      true ->
+        [{prefix, delete_len, binary_part(script, prefix, insert_len)}]
+    end
+  end
+
+  defp diff_chunks(_, _, offset, stop, edits) when offset >= stop do
+    Enum.reverse(edits)
+  end
+
+  defp diff_chunks(base, script, offset, stop, edits) do
+    len = min(@chunk_size, stop - offset)
+    new = binary_part(script, offset, len)
+
+    edits =
+      case binary_part(base, offset, len) == new do
+        true -> edits
+        false -> add_edit(edits, offset, len, new)
+      end
+
+    diff_chunks(base, script, offset + len, stop, edits)
+  end
+
+  # runs of changed chunks become one edit
+  defp add_edit([{prev_offset, prev_len, bytes} | edits], offset, len, new)
+       when prev_offset + prev_len == offset do
+    [{prev_offset, prev_len + len, [bytes, new]} | edits]
+  end
+
+  defp add_edit(edits, offset, len, new), do: [{offset, len, new} | edits]
+
+  defp patch_size(edits) do
+    Enum.reduce(edits, 0, fn {_, _, bytes}, size ->
+      size + @edit_header_size + IO.iodata_length(bytes)
+    end)
+  end
+
+  # --------------------------------------------------------
+  defp encode(dl_id, base_tag, tag, base_size, edits) do
+    [
+      <<
+        @cmd_patch_script::unsigned-integer-size(32)-native,
+        dl_id::unsigned-integer-size(32)-native,
+        base_tag::unsigned-integer-size(32)-native,
+        tag::unsigned-integer-size(32)-native,
+        base_size::unsigned-integer-size(32)-native,
+        length(edits)::unsigned-integer-size(32)-native
+      >>
+      | Enum.map(edits, fn {offset, len, bytes} ->
+          [
+            <<
+              offset::unsigned-integer-size(32)-native,
+              len::unsigned-integer-size(32)-native,
+              IO.iodata_length(bytes)::unsigned-integer-size(32)-native
+            >>,
+            bytes
+          ]
+        end)
+    ]
+  end
+end
@@ -5,7 +5,7 @@
 # a collection of functions for handling port specific messages
 #
 defmodule Scenic.Driver.Glfw.Port do
-  #  alias Scenic.Driver.Glfw
+  alias Scenic.Driver.Glfw
 
   @msg_stats_id 0x01
 
@@ -24,6 +24,8 @@ defmodule Scenic.Driver.Glfw.Port do
   @cmd_set_root_dl 0x03
   @cmd_clear_color 0x05
 
+  @cmd_batch 0x41
+
   # @cmd_new_dl_id            0x30
   # @cmd_free_dl_id           0x31
   # @cmd_new_tx_id            0x32
@@ -58,6 +60,34 @@ defmodule Scenic.Driver.Glfw.Port do
     end
   end
 
+  # send a potentially large message. If the driver mapped the shared memory
+  # ring, big ones go through that instead of being copied down the port.
+  @doc false
+  def send_bulk(msg, port, nil), do: __MODULE__.send(msg, port)
+
+  def send_bulk(msg, port, shm), do: Glfw.Shm.send(shm, port, msg)
+
+  # send several messages as one batch, which the driver applies all together
+  @doc false
+  def send_batch([], _port, _shm), do: :ok
+  def send_batch([msg], port, shm), do: send_bulk(msg, port, shm)
+  def send_batch(msgs, port, nil), do: msgs |> batch() |> __MODULE__.send(port)
+  def send_batch(msgs, port, shm), do: Glfw.Shm.send_batch(shm, port, msgs)
+
+  # send several messages. As one batch if the driver said it can take them
+  @doc false
+  def send_all(msgs, port, %{batch: true} = state), do: send_batch(msgs, port, state[:shm])
+  def send_all(msgs, port, state), do: Enum.each(msgs, &send_bulk(&1, port, state[:shm]))
+
+  # each message in the batch is prefixed with its length
+  @doc false
+  def batch(msgs) do
+    [
+      <<@cmd_batch::unsigned-integer-size(32)-native>>
+      | Enum.map(msgs, &[<<IO.iodata_length(&1)::unsigned-integer-size(32)-native>>, &1])
+    ]
+  end
+
   # ============================================================================
   # all internal functions.
 
@@ -93,27 +123,27 @@ defmodule Scenic.Driver.Glfw.Port do
   end
 
   @doc false
-  def set_root_dl(port, root_dl) do
-    Port.command(
-      port,
-      <<
-        @cmd_set_root_dl::unsigned-integer-size(32)-native,
-        root_dl::integer-size(32)-native
-      >>
-    )
+  def set_root_dl(port, root_dl), do: Port.command(port, set_root_dl_msg(root_dl))
+
+  @doc false
+  def set_root_dl_msg(root_dl) do
+    <<
+      @cmd_set_root_dl::unsigned-integer-size(32)-native,
+      root_dl::integer-size(32)-native
+    >>
   end
 
-  def clear_color(port, {r, g, b, a}) do
-    Port.command(
-      port,
-      <<
-        @cmd_clear_color::unsigned-integer-size(32)-native,
-        r::unsigned-integer-size(32)-native,
-        g::unsigned-integer-size(32)-native,
-        b::unsigned-integer-size(32)-native,
-        a::unsigned-integer-size(32)-native
-      >>
-    )
+  def clear_color(port, color), do: Port.command(port, clear_color_msg(color))
+
+  @doc false
+  def clear_color_msg({r, g, b, a}) do
+    <<
+      @cmd_clear_color::unsigned-integer-size(32)-native,
+      r::unsigned-integer-size(32)-native,
+      g::unsigned-integer-size(32)-native,
+      b::unsigned-integer-size(32)-native,
+      a::unsigned-integer-size(32)-native
+    >>
   end
 
   # ============================================================================
@@ -163,10 +193,38 @@ defmodule Scenic.Driver.Glfw.Port do
       receive do
         {^port,
          {:data,
-          <<@msg_stats_id::size(8), input_flags::unsigned-integer-native-size(32),
-            x_pos::integer-native-size(32), y_pos::integer-native-size(32),
-            width::integer-native-size(32), height::integer-native-size(32), focused::size(8),
-            resizable::size(8), iconified::size(8), maximized::size(8), visible::size(8)>>}} ->
+          <<@msg_stats_id::unsigned-integer-native-size(32),
+            input_flags::unsigned-integer-native-size(32), x_pos::integer-native-size(32),
+            y_pos::integer-native-size(32), width::integer-native-size(32),
+            height::integer-native-size(32), focused::size(8), resizable::size(8),
+            iconified::size(8), maximized::size(8), visible::size(8),
+            frame_msgs_out::unsigned-integer-native-size(32),
+            frame_bytes_out::unsigned-integer-native-size(32),
+            frame_writes_out::unsigned-integer-native-size(32),
+            frame_time::float-native-size(64),
+            lane_control::unsigned-integer-native-size(32),
+            lane_scripts::unsigned-integer-native-size(32),
+            lane_bulk::unsigned-integer-native-size(32),
+            scripts_live::unsigned-integer-native-size(32),
+            scripts_peak::unsigned-integer-native-size(32),
+            retained_hits::unsigned-integer-native-size(32),
+            retained_records::unsigned-integer-native-size(32),
+            retained_bytes::unsigned-integer-native-size(32),
+            frames_partial::unsigned-integer-native-size(32),
+            frames_full::unsigned-integer-native-size(32),
+            cache_hits::unsigned-integer-native-size(32),
+            cache_misses::unsigned-integer-native-size(32),
+            cache_bytes::unsigned-integer-native-size(32),
+            culled_skipped::unsigned-integer-native-size(32),
+            culled_drawn::unsigned-integer-native-size(32),
+            text_hits::unsigned-integer-native-size(32),
+            text_misses::unsigned-integer-native-size(32),
+            text_bytes::unsigned-integer-native-size(32),
+            ops_received::unsigned-integer-native-size(32),
+            ops_kept::unsigned-integer-native-size(32),
+            profile_ops::unsigned-integer-native-size(32),
+            profile_buckets::unsigned-integer-native-size(32),
+            profile_frequency::unsigned-integer-native-size(64), profile::binary>>}} ->
           {:ok,
            %{
              input_flags: input_flags,
@@ -179,6 +237,36 @@ defmodule Scenic.Driver.Glfw.Port do
              iconified: iconified != 0,
              maximized: maximized != 0,
              visible: visible != 0,
+             # messages, bytes and writes sent up during the last frame
+             frame_out: %{
+               msgs: frame_msgs_out,
+               bytes: frame_bytes_out,
+               writes: frame_writes_out
+             },
+             # when the last frame was presented and when the latest input
+             # event happened, both in seconds on the driver's clock
+             frame_time: frame_time,
+             last_input_time: state[:last_input_time],
+             # messages waiting in the driver, by lane
+             lanes: %{control: lane_control, scripts: lane_scripts, bulk: lane_bulk},
+             # scripts the driver holds now, and the most it has held at once
+             scripts: %{live: scripts_live, peak: scripts_peak},
+             # times drawing was replayed, kept, and what the kept drawing takes
+             retained: %{hits: retained_hits, records: retained_records, bytes: retained_bytes},
+             # frames that only drew what changed, and frames that drew it all
+             frames: %{partial: frames_partial, full: frames_full},
+             # times scripts were drawn from a texture, cached textures thrown
+             # away, and what the textures take
+             cache: %{hits: cache_hits, misses: cache_misses, bytes: cache_bytes},
+             # scripts skipped in the last frame because nothing they draw
+             # could be seen, and scripts that were drawn
+             culled: %{skipped: culled_skipped, drawn: culled_drawn},
+             # text drawn from its layout, text laid out, and what the layouts take
+             text: %{hits: text_hits, misses: text_misses, bytes: text_bytes},
+             # ops in the scripts received, and left to run once optimized
+             ops: %{received: ops_received, kept: ops_kept},
+             # script op counts and times, if the driver is profiling them
+             profile: decode_profile(profile_ops, profile_buckets, profile_frequency, profile),
              pid: self(),
              module: __MODULE__
            }}
@@ -189,6 +277,29 @@ defmodule Scenic.Driver.Glfw.Port do
     {:reply, reply, state}
   end
 
+  # --------------------------------------------------------
+  # times are in ticks of the driver's timer, which runs at frequency per second.
+  # the histogram counts op times in power of two buckets of ticks.
+  defp decode_profile(0, 0, _, _), do: nil
+
+  defp decode_profile(op_count, bucket_count, frequency, profile) do
+    ops_size = op_count * 20
+    histogram_size = bucket_count * 8
+
+    <<ops::binary-size(ops_size), histogram::binary-size(histogram_size)>> = profile
+
+    ops =
+      for <<op::unsigned-integer-native-size(32), count::unsigned-integer-native-size(64),
+            ticks::unsigned-integer-native-size(64) <- ops>>,
+          into: %{},
+          do: {op, %{count: count, ticks: ticks}}
+
+    histogram =
+      for <<count::unsigned-integer-native-size(64) <- histogram>>, do: count
+
+    %{frequency: frequency, ops: ops, histogram: histogram}
+  end
+
   # ============================================================================
   @doc false
   def handle_cast(msg, state)
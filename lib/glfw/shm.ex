@@ -0,0 +1,222 @@
+#
+# optional shared memory transport for bulk messages to the C driver.
+#
+# Large messages (scripts, textures, fonts) are written into a ring buffer
+# in a POSIX shared memory object that the driver maps. Only a small
+# descriptor goes down the port. The driver writes the position it has
+# released up to back into the ring's header, so no acks are needed.
+#
+# The BEAM can't map memory, so the object is written through its file
+# under /dev/shm. Where that doesn't exist, or if the ring is full, messages
+# just go down the port as before.
+#
+defmodule Scenic.Driver.Glfw.Shm do
+  use GenServer
+  use Bitwise
+
+  alias Scenic.Driver.Glfw
+
+  require Logger
+
+  @shm_dir "/dev/shm"
+
+  @magic 0x53484D31
+  @header_size 64
+  @released_offset 8
+
+  @cmd_shm_msg 0x40
+
+  # smaller messages aren't worth the trip through shared memory
+  @min_bulk 0x4000
+
+  # ============================================================================
+  # client api
+
+  # --------------------------------------------------------
+  @doc false
+  def start_link(size) when is_integer(size) and size > 0 do
+    GenServer.start_link(__MODULE__, size)
+  end
+
+  # --------------------------------------------------------
+  # the name the driver passes to shm_open
+  @doc false
+  def name(shm), do: GenServer.call(shm, :name)
+
+  # --------------------------------------------------------
+  # send a message through the ring. Falls back to the port if it is small or
+  # doesn't fit
+  @doc false
+  def send(shm, port, msg) do
+    case IO.iodata_length(msg) >= @min_bulk do
+      true -> GenServer.call(shm, {:send, port, IO.iodata_to_binary(msg)})
+      false -> Glfw.Port.send(msg, port)
+    end
+  end
+
+  # --------------------------------------------------------
+  # send a batch, with the big messages in it going through the ring. The
+  # descriptors have to reach the port in ring order, so the batch is sent
+  # from here too.
+  @doc false
+  def send_batch(shm, port, msgs) when is_list(msgs) do
+    GenServer.call(shm, {:send_batch, port, msgs})
+  end
+
+  # ============================================================================
+  # server
+
+  # --------------------------------------------------------
+  @doc false
+  def init(size) do
+    Process.flag(:trap_exit, true)
+
+    name = "scenic_driver_glfw_#{:os.getpid()}_#{System.unique_integer([:positive])}"
+    path = Path.join(@shm_dir, name)
+
+    header = <<
+      @magic::unsigned-integer-size(32)-native,
+      size::unsigned-integer-size(32)-native,
+      0::unsigned-integer-size(32)-native
+    >>
+
+    with true <- File.dir?(@shm_dir),
+         {:ok, file} <- :file.open(to_charlist(path), [:raw, :binary, :read, :write]),
+         :ok <- :file.pwrite(file, 0, header),
+         {:ok, _} <- :file.position(file, @header_size + size),
+         :ok <- :file.truncate(file) do
+      {:ok,
+       %{
+         file: file,
+         path: path,
+         name: "/" <> name,
+         size: size,
+         offset: 0,
+         head: 0,
+         released: 0,
+         sequence: 0
+       }}
+    else
+      _ -> :ignore
+    end
+  end
+
+  # --------------------------------------------------------
+  @doc false
+  def handle_call(:name, _from, %{name: name} = state) do
+    {:reply, name, state}
+  end
+
+  # --------------------------------------------------------
+  def handle_call({:send, port, msg}, _from, state) do
+    {msg, state} = put(msg, state)
+    Glfw.Port.send(msg, port)
+    {:reply, :ok, state}
+  end
+
+  # --------------------------------------------------------
+  def handle_call({:send_batch, port, msgs}, _from, state) do
+    {msgs, state} =
+      Enum.map_reduce(msgs, state, fn msg, state ->
+        case IO.iodata_length(msg) >= @min_bulk do
+          true -> put(IO.iodata_to_binary(msg), state)
+          false -> {msg, state}
+        end
+      end)
+
+    msgs
+    |> Glfw.Port.batch()
+    |> Glfw.Port.send(port)
+
+    {:reply, :ok, state}
+  end
+
+  # --------------------------------------------------------
+  @doc false
+  def terminate(_reason, %{file: file, path: path}) do
+    # the driver normally unlinks it as soon as it is mapped
+    :file.close(file)
+    File.rm(path)
+  end
+
+  # ============================================================================
+  # ring management. offset is where the next message goes. head and released
+  # are running byte counts that wrap at 32 bits.
+
+  # --------------------------------------------------------
+  defp reserve(len, %{size: size}) when len > size, do: :full
+
+  defp reserve(len, %{size: size, offset: offset, head: head} = state) do
+    # messages are always contiguous. skip to the start if it won't fit
+    {offset, skip} =
+      case offset + len > size do
+        true -> {0, size - offset}
+        false -> {offset, 0}
+      end
+
+    state = refresh_released(skip + len, state)
+
+    case used(state) + skip + len <= size do
+      true -> {:ok, offset, %{state | head: wrap(head + skip)}}
+      false -> :full
+    end
+  end
+
+  # only read the header when the cached position isn't enough
+  defp refresh_released(needed, %{size: size, file: file} = state) do
+    case used(state) + needed <= size do
+      true ->
+        state
+
+      false ->
+        case :file.pread(file, @released_offset, 4) do
+          {:ok, <<released::unsigned-integer-size(32)-native>>} ->
+            %{state | released: released}
+
+          _ ->
+            state
+        end
+    end
+  end
+
+  defp used(%{head: head, released: released}), do: wrap(head - released)
+
+  defp wrap(n), do: band(n, 0xFFFFFFFF)
+
+  # --------------------------------------------------------
+  # write a message into the ring. Returns the descriptor to send down the
+  # port in its place, or the message itself if it has to go the slow way.
+  defp put(msg, state) do
+    case reserve(byte_size(msg), state) do
+      {:ok, offset, state} ->
+        write(msg, offset, state)
+
+      :full ->
+        # the driver is behind. go the slow way, which keeps the order
+        {msg, state}
+    end
+  end
+
+  # --------------------------------------------------------
+  defp write(msg, offset, %{file: file, head: head, sequence: sequence} = state) do
+    len = byte_size(msg)
+    head = wrap(head + len)
+
+    case :file.pwrite(file, @header_size + offset, msg) do
+      :ok ->
+        desc = <<
+          @cmd_shm_msg::unsigned-integer-size(32)-native,
+          sequence::unsigned-integer-size(32)-native,
+          offset::unsigned-integer-size(32)-native,
+          len::unsigned-integer-size(32)-native,
+          head::unsigned-integer-size(32)-native
+        >>
+
+        {desc, %{state | offset: offset + len, head: head, sequence: wrap(sequence + 1)}}
+
+      err ->
+        Logger.error("Glfw.Shm write failed: #{inspect(err)}")
+        {msg, state}
+    end
+  end
+end
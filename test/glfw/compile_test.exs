@@ -0,0 +1,215 @@
+defmodule Scenic.Driver.Glfw.CompileTest do
+  use ExUnit.Case, async: true
+  alias Scenic.Driver.Glfw.Compile
+  alias Scenic.Primitive
+
+  @graph_key {:graph, :compile_test, nil}
+  @icon_key {:graph, :icon, nil}
+  @badge_key {:graph, :badge, nil}
+  @dl_map %{@icon_key => 7, @badge_key => 9}
+
+  @encoding_instances 0x02
+  @encoding_polylines 0x04
+
+  # --------------------------------------------------------
+  # the expected ops, in the driver's byte order
+
+  defp u32(values) do
+    for v <- List.wrap(values), into: <<>>, do: <<v::unsigned-integer-size(32)-native>>
+  end
+
+  defp f32(values) do
+    for v <- List.wrap(values), into: <<>>, do: <<v::float-size(32)-native>>
+  end
+
+  # every primitive is wrapped in a push and pop, with a path begun after its
+  # transforms and styles
+  defp primitive(head, body \\ <<>>), do: u32(0x01) <> head <> u32(0x20) <> body <> u32(0x02)
+
+  defp root(children), do: primitive(<<>>, children) <> u32(0xFF)
+
+  defp translate(x, y), do: u32(0x39) <> f32([x, y])
+  defp run_script(id), do: u32([0x04, id])
+
+  defp draw_instances(id, offsets) do
+    u32([0x05, id, length(offsets), 0]) <>
+      for {x, y} <- offsets, into: <<>>, do: f32([1.0, 0.0, 0.0, 1.0, x, y])
+  end
+
+  defp move_to(x, y), do: u32(0x21) <> f32([x, y])
+  defp line_to(x, y), do: u32(0x22) <> f32([x, y])
+  defp close_path(), do: u32(0x26)
+
+  defp points(op, points) do
+    u32([op, length(points)]) <> for {x, y} <- points, into: <<>>, do: f32([x, y])
+  end
+
+  defp polyline(pts), do: points(0x28, pts)
+  defp polygon(pts), do: points(0x2B, pts)
+
+  defp path(actions), do: %{data: {Primitive.Path, actions}}
+
+  defp ref(key, x, y) do
+    %{data: {Primitive.SceneRef, key}, transforms: %{translate: {x, y}}}
+  end
+
+  defp compile(children, encodings) do
+    ids = Enum.to_list(1..length(children))
+
+    graph =
+      children
+      |> Enum.zip(ids)
+      |> Enum.into(%{0 => %{data: {Primitive.Group, ids}}}, fn {p, id} -> {id, p} end)
+
+    state = %{dl_map: @dl_map, driver_info: %{encodings: encodings}}
+
+    graph
+    |> Compile.graph(@graph_key, state)
+    |> IO.iodata_to_binary()
+  end
+
+  # --------------------------------------------------------
+  # instances
+
+  test "a run of moved references to a graph is drawn as instances" do
+    children = [ref(@icon_key, 10.0, 20.0), ref(@icon_key, 30.0, 40.0), ref(@icon_key, 50.0, 60.0)]
+
+    assert compile(children, @encoding_instances) ==
+             root(draw_instances(7, [{10.0, 20.0}, {30.0, 40.0}, {50.0, 60.0}]))
+  end
+
+  test "references are run one at a time when the driver can't take instances" do
+    children = [ref(@icon_key, 10.0, 20.0), ref(@icon_key, 30.0, 40.0)]
+
+    assert compile(children, 0x05) ==
+             root(
+               primitive(translate(10.0, 20.0), run_script(7)) <>
+                 primitive(translate(30.0, 40.0), run_script(7))
+             )
+  end
+
+  test "a reference with styles is not an instance" do
+    styled = Map.put(ref(@icon_key, 30.0, 40.0), :styles, %{join: :round})
+    children = [ref(@icon_key, 10.0, 20.0), styled]
+
+    assert compile(children, @encoding_instances) ==
+             root(
+               primitive(translate(10.0, 20.0), run_script(7)) <>
+                 primitive(translate(30.0, 40.0) <> u32([0x16, 1]), run_script(7))
+             )
+  end
+
+  test "a reference with more than a translation is not an instance" do
+    scaled = %{
+      data: {Primitive.SceneRef, @icon_key},
+      transforms: %{translate: {30.0, 40.0}, scale: {2.0, 2.0}}
+    }
+
+    children = [ref(@icon_key, 10.0, 20.0), scaled]
+
+    assert compile(children, @encoding_instances) ==
+             root(
+               primitive(translate(10.0, 20.0), run_script(7)) <>
+                 primitive(translate(30.0, 40.0) <> u32(0x3A) <> f32([2.0, 2.0]), run_script(7))
+             )
+  end
+
+  test "only runs of more than one reference to the same graph are instances" do
+    children = [
+      ref(@icon_key, 1.0, 2.0),
+      ref(@icon_key, 3.0, 4.0),
+      %{data: {Primitive.Rectangle, {5.0, 6.0}}},
+      ref(@icon_key, 7.0, 8.0),
+      ref(@badge_key, 9.0, 10.0),
+      ref(@badge_key, 11.0, 12.0)
+    ]
+
+    assert compile(children, @encoding_instances) ==
+             root(
+               draw_instances(7, [{1.0, 2.0}, {3.0, 4.0}]) <>
+                 primitive(<<>>, u32(0x2E) <> f32([5.0, 6.0])) <>
+                 primitive(translate(7.0, 8.0), run_script(7)) <>
+                 draw_instances(9, [{9.0, 10.0}, {11.0, 12.0}])
+             )
+  end
+
+  test "references to graphs the driver doesn't have yet are left empty" do
+    missing = {:graph, :missing, nil}
+    children = [ref(missing, 10.0, 20.0), ref(missing, 30.0, 40.0)]
+
+    assert compile(children, @encoding_instances) ==
+             root(primitive(translate(10.0, 20.0)) <> primitive(translate(30.0, 40.0)))
+  end
+
+  # --------------------------------------------------------
+  # polylines
+
+  test "a move_to on its own stays a move_to" do
+    children = [path([{:move_to, 1.0, 2.0}])]
+    assert compile(children, @encoding_polylines) == root(primitive(<<>>, move_to(1.0, 2.0)))
+  end
+
+  test "a move_to and a close_path are not a polygon" do
+    children = [path([{:move_to, 1.0, 2.0}, :close_path])]
+
+    assert compile(children, @encoding_polylines) ==
+             root(primitive(<<>>, move_to(1.0, 2.0) <> close_path()))
+  end
+
+  test "each move_to starts a polyline of its own" do
+    children = [
+      path([
+        {:move_to, 0.0, 0.0},
+        {:line_to, 1.0, 1.0},
+        {:line_to, 2.0, 0.0},
+        {:move_to, 5.0, 5.0},
+        {:line_to, 6.0, 6.0},
+        :close_path
+      ])
+    ]
+
+    assert compile(children, @encoding_polylines) ==
+             root(
+               primitive(
+                 <<>>,
+                 polyline([{0.0, 0.0}, {1.0, 1.0}, {2.0, 0.0}]) <>
+                   polygon([{5.0, 5.0}, {6.0, 6.0}])
+               )
+             )
+  end
+
+  test "line_tos after a bezier stay line_tos" do
+    children = [
+      path([
+        {:move_to, 0.0, 0.0},
+        {:bezier_to, 1.0, 1.0, 2.0, 2.0, 3.0, 3.0},
+        {:line_to, 4.0, 4.0},
+        {:line_to, 5.0, 5.0}
+      ])
+    ]
+
+    assert compile(children, @encoding_polylines) ==
+             root(
+               primitive(
+                 <<>>,
+                 move_to(0.0, 0.0) <>
+                   u32(0x23) <>
+                   f32([1.0, 1.0, 2.0, 2.0, 3.0, 3.0]) <> line_to(4.0, 4.0) <> line_to(5.0, 5.0)
+               )
+             )
+  end
+
+  test "paths are sent an action at a time when the driver can't take polylines" do
+    children = [
+      path([{:move_to, 0.0, 0.0}, {:line_to, 1.0, 1.0}, {:line_to, 2.0, 0.0}, :close_path])
+    ]
+
+    assert compile(children, @encoding_instances) ==
+             root(
+               primitive(
+                 <<>>,
+                 move_to(0.0, 0.0) <> line_to(1.0, 1.0) <> line_to(2.0, 0.0) <> close_path()
+               )
+             )
+  end
+end
@@ -0,0 +1,65 @@
+defmodule Scenic.Driver.Glfw.InputTest do
+  use ExUnit.Case, async: true
+  alias Scenic.Driver.Glfw.Input
+
+  @msg_ready_id 0x06
+  @msg_key_id 0x0A
+  @msg_cursor_pos_id 0x0C
+  @msg_event_batch_id 0x11
+
+  # an event batch record. The event's fields are padded to 20 bytes with
+  # junk, which has to be trimmed off before the event is handled
+  defp record(id, time, fields) do
+    padding = :binary.copy(<<0xEE>>, 20 - byte_size(fields))
+
+    <<id::unsigned-integer-size(32)-native, time::float-size(64)-native, fields::binary,
+      padding::binary>>
+  end
+
+  test "a batch of events goes to the ViewPort in order" do
+    key =
+      <<
+        ?A::unsigned-integer-size(32)-native,
+        38::unsigned-integer-size(32)-native,
+        1::unsigned-integer-size(32)-native,
+        2::unsigned-integer-size(32)-native
+      >>
+
+    cursor = <<10.5::float-size(32)-native, 20.0::float-size(32)-native>>
+
+    msg =
+      <<@msg_event_batch_id::unsigned-integer-size(32)-native>> <>
+        record(@msg_key_id, 1.5, key) <> record(@msg_cursor_pos_id, 2.25, cursor)
+
+    assert byte_size(msg) == 4 + 2 * 32
+
+    {:noreply, state} = Input.handle_port_message(msg, %{viewport: self()})
+
+    assert {:messages,
+            [
+              {:"$gen_cast", {:input, {:key, {"A", :press, 2}}}},
+              {:"$gen_cast", {:input, {:cursor_pos, {10.5, 20.0}}}}
+            ]} = Process.info(self(), :messages)
+    assert state.last_input_time == 2.25
+  end
+
+  test "an empty batch leaves the state alone" do
+    msg = <<@msg_event_batch_id::unsigned-integer-size(32)-native>>
+    assert Input.handle_port_message(msg, %{viewport: self()}) == {:noreply, %{viewport: self()}}
+    refute_received {:"$gen_cast", _}
+  end
+
+  test "a ready message from a driver without the handshake is accepted" do
+    msg = <<@msg_ready_id::unsigned-integer-size(32)-native, 3::integer-size(32)-native>>
+
+    {:noreply, state} =
+      Input.handle_port_message(msg, %{viewport: self(), dl_block_size: 512})
+
+    assert state.ready == true
+    assert state.driver_info.caps == 0
+    assert state.driver_info.encodings == 0x01
+    assert state.start_dl == 3
+    assert state.end_dl == 3 + 512 - 1
+    assert_received {:"$gen_cast", {:driver_ready, _}}
+  end
+end
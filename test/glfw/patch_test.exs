@@ -0,0 +1,150 @@
+defmodule Scenic.Driver.Glfw.PatchTest do
+  use ExUnit.Case, async: true
+  alias Scenic.Driver.Glfw.Patch
+
+  @cmd_patch_script 0x04
+
+  # apply the edits the way the driver does. Offsets are into base, so work
+  # back from the end
+  defp apply_edits(base, edits) do
+    edits
+    |> Enum.sort_by(fn {offset, _, _} -> offset end, &>=/2)
+    |> Enum.reduce(base, fn {offset, len, bytes}, acc ->
+      <<head::binary-size(offset), _::binary-size(len), tail::binary>> = acc
+      head <> IO.iodata_to_binary(bytes) <> tail
+    end)
+  end
+
+  defp decode(msg) do
+    <<
+      @cmd_patch_script::unsigned-integer-size(32)-native,
+      dl_id::unsigned-integer-size(32)-native,
+      base_tag::unsigned-integer-size(32)-native,
+      tag::unsigned-integer-size(32)-native,
+      base_size::unsigned-integer-size(32)-native,
+      count::unsigned-integer-size(32)-native,
+      rest::binary
+    >> = IO.iodata_to_binary(msg)
+
+    {edits, <<>>} =
+      Enum.map_reduce(List.duplicate(nil, count), rest, fn _, bin ->
+        <<
+          offset::unsigned-integer-size(32)-native,
+          len::unsigned-integer-size(32)-native,
+          size::unsigned-integer-size(32)-native,
+          bytes::binary-size(size),
+          bin::binary
+        >> = bin
+
+        {{offset, len, bytes}, bin}
+      end)
+
+    %{dl_id: dl_id, base_tag: base_tag, tag: tag, base_size: base_size, edits: edits}
+  end
+
+  defp bytes(n, seed), do: for(i <- 1..n, into: <<>>, do: <<rem((i - 1) * 31 + seed, 251)>>)
+
+  # --------------------------------------------------------
+  # diff
+
+  test "diff of the same script is empty" do
+    script = bytes(300, 1)
+    assert Patch.diff(script, script) == []
+  end
+
+  test "diff against an empty base inserts the whole script" do
+    script = bytes(100, 1)
+    edits = Patch.diff(<<>>, script)
+    assert edits == [{0, 0, script}]
+    assert apply_edits(<<>>, edits) == script
+  end
+
+  test "diff handles an insert" do
+    base = bytes(300, 1)
+    <<head::binary-size(120), tail::binary>> = base
+    script = head <> bytes(40, 7) <> tail
+    assert apply_edits(base, Patch.diff(base, script)) == script
+  end
+
+  test "diff handles a delete" do
+    base = bytes(300, 1)
+    <<head::binary-size(50), _::binary-size(90), tail::binary>> = base
+    script = head <> tail
+    edits = Patch.diff(base, script)
+    assert [{50, 90, _}] = edits
+    assert apply_edits(base, edits) == script
+  end
+
+  test "diff of a same size change only sends the chunks that changed" do
+    base = bytes(400, 1)
+
+    # chunks start where the scripts first differ, at 60. The second change
+    # crosses into the second chunk, the third is in the last one
+    <<a::binary-size(60), _::binary-size(10), b::binary-size(50), _::binary-size(10),
+      c::binary-size(170), _::binary-size(4), d::binary>> = base
+
+    script = a <> bytes(10, 9) <> b <> bytes(10, 9) <> c <> bytes(4, 3) <> d
+    edits = Patch.diff(base, script)
+
+    assert [{60, 128, _}, {252, 52, _}] = edits
+    assert apply_edits(base, edits) == script
+  end
+
+  # --------------------------------------------------------
+  # script_msg
+
+  test "script_msg sends the whole script when there is nothing to patch" do
+    table = Patch.new_table()
+    script = bytes(200, 1)
+    msg = decode(Patch.script_msg(table, 3, script))
+    assert msg.dl_id == 3
+    assert msg.base_tag == 0
+    assert msg.base_size == 0
+    assert msg.tag != 0
+    assert msg.edits == [{0, 0, script}]
+  end
+
+  test "script_msg patches the last script sent" do
+    table = Patch.new_table()
+    base = bytes(400, 1)
+    first = decode(Patch.script_msg(table, 3, base))
+
+    <<head::binary-size(200), _::binary-size(8), tail::binary>> = base
+    script = head <> bytes(8, 5) <> tail
+    msg = decode(Patch.script_msg(table, 3, script))
+
+    assert msg.base_tag == first.tag
+    assert msg.tag != first.tag
+    assert msg.base_size == byte_size(base)
+    assert apply_edits(base, msg.edits) == script
+  end
+
+  test "script_msg sends the whole script when a patch would be half of it or more" do
+    ends = fn middle -> :binary.copy(<<1>>, 70) <> middle <> :binary.copy(<<2>>, 70) end
+    base = ends.(<<>>)
+
+    # 12 bytes of edit header and 100 inserted is under half of 240
+    table = Patch.new_table()
+    Patch.script_msg(table, 3, base)
+    script = ends.(:binary.copy(<<3>>, 100))
+    msg = decode(Patch.script_msg(table, 3, script))
+    assert msg.base_tag != 0
+    assert msg.edits == [{70, 0, :binary.copy(<<3>>, 100)}]
+
+    # 12 and 116 is exactly half of 256
+    table = Patch.new_table()
+    Patch.script_msg(table, 3, base)
+    script = ends.(:binary.copy(<<3>>, 116))
+    msg = decode(Patch.script_msg(table, 3, script))
+    assert msg.base_tag == 0
+    assert msg.base_size == 0
+    assert msg.edits == [{0, 0, script}]
+  end
+
+  test "forget drops the copy so the next script is sent whole" do
+    table = Patch.new_table()
+    Patch.script_msg(table, 3, bytes(400, 1))
+    Patch.forget(table, 3)
+    assert decode(Patch.script_msg(table, 3, bytes(400, 2))).base_tag == 0
+  end
+end
@@ -37,7 +37,6 @@ defmodule Scenic.Driver.GlfwTest do
     assert state.clear_color == {0, 0, 0, 255}
     assert state.closing == false
     assert state.currently_drawing == []
-    assert state.debounce == %{}
     assert state.dirty_graphs == []
     assert state.dl_block_size == 512
     assert state.dl_map == %{}
@@ -45,10 +44,13 @@ defmodule Scenic.Driver.GlfwTest do
     assert state.fonts == %{}
     assert state.frame == @size
     assert state.last_used_dl == nil
+    assert state.free_dls == []
     assert state.pending_flush == false
     assert is_port(state.port)
     assert state.ready == false
     assert state.root_ref == nil
+    assert state.batch == false
+    assert state.driver_info == nil
     assert state.screen_factor == 1.0
     assert state.textures == %{}
     assert state.used_dls == %{}